@@ -0,0 +1,1332 @@
+/*
+** bench.c
+** Benchmarks the hot paths of the libraries, and prints the results as JSON lines
+** -------------------------------------------
+** Made by Gilles Henrard
+** Last modified : 17/10/2026
+*/
+
+#include "global.h"
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include "screen.h"
+#include "dataset.h"
+#include "serialisation.h"
+#include "protocol.h"
+#include "metrics.h"
+
+#define ITERATIONS  10000000    // default amount of iterations per benchmark
+#define SWAP_ELEMS  4096        // amount of integers per batch in the swap benchmark
+#define FLOAT_VALUES 1024       // amount of different values in the float benchmark
+#define CRC_BLOCK   64          // bytes per operation in the crc benchmark (a cache line)
+#define CRC_HOT     (64 << 10)  // buffer summed over and over (fits in the caches)
+#define CRC_COLD    (256 << 20) // buffer summed from memory
+#define LOG_SHARE   10          // fraction of the iterations logged in the log benchmark
+#define LOG_THREADS 4           // threads logging at once in the log benchmark
+#define LOG_BURST   256         // lines logged at once, then written while the benchmark waits
+#define CATALOG_NAMES 10000     // names listed in the catalog benchmark (a large directory)
+#define CATALOG_LARGE 1000000   // names looked up in the catalog benchmark (a huge directory)
+#define CATALOG_NAME "f%07ld"   // name of the files in the catalog benchmark
+#define CATALOG_SHARE 1000      // fraction of the iterations run on the linked list in the catalog benchmark
+#define CATALOG_STEP 7919       // prime stride between the names looked up (all of them, in scattered order)
+#define LOAD_SHARE  10000       // fraction of the iterations run as sessions, per concurrency, in the load benchmark
+#define LOAD_MAXCONC 10000      // sessions run at once at most in the load benchmark
+#define LOAD_SIZES  16          // different file sizes in a mix at most
+#define LOAD_OPTS   8           // options passed on to the server at most
+#define LOAD_STACK  (256 << 10) // stack of the threads running the sessions
+#define LOAD_BUFSZ  (1 << 20)   // random bytes written over and over in the files served
+#define LOAD_BACKLOG "4096"     // pending connections held by the server benchmarked
+#define LOAD_TIMEOUT 10         // time given to a session to send or receive anything (s)
+#define LOAD_WAIT   5000        // time given to the server to listen (ms)
+#define LOAD_NAME   "f%06d"     // name of the files served (listed after "." and "..")
+
+typedef struct{
+    char* name;                 // name of the benchmark
+    int (*run)(long);           // function running the benchmark
+}bench_t;
+
+typedef struct{
+    char* concurrency;          // sessions run at once (comma-separated list, a run each)
+    char* sizes;                // mix of file sizes (size[:weight], comma-separated)
+    int files;                  // amount of files listed by the server
+    uint32_t caps;              // capabilities advertised by the sessions
+    char* options[LOAD_OPTS + 4];   // options passed on to the server
+    int nbopts;                 // amount of options passed on to the server
+}loadopt_t;
+
+typedef struct{
+    char port[8];               // port on which the server listens
+    int files;                  // amount of files listed by the server
+    uint32_t caps;              // capabilities advertised by the sessions
+    long sessions;              // sessions to run
+    long claimed;               // sessions claimed by the threads so far
+}load_t;
+
+int bench_pack(long iterations);
+int bench_swap(long iterations);
+int bench_float(long iterations);
+int bench_crc(long iterations);
+int bench_log(long iterations);
+void* log_worker(void* arg);
+int bench_catalog(long iterations);
+int catalog_fill(catalog_t* cat, int nbnames);
+int catalog_lookups(catalog_t* cat, char* suffix, long iterations);
+int bench_load(long iterations);
+int load_files(char* directory, int files, char* mix);
+int load_server(char* directory, char* port, pid_t* pid);
+void* load_worker(void* arg);
+int load_session(load_t* load, int out, int file, int* sockfd);
+int load_fail(int* sockfd);
+void load_report(int concurrency, double elapsed, shard_t* measures);
+double now_ns();
+void report(char* bench, char* variant, long iterations, double elapsed);
+
+bench_t benches[] = {
+    {"pack", bench_pack},
+    {"swap", bench_swap},
+    {"float", bench_float},
+    {"crc", bench_crc},
+    {"log", bench_log},
+    {"catalog", bench_catalog},
+    {"load", bench_load},
+    {NULL, NULL}
+};
+
+volatile uint64_t sink = 0;
+loadopt_t loadopt = {"1,16,256", "4k,64k,1m", 100, PF_LISTZ, {0}, 0};
+
+int main(int argc, char *argv[])
+{
+    long iterations = ITERATIONS;
+    bench_t* b = NULL;
+    int opt = 0;
+
+	//parse the options (of the load benchmark)
+	while((opt = getopt(argc, argv, "c:f:l:m:t:o:pkd")) != -1)
+	{
+        switch(opt)
+        {
+            case 'c': //sessions run at once (a run per value)
+                loadopt.concurrency = optarg;
+                break;
+
+            case 'f': //mix of file sizes served
+                loadopt.sizes = optarg;
+                break;
+
+            case 'l': //amount of files listed
+                if((loadopt.files = atoi(optarg)) < 1)
+                {
+                    print_error("bench: invalid amount of files %s", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'p': //file chosen in the hello, the sessions are pipelined
+                loadopt.caps |= PF_STREAM;
+                break;
+
+            case 'k': //a connection kept by each thread, the files requested without the list
+                loadopt.caps |= PF_KEEP;
+                break;
+
+            case 'd': //files received in datagrams (UDP)
+                loadopt.caps |= PF_UDP;
+                break;
+
+            case 'm': //options passed on to the server
+            case 't':
+            case 'o':
+                if(loadopt.nbopts + 2 > LOAD_OPTS)
+                {
+                    print_error("bench: too many options for the server (%d at most)", LOAD_OPTS);
+                    exit(EXIT_FAILURE);
+                }
+                if(opt != 'o')
+                    loadopt.options[loadopt.nbopts++] = (opt == 'm' ? "-m" : "-t");
+                loadopt.options[loadopt.nbopts++] = optarg;
+                break;
+
+            default:
+                print_error("usage: bench [-c concurrency] [-f sizes] [-l files] [-p] [-k] [-d] [-m mode] [-t threads] [-o option] name|all [iterations]");
+                exit(EXIT_FAILURE);
+        }
+	}
+
+	//checks if the benchmark name has been provided
+	if (argc - optind < 1 || argc - optind > 2)
+	{
+        print_error("usage: bench [-c concurrency] [-f sizes] [-l files] [-p] [-k] [-d] [-m mode] [-t threads] [-o option] name|all [iterations]");
+		exit(EXIT_FAILURE);
+	}
+
+	if(argc - optind == 2 && (iterations = atol(argv[optind+1])) < 1)
+	{
+        print_error("bench: invalid amount of iterations %s", argv[optind+1]);
+		exit(EXIT_FAILURE);
+	}
+
+    //run all the benchmarks matching the name
+    for(b = benches ; b->name ; b++)
+    {
+        if(!strcmp(argv[optind], "all") || !strcmp(argv[optind], b->name))
+        {
+            if((*b->run)(iterations) == -1)
+                exit(EXIT_FAILURE);
+        }
+    }
+
+	exit(EXIT_SUCCESS);
+}
+
+/************************************************************************/
+/*  I : /                                                               */
+/*  P : Gives the time of a monotonic clock                             */
+/*  O : time in nanoseconds                                             */
+/************************************************************************/
+double now_ns()
+{
+    struct timespec ts = {0};
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/************************************************************************/
+/*  I : name of the benchmark                                           */
+/*      name of the variant measured                                    */
+/*      amount of iterations                                            */
+/*      time elapsed (in nanoseconds)                                   */
+/*  P : Prints the result of a measure as a JSON line                   */
+/*  O : /                                                               */
+/************************************************************************/
+void report(char* bench, char* variant, long iterations, double elapsed)
+{
+    printf("{\"bench\":\"%s\",\"variant\":\"%s\",\"iterations\":%ld,\"ns_per_op\":%.2f}\n",
+           bench, variant, iterations, elapsed / iterations);
+}
+
+/************************************************************************/
+/*  I : amount of iterations                                            */
+/*  P : Compares the header (de)serialisation through the interpreted   */
+/*          pack()/unpack(), a compiled format, and the specialised     */
+/*          protocol functions                                          */
+/*  O : -1 on error                                                     */
+/*       0 otherwise                                                    */
+/************************************************************************/
+int bench_pack(long iterations)
+{
+    unsigned char serialised[HEAD_SZ] = {0};
+    head_t header = {0, SFILE, 0}, check = {0};
+    uint64_t values[3] = {0};
+    packfmt_t fmt = {0};
+    double start = 0.0;
+    long i = 0;
+
+    if(compile_format(&fmt, HEAD_F) == -1)
+    {
+        print_error("bench: unable to compile the format %s", HEAD_F);
+        return -1;
+    }
+
+    //interpreted format
+    start = now_ns();
+    for(i = 0 ; i < iterations ; i++)
+    {
+        header.nbelem = i;
+        header.szelem = i;
+        pack(serialised, HEAD_F, header.nbelem, header.stype, header.szelem);
+        unpack(serialised, HEAD_F, &check.nbelem, &check.stype, &check.szelem);
+        sink += check.szelem;
+    }
+    report("pack", "interpreted", iterations, now_ns() - start);
+
+    //compiled format
+    start = now_ns();
+    for(i = 0 ; i < iterations ; i++)
+    {
+        values[0] = i;
+        values[1] = SFILE;
+        values[2] = i;
+        packf(serialised, &fmt, values);
+        unpackf(serialised, &fmt, values);
+        sink += values[2];
+    }
+    report("pack", "compiled", iterations, now_ns() - start);
+
+    //specialised header functions
+    start = now_ns();
+    for(i = 0 ; i < iterations ; i++)
+    {
+        header.nbelem = i;
+        header.szelem = i;
+        pmkhead(serialised, &header);
+        punpackhead(serialised, &check);
+        sink += check.szelem;
+    }
+    report("pack", "specialised", iterations, now_ns() - start);
+
+    //all the variants must agree on the serialised form
+    header.nbelem = 0x01020304;
+    header.szelem = 0x0102030405060708;
+    pmkhead(serialised, &header);
+    values[0] = 0;
+    unpackf(serialised, &fmt, values);
+    unpack(serialised, HEAD_F, &check.nbelem, &check.stype, &check.szelem);
+    if(values[0] != header.nbelem || values[2] != header.szelem || check.szelem != header.szelem)
+    {
+        print_error("bench: the serialised headers do not match");
+        return -1;
+    }
+
+    return 0;
+}
+
+/************************************************************************/
+/*  I : amount of integers to swap, per kernel and width                */
+/*  P : Checks that every batch kernel gives the same bytes as the      */
+/*          scalar packiN()/unpackuN(), then measures them              */
+/*  O : -1 on error                                                     */
+/*       0 otherwise                                                    */
+/************************************************************************/
+int bench_swap(long iterations)
+{
+    static uint64_t values[SWAP_ELEMS], check[SWAP_ELEMS];
+    static unsigned char buf[SWAP_ELEMS * 8], ref[SWAP_ELEMS * 8];
+    char* names[] = {"", "scalar", "ssse3", "avx2"};
+    unsigned int widths[] = {2, 4, 8}, w = 0;
+    char variant[32] = {0};
+    long passes = (iterations + SWAP_ELEMS - 1) / SWAP_ELEMS, p = 0;
+    size_t n = 0, i = 0;
+    double start = 0.0;
+    int k = 0;
+
+    for(i = 0 ; i < SWAP_ELEMS ; i++)
+        values[i] = 0x0123456789ABCDEFULL * (i + 1);
+
+    for(k = SWAP_SCALAR ; k <= SWAP_AVX2 ; k++)
+    {
+        if(setswapkernel(k) == -1)
+            continue;
+
+        for(w = 0 ; w < sizeof(widths) / sizeof(*widths) ; w++)
+        {
+            //odd amounts of integers, to go through the scalar tails
+            for(n = 0 ; n < 67 ; n++)
+            {
+                memset(buf, 0, sizeof(buf));
+                memset(check, 0, sizeof(check));
+                for(i = 0 ; i < n ; i++)
+                {
+                    switch(widths[w])
+                    {
+                    case 2:
+                        packi16(ref + 2*i, (uint16_t)values[i]);
+                        ((uint16_t*)check)[i] = (uint16_t)values[i];
+                        break;
+                    case 4:
+                        packi32(ref + 4*i, (uint32_t)values[i]);
+                        ((uint32_t*)check)[i] = (uint32_t)values[i];
+                        break;
+                    default:
+                        packi64(ref + 8*i, values[i]);
+                        check[i] = values[i];
+                        break;
+                    }
+                }
+
+                switch(widths[w])
+                {
+                case 2:
+                    packa16(buf, (uint16_t*)check, n);
+                    unpacka16((uint16_t*)check, ref, n);
+                    for(i = 0 ; i < n && ((uint16_t*)check)[i] == unpacku16(ref + 2*i) ; i++);
+                    break;
+                case 4:
+                    packa32(buf, (uint32_t*)check, n);
+                    unpacka32((uint32_t*)check, ref, n);
+                    for(i = 0 ; i < n && ((uint32_t*)check)[i] == unpacku32(ref + 4*i) ; i++);
+                    break;
+                default:
+                    packa64(buf, check, n);
+                    unpacka64(check, ref, n);
+                    for(i = 0 ; i < n && check[i] == unpacku64(ref + 8*i) ; i++);
+                    break;
+                }
+
+                if(i < n || memcmp(buf, ref, n * widths[w]) || buf[n * widths[w]])
+                {
+                    print_error("bench: %s kernel differs from the scalar functions (%u bytes, %lu integers)", names[k], widths[w], n);
+                    return -1;
+                }
+            }
+
+            //measure
+            start = now_ns();
+            for(p = 0 ; p < passes ; p++)
+            {
+                switch(widths[w])
+                {
+                case 2:
+                    packa16(buf, (uint16_t*)values, SWAP_ELEMS);
+                    break;
+                case 4:
+                    packa32(buf, (uint32_t*)values, SWAP_ELEMS);
+                    break;
+                default:
+                    packa64(buf, values, SWAP_ELEMS);
+                    break;
+                }
+                sink += buf[p % sizeof(buf)];
+            }
+            sprintf(variant, "%s/%u", names[k], widths[w] * 8);
+            report("swap", variant, passes * SWAP_ELEMS, now_ns() - start);
+        }
+    }
+
+    //measure the former one-at-a-time functions as a reference
+    start = now_ns();
+    for(p = 0 ; p < passes ; p++)
+    {
+        for(i = 0 ; i < SWAP_ELEMS ; i++)
+            packi64(buf + 8*i, values[i]);
+        sink += buf[p % sizeof(buf)];
+    }
+    report("swap", "packi64", passes * SWAP_ELEMS, now_ns() - start);
+
+    setswapkernel(SWAP_AUTO);
+    return 0;
+}
+
+/************************************************************************/
+/*  I : amount of iterations                                            */
+/*  P : Checks the IEEE-754 conversions (native and generic) on special */
+/*          and random values, then measures the f, d and g codes of    */
+/*          pack()/unpack() and the conversions themselves              */
+/*  O : -1 on error                                                     */
+/*       0 otherwise                                                    */
+/************************************************************************/
+int bench_float(long iterations)
+{
+    unsigned char serialised[8] = {0};
+    double values[FLOAT_VALUES] = {0};
+    uint64_t bits = 0x9E3779B97F4A7C15ULL;
+    long double g = 0.0;
+    double x = 0.0;
+    float f = 0.0, d = 0.0;
+    double start = 0.0;
+    long i = 0;
+
+    //every float-16 pattern must survive a generic round trip
+    for(i = 0 ; i < 0x10000 ; i++)
+    {
+        g = unpack754_16(i);
+        if(isnan(g) ? !isnan(unpack754_16(pack754_16(g))) : pack754_16(g) != (uint64_t)i)
+        {
+            print_error("bench: float-16 0x%04lx does not survive a round trip", i);
+            return -1;
+        }
+    }
+
+    //random float-32 and float-64 patterns (subnormals, infinities, NaN
+    //  included) : generic and native conversions must agree
+    for(i = 0 ; i < 1000000 ; i++)
+    {
+        bits ^= bits << 13;
+        bits ^= bits >> 7;
+        bits ^= bits << 17;
+        x = unpack754_f64(bits);
+        f = unpack754_f32((uint32_t)bits);
+        if(isnan(x) || isnan(f))
+            continue;
+        if(pack754(x, 64, 11) != bits || pack754(f, 32, 8) != (uint32_t)bits
+           || unpack754(bits, 64, 11) != x || unpack754((uint32_t)bits, 32, 8) != f)
+        {
+            print_error("bench: generic and native conversions differ on 0x%016lx", bits);
+            return -1;
+        }
+    }
+    if(!isnan(unpack754(pack754(NAN, 64, 11), 64, 11)) || unpack754(pack754(-INFINITY, 32, 8), 32, 8) != -INFINITY
+       || pack754(-0.0, 64, 11) != pack754_f64(-0.0))
+    {
+        print_error("bench: NaN, infinities or -0 are not converted properly");
+        return -1;
+    }
+
+    //values over the whole exponents range
+    for(i = 0 ; i < FLOAT_VALUES ; i++)
+        values[i] = ldexp(1.0 + i / (double)FLOAT_VALUES, (i * 37) % 2000 - 1000);
+
+    start = now_ns();
+    for(i = 0 ; i < iterations ; i++)
+        sink += pack754(values[i % FLOAT_VALUES], 64, 11);
+    report("float", "generic/64", iterations, now_ns() - start);
+
+    start = now_ns();
+    for(i = 0 ; i < iterations ; i++)
+        sink += pack754_64(values[i % FLOAT_VALUES]);
+    report("float", "native/64", iterations, now_ns() - start);
+
+    //codes of pack()/unpack()
+    start = now_ns();
+    for(i = 0 ; i < iterations ; i++)
+    {
+        pack(serialised, "f", (float)values[i % 64]);
+        unpack(serialised, "f", &f);
+        sink += serialised[1];
+    }
+    report("float", "pack f", iterations, now_ns() - start);
+
+    start = now_ns();
+    for(i = 0 ; i < iterations ; i++)
+    {
+        pack(serialised, "d", (float)values[i % FLOAT_VALUES]);
+        unpack(serialised, "d", &d);
+        sink += serialised[3];
+    }
+    report("float", "pack d", iterations, now_ns() - start);
+
+    start = now_ns();
+    for(i = 0 ; i < iterations ; i++)
+    {
+        pack(serialised, "g", (long double)values[i % FLOAT_VALUES]);
+        unpack(serialised, "g", &g);
+        sink += serialised[7];
+    }
+    report("float", "pack g", iterations, now_ns() - start);
+
+    return 0;
+}
+
+/************************************************************************/
+/*  I : amount of blocks of CRC_BLOCK bytes to sum, per variant         */
+/*  P : Checks the CRC32C kernels against the standard check value and  */
+/*          against each other (any length, alignment and chaining),    */
+/*          then measures them, the former Adler-32, and a plain read   */
+/*          of the data, on a buffer in the caches and one in memory    */
+/*  O : -1 on error                                                     */
+/*       0 otherwise                                                    */
+/************************************************************************/
+int bench_crc(long iterations)
+{
+    char* names[] = {"", "crc32c/scalar", "crc32c/sse42"};
+    char* sizes[] = {"hot", "cold"};
+    size_t lengths[] = {CRC_HOT, CRC_COLD}, len = 0, off = 0, done = 0, cut = 0;
+    unsigned char* buf = NULL;
+    uint32_t ref = 0, sum = 0;
+    char variant[32] = {0};
+    double start = 0.0;
+    int k = 0, v = 0;
+    long i = 0;
+
+    if((buf = malloc(CRC_COLD)) == NULL)
+    {
+        print_error("bench: unable to allocate %d bytes", CRC_COLD);
+        return -1;
+    }
+
+    //random bytes, none equal to 0xFF (searched to read the whole buffer)
+    srand(42);
+    for(len = 0 ; len < CRC_COLD ; len++)
+        buf[len] = rand() % 0xFF;
+
+    for(k = CRC_SCALAR ; k <= CRC_SSE42 ; k++)
+    {
+        if(setcrckernel(k) == -1)
+            continue;
+
+        //standard check value
+        if(crc32c(CRC32C_INIT, "123456789", 9) != 0xE3069283)
+        {
+            print_error("bench: %s gives %08X as check value", names[k], crc32c(CRC32C_INIT, "123456789", 9));
+            free(buf);
+            return -1;
+        }
+
+        //any length (through the interleaved blocks), alignment and chaining
+        for(i = 0 ; i < 2000 ; i++)
+        {
+            off = rand() % 64;
+            len = (i < 1000 ? (size_t)i : (size_t)rand() % (CRC_LONG * 8));
+            cut = (len ? (size_t)rand() % len : 0);
+            setcrckernel(CRC_SCALAR);
+            ref = crc32c(CRC32C_INIT, buf + off, len);
+            setcrckernel(k);
+            sum = crc32c(crc32c(CRC32C_INIT, buf + off, cut), buf + off + cut, len - cut);
+            if(crc32c(CRC32C_INIT, buf + off, len) != ref || sum != ref)
+            {
+                print_error("bench: %s differs from the tables (%lu bytes at +%lu, cut at %lu)", names[k], len, off, cut);
+                free(buf);
+                return -1;
+            }
+        }
+    }
+
+    for(v = 0 ; v < 2 ; v++)
+    {
+        for(k = CRC_SCALAR ; k <= CRC_SSE42 ; k++)
+        {
+            if(setcrckernel(k) == -1)
+                continue;
+
+            start = now_ns();
+            for(done = 0 ; done < (size_t)iterations * CRC_BLOCK ; done += lengths[v])
+                sink += crc32c(CRC32C_INIT, buf, lengths[v]);
+            sprintf(variant, "%s/%s", names[k], sizes[v]);
+            report("crc", variant, done / CRC_BLOCK, now_ns() - start);
+        }
+
+        //checksum used before CRC32C
+        start = now_ns();
+        for(done = 0 ; done < (size_t)iterations * CRC_BLOCK ; done += lengths[v])
+            sink += adlersum(ADLER_INIT, buf, lengths[v]);
+        sprintf(variant, "adler32/%s", sizes[v]);
+        report("crc", variant, done / CRC_BLOCK, now_ns() - start);
+
+        //reading the data without computing anything (bandwidth reference)
+        start = now_ns();
+        for(done = 0 ; done < (size_t)iterations * CRC_BLOCK ; done += lengths[v])
+            sink += (memchr(buf, 0xFF, lengths[v]) != NULL);
+        sprintf(variant, "read/%s", sizes[v]);
+        report("crc", variant, done / CRC_BLOCK, now_ns() - start);
+    }
+
+    setcrckernel(CRC_AUTO);
+    free(buf);
+    return 0;
+}
+
+/************************************************************************/
+/*  I : amount of iterations                                            */
+/*  P : Compares the cost of a log line written by the caller, and      */
+/*          queued for the background writer (by bursts the writer      */
+/*          catches up with, then continuously by one and several      */
+/*          threads, the queue staying full)                           */
+/*  O : -1 on error                                                     */
+/*       0 otherwise                                                    */
+/************************************************************************/
+int bench_log(long iterations)
+{
+    pthread_t threads[LOG_THREADS];
+    struct timespec pause = {.tv_nsec = 1000000};
+    long lines = iterations / LOG_SHARE + 1, share = 0, done = 0;
+    double start = 0.0, elapsed = 0.0;
+    int saved = 0, devnull = 0, i = 0;
+
+    //the lines logged are thrown away
+    fflush(stderr);
+    if((saved = dup(STDERR_FILENO)) == -1 || (devnull = open("/dev/null", O_WRONLY)) == -1)
+    {
+        print_error("bench: unable to redirect the logs: %s", strerror(errno));
+        return -1;
+    }
+    dup2(devnull, STDERR_FILENO);
+    close(devnull);
+
+    start = now_ns();
+    log_worker(&lines);
+    fflush(stderr);
+    report("log", "sync", lines, now_ns() - start);
+
+    //bursts queued while the writer keeps up (cost seen by the callers)
+    setlogmode(LOG_ASYNC);
+    share = LOG_BURST;
+    for(done = 0 ; done < lines ; done += LOG_BURST)
+    {
+        start = now_ns();
+        log_worker(&share);
+        elapsed += now_ns() - start;
+        nanosleep(&pause, NULL);
+    }
+    report("log", "async", done, elapsed);
+
+    //the queue full, the callers going at the pace of the writer
+    start = now_ns();
+    log_worker(&lines);
+    setlogmode(LOG_SYNC);
+    report("log", "async/saturated", lines, now_ns() - start);
+
+    //several threads logging at once (time per line, all threads together)
+    share = lines / LOG_THREADS;
+    setlogmode(LOG_ASYNC);
+    start = now_ns();
+    for(i = 0 ; i < LOG_THREADS ; i++)
+        pthread_create(&threads[i], NULL, log_worker, &share);
+    for(i = 0 ; i < LOG_THREADS ; i++)
+        pthread_join(threads[i], NULL);
+    setlogmode(LOG_SYNC);
+    report("log", "async/saturated/4threads", share * LOG_THREADS, now_ns() - start);
+
+    dup2(saved, STDERR_FILENO);
+    close(saved);
+    return 0;
+}
+
+/************************************************************************/
+/*  I : amount of lines to log                                          */
+/*  P : Logs lines looking like the ones of the server                  */
+/*  O : NULL                                                            */
+/************************************************************************/
+void* log_worker(void* arg)
+{
+    long lines = *(long*)arg, i = 0;
+
+    for(i = 0 ; i < lines ; i++)
+        print_error("server: %s -> sending %lu elements of %lu bytes", "127.0.0.1", 1UL, (unsigned long)i);
+
+    return NULL;
+}
+
+/************************************************************************/
+/*  I : amount of iterations                                            */
+/*  P : Compares the lookups of the names of a large directory in the   */
+/*          linked list (by index, a thousandth of the iterations) and  */
+/*          in a catalog (by index, by name and through its hash index),*/
+/*          then the memory both take, then the lookups by name in a    */
+/*          directory of a million files (names found, then missing)    */
+/*  O : -1 on error                                                     */
+/*       0 otherwise                                                    */
+/************************************************************************/
+int bench_catalog(long iterations)
+{
+    meta_t lis = {NULL, NULL, 0, FILENAMESZ, compare_dataset, print_error};
+    catalog_t cat = {0};
+    char name[FILENAMESZ] = {0};
+    long walks = iterations / CATALOG_SHARE + 1, i = 0;
+    double start = 0.0;
+    int n = 0;
+
+    start = now_ns();
+    if(catalog_fill(&cat, CATALOG_NAMES) == -1)
+        return -1;
+    report("catalog", "catalog/build", CATALOG_NAMES, now_ns() - start);
+
+    //the list, filled the way the client does
+    start = now_ns();
+    for(n = CATALOG_NAMES - 1 ; n >= 0 ; n--)
+    {
+        memset(name, 0, FILENAMESZ);
+        strcpy(name, catalog_name(&cat, n));
+        insertListTop(&lis, name);
+    }
+    report("catalog", "list/build", CATALOG_NAMES, now_ns() - start);
+
+    start = now_ns();
+    for(i = 0 ; i < walks ; i++)
+        sink += *(char*)get_listelem(&lis, (i * CATALOG_STEP) % CATALOG_NAMES);
+    report("catalog", "list/index", walks, now_ns() - start);
+
+    start = now_ns();
+    for(i = 0 ; i < iterations ; i++)
+        sink += *catalog_name(&cat, (i * CATALOG_STEP) % CATALOG_NAMES);
+    report("catalog", "catalog/index", iterations, now_ns() - start);
+
+    //every name is found at its own index
+    for(n = 0 ; n < CATALOG_NAMES ; n++)
+    {
+        if(strcmp(catalog_name(&cat, n), (char*)get_listelem(&lis, n)))
+        {
+            print_error("bench: name %d not found at its index", n);
+            catalog_free(&cat);
+            freeDynList(&lis);
+            return -1;
+        }
+    }
+    freeDynList(&lis);
+
+    if(catalog_lookups(&cat, "", iterations) == -1)
+    {
+        catalog_free(&cat);
+        return -1;
+    }
+
+    //bytes held per name (a list node holds its data and two links, the allocator overhead excluded)
+    printf("{\"bench\":\"catalog\",\"variant\":\"memory\",\"names\":%d,\"list_bytes_per_name\":%.1f,\"catalog_bytes_per_name\":%.1f}\n",
+           CATALOG_NAMES, (double)(FILENAMESZ + 3 * sizeof(void*)),
+           (double)(cat.arenasz + (uint64_t)cat.nbnames * sizeof(uint32_t) + ((uint64_t)cat.mask + 1) * sizeof(uint32_t)) / cat.nbnames);
+    catalog_free(&cat);
+
+    //a directory of a million files
+    start = now_ns();
+    if(catalog_fill(&cat, CATALOG_LARGE) == -1)
+        return -1;
+    report("catalog", "catalog/build/1m", CATALOG_LARGE, now_ns() - start);
+
+    n = catalog_lookups(&cat, "/1m", iterations);
+    catalog_free(&cat);
+    return n;
+}
+
+/************************************************************************/
+/*  I : catalog to fill                                                 */
+/*      amount of names                                                 */
+/*  P : Fills a catalog with names in scattered order (as read from a   */
+/*          directory), then sorts and hashes it                        */
+/*  O : -1 on error                                                     */
+/*       0 otherwise                                                    */
+/************************************************************************/
+int catalog_fill(catalog_t* cat, int nbnames)
+{
+    char name[FILENAMESZ] = {0};
+    int n = 0;
+
+    for(n = 0 ; n < nbnames ; n++)
+    {
+        sprintf(name, CATALOG_NAME, ((long)n * CATALOG_STEP) % nbnames);
+        if(catalog_add(cat, name) == -1)
+        {
+            print_error("bench: unable to fill the catalog");
+            catalog_free(cat);
+            return -1;
+        }
+    }
+
+    catalog_sort(cat);
+    if(catalog_hash(cat) == -1)
+    {
+        print_error("bench: unable to hash the catalog");
+        catalog_free(cat);
+        return -1;
+    }
+
+    return 0;
+}
+
+/************************************************************************/
+/*  I : catalog sorted and hashed                                       */
+/*      suffix of the variants reported                                 */
+/*      amount of iterations                                            */
+/*  P : Checks that each name is found at its own index, then measures  */
+/*          the lookups by name by binary search and through the hash   */
+/*          index, and the lookups of names missing                     */
+/*  O : -1 on error                                                     */
+/*       0 otherwise                                                    */
+/************************************************************************/
+int catalog_lookups(catalog_t* cat, char* suffix, long iterations)
+{
+    char variant[32] = {0}, name[FILENAMESZ] = {0};
+    double start = 0.0;
+    uint32_t n = 0;
+    long i = 0;
+
+    for(n = 0 ; n < cat->nbnames ; n++)
+    {
+        if(catalog_find(cat, catalog_name(cat, n)) != n || catalog_lookup(cat, catalog_name(cat, n)) != n)
+        {
+            print_error("bench: name %u not found at its index", n);
+            return -1;
+        }
+    }
+
+    start = now_ns();
+    for(i = 0 ; i < iterations ; i++)
+        sink += catalog_find(cat, catalog_name(cat, (i * CATALOG_STEP) % cat->nbnames));
+    sprintf(variant, "catalog/name%s", suffix);
+    report("catalog", variant, iterations, now_ns() - start);
+
+    start = now_ns();
+    for(i = 0 ; i < iterations ; i++)
+        sink += catalog_lookup(cat, catalog_name(cat, (i * CATALOG_STEP) % cat->nbnames));
+    sprintf(variant, "catalog/hash%s", suffix);
+    report("catalog", variant, iterations, now_ns() - start);
+
+    //names missing, each one different (the cost of writing them included)
+    start = now_ns();
+    for(i = 0 ; i < iterations ; i++)
+    {
+        sprintf(name, CATALOG_NAME "~", (i * CATALOG_STEP) % cat->nbnames);
+        sink += catalog_lookup(cat, name);
+    }
+    sprintf(variant, "catalog/miss%s", suffix);
+    report("catalog", variant, iterations, now_ns() - start);
+
+    return 0;
+}
+
+/************************************************************************/
+/*  I : amount of iterations (a ten-thousandth run as sessions, per     */
+/*          concurrency, at least a session per thread)                 */
+/*  P : Serves a mix of files from a server started on the loopback,    */
+/*          then runs whole sessions against it (connection, hello,     */
+/*          list, choice, file) from as many threads as sessions at     */
+/*          once, each thread starting a session as soon as its last    */
+/*          one ended, for each concurrency requested                   */
+/*  O : -1 on error                                                     */
+/*       0 otherwise                                                    */
+/************************************************************************/
+int bench_load(long iterations)
+{
+    static shard_t before, after;
+    char directory[] = "/tmp/bench.XXXXXX", path[PATH_MAX] = {0}, *conc = NULL, *next = NULL;
+    pthread_t* threads = NULL;
+    pthread_attr_t attr;
+    struct sigaction sa = {0};
+    struct rlimit lim = {0};
+    load_t load = {{0}, loadopt.files, loadopt.caps, 0, 0};
+    pid_t server = 0;
+    double start = 0.0;
+    int nbthreads = 0, ret = 0, i = 0, b = 0;
+
+    if(metrics_open("bench") == -1)
+    {
+        print_error("bench: unable to measure the sessions: %s", strerror(errno));
+        return -1;
+    }
+
+    //a session cut by the server must not bring the benchmark down
+    sa.sa_handler = SIG_IGN;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPIPE, &sa, NULL);
+
+    //thousands of sockets at once, here and in the server (which inherits the limit)
+    if(getrlimit(RLIMIT_NOFILE, &lim) == 0)
+    {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+
+    if(mkdtemp(directory) == NULL)
+    {
+        print_error("bench: unable to create a directory to serve: %s", strerror(errno));
+        return -1;
+    }
+
+    if(load_files(directory, loadopt.files, loadopt.sizes) == -1 || load_server(directory, load.port, &server) == -1)
+        ret = -1;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, LOAD_STACK);
+
+    //a run per concurrency requested
+    for(conc = loadopt.concurrency ; ret == 0 && conc ; conc = next)
+    {
+        nbthreads = strtol(conc, &next, 10);
+        if(nbthreads < 1 || nbthreads > LOAD_MAXCONC || (*next && *next != ','))
+        {
+            print_error("bench: invalid concurrency %s (1 to %d sessions at once)", conc, LOAD_MAXCONC);
+            ret = -1;
+            break;
+        }
+        next = (*next ? next + 1 : NULL);
+
+        if((threads = calloc(nbthreads, sizeof(pthread_t))) == NULL)
+        {
+            print_error("bench: calloc: %s", strerror(errno));
+            ret = -1;
+            break;
+        }
+
+        load.sessions = (iterations / LOAD_SHARE > nbthreads ? iterations / LOAD_SHARE : nbthreads);
+        load.claimed = 0;
+        metrics_merge(&before);
+        start = now_ns();
+        for(i = 0 ; i < nbthreads ; i++)
+        {
+            if(pthread_create(&threads[i], &attr, load_worker, &load) != 0)
+            {
+                print_error("bench: pthread_create: unable to start the thread %d", i);
+                __atomic_store_n(&load.sessions, 0, __ATOMIC_RELAXED);
+                ret = -1;
+                break;
+            }
+        }
+        nbthreads = i;
+        for(i = 0 ; i < nbthreads ; i++)
+            pthread_join(threads[i], NULL);
+
+        //measures of the run only
+        start = now_ns() - start;
+        metrics_merge(&after);
+        for(i = 0 ; i < MC_COUNT ; i++)
+            after.counters[i] -= before.counters[i];
+        for(i = 0 ; i < MH_COUNT ; i++)
+        {
+            after.sums[i] -= before.sums[i];
+            for(b = 0 ; b < MET_BUCKETS ; b++)
+                after.buckets[i][b] -= before.buckets[i][b];
+        }
+
+        if(ret == 0)
+            load_report(nbthreads, start, &after);
+        free(threads);
+    }
+    pthread_attr_destroy(&attr);
+
+    //stop the server, then remove the files served
+    if(server > 0)
+    {
+        kill(server, SIGTERM);
+        waitpid(server, NULL, 0);
+    }
+    for(i = 0 ; i < loadopt.files ; i++)
+    {
+        sprintf(path, "%s/" LOAD_NAME, directory, i);
+        unlink(path);
+    }
+    rmdir(directory);
+
+    return ret;
+}
+
+/************************************************************************/
+/*  I : directory in which create the files                             */
+/*      amount of files to create                                       */
+/*      mix of their sizes (size[k|m|g][:weight], comma-separated)      */
+/*  P : Creates files of random bytes, their sizes spread as the mix    */
+/*          requires                                                    */
+/*  O : -1 on error                                                     */
+/*       0 otherwise                                                    */
+/************************************************************************/
+int load_files(char* directory, int files, char* mix)
+{
+    uint64_t sizes[LOAD_SIZES] = {0}, bits = 0x9E3779B97F4A7C15ULL, left = 0;
+    int weights[LOAD_SIZES] = {0}, nbsizes = 0, total = 0, slot = 0, fd = 0, i = 0, k = 0;
+    char path[PATH_MAX] = {0}, *p = mix, *end = NULL;
+    uint64_t* buffer = NULL;
+    ssize_t ret = 0;
+
+    //parse the mix
+    while(*p)
+    {
+        sizes[nbsizes] = strtoull(p, &end, 10);
+        if(end == p || nbsizes == LOAD_SIZES - 1)
+        {
+            print_error("bench: invalid mix of file sizes %s (%d sizes at most)", mix, LOAD_SIZES - 1);
+            return -1;
+        }
+
+        switch(*end)
+        {
+            case 'k':
+            case 'K':
+                sizes[nbsizes] <<= 10;
+                end++;
+                break;
+
+            case 'm':
+            case 'M':
+                sizes[nbsizes] <<= 20;
+                end++;
+                break;
+
+            case 'g':
+            case 'G':
+                sizes[nbsizes] <<= 30;
+                end++;
+                break;
+        }
+
+        weights[nbsizes] = (*end == ':' ? strtol(end + 1, &end, 10) : 1);
+        if(weights[nbsizes] < 1 || (*end && *end != ','))
+        {
+            print_error("bench: invalid mix of file sizes %s", mix);
+            return -1;
+        }
+
+        total += weights[nbsizes++];
+        p = (*end ? end + 1 : end);
+    }
+
+    if(!nbsizes)
+    {
+        print_error("bench: no file size in the mix");
+        return -1;
+    }
+
+    if((buffer = malloc(LOAD_BUFSZ)) == NULL)
+    {
+        print_error("bench: unable to allocate %d bytes", LOAD_BUFSZ);
+        return -1;
+    }
+
+    for(i = 0 ; i < LOAD_BUFSZ / 8 ; i++)
+    {
+        bits ^= bits << 13;
+        bits ^= bits >> 7;
+        bits ^= bits << 17;
+        buffer[i] = bits;
+    }
+
+    //the sizes alternate as their weights require
+    for(i = 0 ; i < files ; i++)
+    {
+        for(slot = i % total, k = 0 ; slot >= weights[k] ; slot -= weights[k++]);
+
+        sprintf(path, "%s/" LOAD_NAME, directory, i);
+        if((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+        {
+            print_error("bench: unable to create %s: %s", path, strerror(errno));
+            free(buffer);
+            return -1;
+        }
+
+        for(left = sizes[k] ; left > 0 ; left -= ret)
+        {
+            if((ret = write(fd, buffer, (left < LOAD_BUFSZ ? left : LOAD_BUFSZ))) <= 0)
+            {
+                print_error("bench: unable to write %s: %s", path, strerror(errno));
+                close(fd);
+                free(buffer);
+                return -1;
+            }
+        }
+
+        close(fd);
+    }
+
+    free(buffer);
+    return 0;
+}
+
+/************************************************************************/
+/*  I : directory to serve                                              */
+/*      port on which the server listens (filled)                       */
+/*      process ID of the server (filled)                               */
+/*  P : Starts the server built along the benchmark on a free port,     */
+/*          with the options requested, then waits for it to listen     */
+/*  O : -1 on error                                                     */
+/*       0 otherwise                                                    */
+/************************************************************************/
+int load_server(char* directory, char* port, pid_t* pid)
+{
+    struct sockaddr_in addr = {0};
+    socklen_t len = sizeof(addr);
+    char exe[PATH_MAX] = {0}, *args[LOAD_OPTS + 8] = {"server"};
+    int sockfd = 0, devnull = 0, nbargs = 1, waited = 0, i = 0;
+
+    //port chosen by the kernel
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if((sockfd = socket(AF_INET, SOCK_STREAM, 0)) == -1 || bind(sockfd, (struct sockaddr*)&addr, len) == -1
+       || getsockname(sockfd, (struct sockaddr*)&addr, &len) == -1)
+    {
+        print_error("bench: unable to find a free port: %s", strerror(errno));
+        if(sockfd != -1)
+            close(sockfd);
+        return -1;
+    }
+    close(sockfd);
+    sprintf(port, "%d", ntohs(addr.sin_port));
+
+    //server built in the same directory as the benchmark
+    if(readlink("/proc/self/exe", exe, sizeof(exe) - 8) == -1)
+    {
+        print_error("bench: readlink: %s", strerror(errno));
+        return -1;
+    }
+    strcpy(strrchr(exe, '/') + 1, "server");
+
+    for(i = 0 ; i < loadopt.nbopts ; i++)
+        args[nbargs++] = loadopt.options[i];
+    args[nbargs++] = "-b";
+    args[nbargs++] = LOAD_BACKLOG;
+    args[nbargs++] = port;
+    args[nbargs++] = directory;
+
+    switch(*pid = fork())
+    {
+        case -1:
+            print_error("bench: fork: %s", strerror(errno));
+            return -1;
+
+        case 0: //server process, its logs thrown away
+            if((devnull = open("/dev/null", O_WRONLY)) != -1)
+            {
+                dup2(devnull, STDOUT_FILENO);
+                dup2(devnull, STDERR_FILENO);
+                close(devnull);
+            }
+            execv(exe, args);
+            exit(EXIT_FAILURE);
+    }
+
+    //wait for the server to accept connections
+    for(waited = 0 ; waited < LOAD_WAIT ; waited += 10)
+    {
+        if(waitpid(*pid, NULL, WNOHANG) == *pid)
+        {
+            print_error("bench: %s exited at once (built, options valid?)", exe);
+            *pid = 0;
+            return -1;
+        }
+
+        if((sockfd = socket(AF_INET, SOCK_STREAM, 0)) != -1 && connect(sockfd, (struct sockaddr*)&addr, len) == 0)
+        {
+            close(sockfd);
+            return 0;
+        }
+
+        if(sockfd != -1)
+            close(sockfd);
+        usleep(10000);
+    }
+
+    print_error("bench: %s does not listen on the port %s", exe, port);
+    return -1;
+}
+
+/************************************************************************/
+/*  I : sessions to run                                                 */
+/*  P : Runs sessions, one after the other, until all of them have      */
+/*          been claimed (over the same connection if kept)             */
+/*  O : NULL                                                            */
+/************************************************************************/
+void* load_worker(void* arg)
+{
+    load_t* load = (load_t*)arg;
+    unsigned int seed = (unsigned int)pthread_self();
+    int out = 0, sockfd = -1;
+
+    //the files are received and thrown away (in datagrams, in an anonymous file : they are summed once written)
+    if((out = (load->caps & PF_UDP ? open("/tmp", O_TMPFILE | O_RDWR, 0600) : open("/dev/null", O_WRONLY))) == -1)
+        print_error("bench: unable to open a file to receive in: %s", strerror(errno));
+
+    while(__atomic_fetch_add(&load->claimed, 1, __ATOMIC_RELAXED) < __atomic_load_n(&load->sessions, __ATOMIC_RELAXED))
+    {
+        if(out == -1 || load_session(load, out, rand_r(&seed) % load->files, &sockfd) == -1)
+            metrics_count(MC_FAILED, 1);
+        else
+            metrics_count(MC_DONE, 1);
+    }
+
+    //end the kept session
+    if(sockfd != -1)
+    {
+        psndclose(sockfd, print_error);
+        close(sockfd);
+    }
+
+    if(out != -1)
+        close(out);
+    return NULL;
+}
+
+/************************************************************************/
+/*  I : sessions run                                                    */
+/*      file in which write the file received                           */
+/*      number of the file to fetch                                     */
+/*      connection kept from the last session (-1 if none, updated)     */
+/*  P : Runs a whole session as the client does (or, over a kept        */
+/*          connection, a request without the list), and measures each  */
+/*          of its phases                                               */
+/*  O : -1 on error                                                     */
+/*       0 otherwise                                                    */
+/************************************************************************/
+int load_session(load_t* load, int out, int file, int* sockfd)
+{
+    meta_t ds_list = {NULL, NULL, 0, FILENAMESZ, compare_dataset, print_error};
+    struct timeval timeout = {LOAD_TIMEOUT, 0};
+    char filename[FILENAMESZ] = {0}, expected[FILENAMESZ] = {0};
+    int choice = file + 3, bufsz = sizeof(int);
+    uint32_t caps = load->caps;
+    uint64_t mark = metrics_now(), start = mark;
+
+    //next request of a kept session : the choice is known, the list already received
+    if(*sockfd != -1)
+        caps |= PF_STREAM | PF_NOLIST;
+    else
+    {
+        if((*sockfd = negociate_socket("127.0.0.1", load->port, SOCK_STREAM, CONNECT, print_error)) == -1)
+            return -1;
+        metrics_since(MH_ACCEPT, &mark);
+        metrics_count(MC_ACCEPTED, 1);
+
+        //a server stuck only fails the session
+        setsockopt(*sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(*sockfd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        if(caps & PF_KEEP)
+            setnodelay(*sockfd);
+    }
+
+    if(psndhello(*sockfd, (caps & PF_STREAM ? choice : 0), caps, print_error) == -1)
+        return load_fail(sockfd);
+    metrics_since(MH_HELLO, &mark);
+
+    if(!(caps & PF_NOLIST))
+    {
+        if(prcv(*sockfd, &ds_list, print_error) == -1)
+            return load_fail(sockfd);
+        freeDynList(&ds_list);
+        metrics_since(MH_LIST, &mark);
+
+        //capabilities accepted by the server, echoed with the list
+        caps = pflags();
+    }
+
+    //choice not sent in the hello, the server waits for it
+    if(!(caps & PF_STREAM) && sendData(*sockfd, &choice, &bufsz, NULL, 1) == -1)
+    {
+        print_error("bench: sendData: %s", strerror(errno));
+        return load_fail(sockfd);
+    }
+
+    //the files are listed after "." and ".."
+    sprintf(expected, LOAD_NAME, file);
+    if(prcv(*sockfd, filename, print_error) == -1 || strcmp(filename, expected))
+    {
+        if(*filename && strcmp(filename, expected))
+            print_error("bench: the server sent %s instead of %s", filename, expected);
+        return load_fail(sockfd);
+    }
+    metrics_since(MH_CHOICE, &mark);
+
+    //each file overwrites the last one
+    lseek(out, 0, SEEK_SET);
+    if(prcv(*sockfd, &out, print_error) == -1 || ((pflags() & PF_STREAM) && psndack(*sockfd, print_error) == -1))
+        return load_fail(sockfd);
+    metrics_since(MH_FILE, &mark);
+    metrics_record(MH_SESSION, mark - start);
+
+    //connection kept for the next session, if the server agrees
+    if(!(caps & PF_KEEP))
+    {
+        close(*sockfd);
+        *sockfd = -1;
+    }
+    return 0;
+}
+
+/************************************************************************/
+/*  I : connection of the session failed (set to -1)                    */
+/*  P : Closes the connection of a failed session                       */
+/*  O : -1                                                              */
+/************************************************************************/
+int load_fail(int* sockfd)
+{
+    close(*sockfd);
+    *sockfd = -1;
+    return -1;
+}
+
+/************************************************************************/
+/*  I : sessions run at once                                            */
+/*      time elapsed (in nanoseconds)                                   */
+/*      measures of the run                                             */
+/*  P : Prints the throughput of a run, then the quantiles of each      */
+/*          phase, as JSON lines                                        */
+/*  O : /                                                               */
+/************************************************************************/
+void load_report(int concurrency, double elapsed, shard_t* measures)
+{
+    char* phases[] = {"connect", "hello", "list", "choice", "file", "session"};
+    int histograms[] = {MH_ACCEPT, MH_HELLO, MH_LIST, MH_CHOICE, MH_FILE, MH_SESSION}, p = 0, b = 0;
+    uint64_t* buckets = NULL, count = 0;
+
+    printf("{\"bench\":\"load\",\"variant\":\"throughput\",\"concurrency\":%d,\"sessions\":%ld,\"failed\":%ld,\"sessions_per_s\":%.1f,\"mb_per_s\":%.2f}\n",
+           concurrency, measures->counters[MC_DONE], measures->counters[MC_FAILED],
+           measures->counters[MC_DONE] * 1e9 / elapsed, measures->counters[MC_RECEIVED] * 1e3 / elapsed);
+
+    for(p = 0 ; p < (int)(sizeof(histograms) / sizeof(*histograms)) ; p++)
+    {
+        buckets = measures->buckets[histograms[p]];
+        for(b = 0, count = 0 ; b < MET_BUCKETS ; b++)
+            count += buckets[b];
+
+        printf("{\"bench\":\"load\",\"variant\":\"%s\",\"concurrency\":%d,\"count\":%lu,\"p50_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f}\n",
+               phases[p], concurrency, count, metrics_quantile(buckets, 0.5) / 1e3,
+               metrics_quantile(buckets, 0.99) / 1e3, metrics_quantile(buckets, 0.999) / 1e3);
+    }
+    fflush(stdout);
+}
@@ -4,9 +4,11 @@
 ** -------------------------------------------
 ** Based on Brian 'Beej Jorgensen' Hall's code
 ** Made by Gilles Henrard
-** Last modified : 31/10/2020
+** Last modified : 17/10/2026
 */
 
+#include <pthread.h>
+#include <time.h>
 #include "global.h"
 #include "network.h"
 #include "screen.h"
@@ -14,23 +16,131 @@
 #include "cstructures.h"
 #include "serialisation.h"
 #include "protocol.h"
+#include "metrics.h"
+
+#define RANGE_MIN   (1 << 20)   // smallest range fetched on a connection of its own
+
+typedef struct{
+    char* host;         // host serving the file
+    char* port;         // port on which the host listens
+    uint32_t choice;    // choice of the file in the list
+    int fd;             // file in which write the range
+    range_t range;      // range to fetch
+    int ret;            // result of the fetch (-1 on error)
+}part_t;
+
+static char* statspath = NULL;  // file in which write the metrics at exit
+static int processed = 0;       // session processed successfully
 
 void sigalrm_handler(int s);
+void cli_stats();
 int cli_phase1(int sockfd);
-int cli_phase2(int sockfd, char* filename);
-int cli_phase3(int sockfd, char* filename);
+int cli_phase2(int sockfd, char* filename, int* choice, uint32_t caps);
+int cli_phase3(int sockfd, char* filename, uint32_t caps, range_t* range);
+int cli_ranges(char* host, char* port, uint32_t choice, char* filename, range_t* range, int nbconn);
+void* cli_part(void* arg);
+int cli_next(char** choices, int* choice);
+int cli_prompt(char* question, int* choice);
 
 int main(int argc, char *argv[])
 {
-	int sockfd=0;
+	int sockfd=0, opt=0, choice=0, nbconn=0, relist=0;
+	uint32_t caps = PF_LISTZ | PF_STAT | PF_RESUME | PF_DEFLATE;
+	char *choices = "", *name = NULL;
+	range_t range = {0};
 	struct sigaction sa = {0};
 	char s[INET6_ADDRSTRLEN] = {0};
 	char filename[FILENAMESZ] = "0";
+	uint64_t mark = 0, start = 0;
+
+	//parse the options
+	while((opt = getopt(argc, argv, "p:f:kln:ruzs:")) != -1)
+	{
+        switch(opt)
+        {
+            case 'p': //files chosen in advance, all the messages are pipelined (over a kept session if several)
+                if((choice = strtol(optarg, &choices, 10)) < 1 || (*choices && *choices != ','))
+                {
+                    print_error("client: invalid choice %s", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                if(*choices)
+                {
+                    choices++;
+                    caps |= PF_KEEP;
+                }
+                caps |= PF_STREAM;
+                break;
+
+            case 'f': //file requested by its name, streamed without any list
+                name = optarg;
+                caps |= PF_STREAM | PF_NOLIST;
+                break;
+
+            case 'k': //session kept, the user chooses another file after each one
+                choices = NULL;
+                caps |= PF_KEEP;
+                break;
+
+            case 'l': //list the files again before each request of a kept session
+                relist = 1;
+                break;
+
+            case 'n': //file fetched by ranges, over several connections at once
+                if((nbconn = atoi(optarg)) < 1)
+                {
+                    print_error("client: invalid amount of connections %s", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                caps = (caps | PF_RANGE) & ~PF_RESUME;
+                break;
+
+            case 'r': //file received raw, never compressed
+                caps &= ~PF_DEFLATE;
+                break;
+
+            case 'u': //file received in datagrams (raw), if the server sends them
+                caps |= PF_UDP;
+                break;
+
+            case 'z': //file moved from the socket to the disk by the kernel
+                setrecvmode(RCV_ZEROCOPY);
+                break;
+
+            case 's': //metrics of the session written in a file at exit
+                if(metrics_open("client") == -1)
+                {
+                    print_error("client: unable to measure the session: %s", strerror(errno));
+                    exit(EXIT_FAILURE);
+                }
+                statspath = optarg;
+                atexit(cli_stats);
+                break;
+
+            default:
+                print_error("usage: client [-p choice[,choice...]] [-f name] [-k] [-l] [-n connections] [-r] [-u] [-z] [-s file] hostname port");
+                exit(EXIT_FAILURE);
+        }
+	}
+
+	//the connections fetching ranges would leave the session idle
+	if((caps & PF_KEEP) && (caps & PF_RANGE))
+	{
+        print_error("client: a file fetched by ranges can not be requested in a kept session");
+        exit(EXIT_FAILURE);
+	}
+
+	//the choices refer to a list never received by a request by name
+	if(name && (choice || (caps & (PF_KEEP | PF_RANGE))))
+	{
+        print_error("client: a file requested by its name can not be chosen, kept nor fetched by ranges");
+        exit(EXIT_FAILURE);
+	}
 
 	//checks if the hostname and the port number have been provided
-	if (argc!=3)
+	if (argc - optind != 2)
 	{
-        print_error("usage: client hostname port");
+        print_error("usage: client [-p choice[,choice...]] [-f name] [-k] [-l] [-n connections] [-r] [-u] [-z] [-s file] hostname port");
 		exit(EXIT_FAILURE);
 	}
 
@@ -46,9 +156,11 @@ int main(int argc, char *argv[])
 
     //set connection timeout alarm
     alarm(TIMEOUT);
+    if(METRICS)
+        start = mark = metrics_now();
 
     //create the actual socket
-    sockfd = negociate_socket(argv[1], argv[2], SOCK_STREAM, CONNECT, print_error);
+    sockfd = negociate_socket(argv[optind], argv[optind+1], SOCK_STREAM, CONNECT, print_error);
     if(sockfd == -1){
         print_error("client: unable to create a socket");
         exit(EXIT_FAILURE);
@@ -56,31 +168,109 @@ int main(int argc, char *argv[])
 
     //stop timeout alarm and free the server info list
     alarm(0);
+    if(METRICS)
+    {
+        metrics_since(MH_ACCEPT, &mark);
+        metrics_count(MC_ACCEPTED, 1);
+    }
+
+    //kept session : each request follows the acknowledgement of the last one
+    if((caps & PF_KEEP) && setnodelay(sockfd) == -1)
+        print_error("client: setsockopt: %s", strerror(errno));
 
     //notify the successful connection to the server
     socket_to_ip(&sockfd, s, sizeof(s));
     print_neutral("client: connecting to %s", s);
 
-    //handle the protocol on the client side
-    if(cli_phase1(sockfd) == -1){
+    //advertise the client capabilities (and its choice, if already known), or request the file by its name
+    if((name ? psndname(sockfd, name, caps, print_error) : psndhello(sockfd, choice, caps, print_error)) == -1){
         close(sockfd);
         exit(EXIT_FAILURE);
     }
+    if(METRICS)
+        metrics_since(MH_HELLO, &mark);
 
-    //handle the protocol on the client side
-    if(cli_phase2(sockfd, filename) == -1){
-        close(sockfd);
-        exit(EXIT_FAILURE);
+    //handle the requests of the session (several if kept)
+    while(1)
+    {
+        //handle the protocol on the client side (the list is received once in a kept session)
+        if(!(caps & PF_NOLIST))
+        {
+            if(cli_phase1(sockfd) == -1){
+                close(sockfd);
+                exit(EXIT_FAILURE);
+            }
+            if(METRICS)
+                metrics_since(MH_LIST, &mark);
+
+            //capabilities accepted by the server, echoed with the list
+            caps = pflags();
+        }
+
+        //handle the protocol on the client side
+        if(cli_phase2(sockfd, filename, &choice, caps) == -1){
+            close(sockfd);
+            exit(EXIT_FAILURE);
+        }
+        if(METRICS)
+            metrics_since(MH_CHOICE, &mark);
+
+        //handle the protocol on the client side
+        if(cli_phase3(sockfd, filename, caps, &range) == -1){
+            close(sockfd);
+            exit(EXIT_FAILURE);
+        }
+
+        //messages streamed by the server : acknowledge them all at once
+        if((pflags() & PF_STREAM) && psndack(sockfd, print_error) == -1){
+            close(sockfd);
+            exit(EXIT_FAILURE);
+        }
+
+        //session not kept (by the client, or by the server) : it ends with the file
+        if(!(caps & PF_KEEP))
+            break;
+
+        if(METRICS)
+            metrics_since(MH_FILE, &mark);
+        print_success("client: file %s received", filename);
+
+        //next file of the session (none ends it)
+        if(cli_next(&choices, &choice) == -1 || choice == 0)
+        {
+            if(psndclose(sockfd, print_error) == -1){
+                close(sockfd);
+                exit(EXIT_FAILURE);
+            }
+            close(sockfd);
+            if(METRICS)
+                metrics_record(MH_SESSION, metrics_now() - start);
+            processed = 1;
+            exit(EXIT_SUCCESS);
+        }
+
+        //the choice is known in advance : the request is pipelined, without the list if already received
+        caps = (caps | PF_STREAM) & ~PF_NOLIST;
+        if(!relist)
+            caps |= PF_NOLIST;
+        if(psndhello(sockfd, choice, caps, print_error) == -1){
+            close(sockfd);
+            exit(EXIT_FAILURE);
+        }
     }
+	close(sockfd);
 
-    //handle the protocol on the client side
-    if(cli_phase3(sockfd, filename) == -1){
-        close(sockfd);
+    //only the size of the file has been received, fetch it by ranges
+    if((caps & PF_RANGE) && cli_ranges(argv[optind], argv[optind+1], choice, filename, &range, nbconn) == -1)
         exit(EXIT_FAILURE);
+    if(METRICS)
+    {
+        metrics_since(MH_FILE, &mark);
+        metrics_record(MH_SESSION, mark - start);
     }
-    print_success("client: file %s received", filename);
 
-	close(sockfd);
+    print_success("client: file %s received", filename);
+    processed = 1;
 	exit(EXIT_SUCCESS);
 }
 
@@ -97,6 +287,30 @@ void sigalrm_handler(int s)
     print_error("client: connection attempt timeout");
 }
 
+/************************************************************************/
+/*  I : /                                                               */
+/*  P : Writes the metrics of the session in the file chosen, at exit   */
+/*          (Prometheus text format)                                    */
+/*  O : /                                                               */
+/************************************************************************/
+void cli_stats()
+{
+    char* buffer = NULL;
+    int fd = 0, len = 0;
+
+    metrics_count((processed ? MC_DONE : MC_FAILED), 1);
+    if((buffer = malloc(MET_DUMPSZ)) == NULL)
+        return;
+
+    len = metrics_dump(buffer, MET_DUMPSZ);
+    if((fd = open(statspath, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1 || write(fd, buffer, len) != len)
+        print_error("client: unable to write the metrics in %s: %s", statspath, strerror(errno));
+
+    if(fd != -1)
+        close(fd);
+    free(buffer);
+}
+
 /************************************************************************/
 /*  I : client socket file descriptor                                   */
 /*  P : Handle the phase 1: receiving the file list from the server     */
@@ -105,14 +319,14 @@ void sigalrm_handler(int s)
 /************************************************************************/
 int cli_phase1(int sockfd)
 {
-    meta_t ds_list = {NULL, NULL, 0, FILENAMESZ, compare_dataset, print_error};
+    meta_t ds_list = {NULL, NULL, 0, sizeof(fileinfo_t), compare_dataset, print_error};
 	int index = 1;
 
 	if(prcv(sockfd, &ds_list, print_error) == -1)
         return -1;
 
-    //display all elements in the list, then free it
-    foreachList(&ds_list, &index, printdatasetnum);
+    //display all elements in the list (with their metadata if sent), then free it
+    foreachList(&ds_list, &index, (pflags() & PF_STAT ? printfileinfonum : printdatasetnum));
     freeDynList(&ds_list);
 
     return 0;
@@ -121,40 +335,39 @@ int cli_phase1(int sockfd)
 /************************************************************************/
 /*  I : client socket file descriptor                                   */
 /*      name of the file to choose in the list sent by the server       */
+/*      choice made in advance (0 if the user has to choose, updated)   */
+/*      capabilities of the request (accepted by the server)            */
 /*  P : Handle the phase 2: send the choice to the server               */
 /*          and receive filename chosen                                 */
 /*  O : 0 if ok                                                         */
 /*      -1 otherwise                                                    */
 /************************************************************************/
-int cli_phase2(int sockfd, char* filename)
+int cli_phase2(int sockfd, char* filename, int* choice, uint32_t caps)
 {
-    char buffer[FILENAMESZ] = {0};
-	int bufsz = 0, choice = 0;
+	int bufsz = 0;
 
-	//collect the user's choice
-    printf("Choose which file to download: ");
-    if(fgets(buffer, FILENAMESZ, stdin) == NULL)
+    //choice not sent in the hello, the server waits for it
+    if(!(caps & PF_STREAM))
     {
-        print_error("client: fgets: error while reading the user's choice");
-        return -1;
-    }
-    printf("\n");
-    fflush(stdin);
-    buffer[strlen(buffer)]='\0';
-
-    //prepare the reply
-    choice = atoi(buffer);
-    bufsz = sizeof(choice);
+        //collect the user's choice, unless made in advance
+        if(!*choice && cli_prompt("Choose which file to download: ", choice) == -1)
+        {
+            print_error("client: fgets: error while reading the user's choice");
+            return -1;
+        }
 
-    //send it to the server
-    if(sendData(sockfd, &choice, &bufsz, NULL, 1) == -1)
-    {
-        print_error("client: sendData: %s", strerror(errno));
-        return -1;
+        //send it to the server
+        bufsz = sizeof(int);
+        if(sendData(sockfd, choice, &bufsz, NULL, 1) == -1)
+        {
+            print_error("client: sendData: %s", strerror(errno));
+            return -1;
+        }
     }
 
     //receive the file name
-    prcv(sockfd, filename, print_error);
+    if(prcv(sockfd, filename, print_error) == -1)
+        return -1;
     printf("filename: %s\n", filename);
 
     return 0;
@@ -163,26 +376,247 @@ int cli_phase2(int sockfd, char* filename)
 /************************************************************************/
 /*  I : client socket file descriptor                                   */
 /*      name of the file to choose in the list sent by the server       */
-/*  P : Handle the phase 3: receive the file sent by the server         */
+/*      capabilities accepted by the server                             */
+/*      range to fill with the size of the file (if fetched by ranges)  */
+/*  P : Handle the phase 3: receive the file sent by the server (or     */
+/*          only its size, if it is to be fetched by ranges), resuming  */
+/*          it from the data already received if possible               */
 /*  O : 0 if ok                                                         */
 /*      -1 otherwise                                                    */
 /************************************************************************/
-int cli_phase3(int sockfd, char* filename)
+int cli_phase3(int sockfd, char* filename, uint32_t caps, range_t* range)
 {
     char buffer[FILENAMESZ] = "0";
 	int fd = 0;
+	head_t resume = {0};
+	uint64_t offset = 0;
 
-	//open the soon to be file
+    //file fetched by ranges : the server only sends its size
+    if(caps & PF_RANGE)
+    {
+        return prcv(sockfd, range, print_error);
+    }
+
+	//open the soon to be file (or the part of it already received)
 	sprintf(buffer, "data/%s", filename);
-    if((fd = open(buffer, O_WRONLY|O_CREAT)) == -1)
+    if((fd = open(buffer, O_RDWR|O_CREAT, 0644)) == -1)
     {
         print_error("client: open: %s", strerror(errno));
         return -1;
     }
     memset(buffer, 0, sizeof(buffer));
 
-    prcv(sockfd, &fd, print_error);
+    //ask the server to resume from the end of the data already received
+    if(caps & PF_RESUME)
+    {
+        offset = lseek(fd, 0, SEEK_END);
+        if(psndresume(sockfd, offset, pfilesum(fd, 0, offset), print_error) == -1
+           || prcvresume(sockfd, &resume, print_error) == -1)
+        {
+            close(fd);
+            return -1;
+        }
+
+        if(resume.szelem)
+            print_neutral("client: resuming %s from byte %lu", filename, resume.szelem);
+        else if(offset)
+            print_neutral("client: the data already received does not match, %s is received again", filename);
+        offset = resume.szelem;
+    }
+
+    //drop anything after the offset the server sends from
+    if(ftruncate(fd, offset) == -1 || lseek(fd, offset, SEEK_SET) == -1)
+    {
+        print_error("client: unable to prepare %s: %s", filename, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    if(prcv(sockfd, &fd, print_error) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+
+    close(fd);
+    return 0;
+}
+
+/************************************************************************/
+/*  I : host serving the file                                           */
+/*      port on which the host listens                                  */
+/*      choice of the file in the list                                  */
+/*      name of the file                                                */
+/*      range covering the whole file (as announced by the server)      */
+/*      amount of connections to open                                   */
+/*  P : Splits the file in ranges, fetches them at once over a          */
+/*          connection each, then reports the aggregate throughput      */
+/*  O : 0 if ok                                                         */
+/*      -1 otherwise                                                    */
+/************************************************************************/
+int cli_ranges(char* host, char* port, uint32_t choice, char* filename, range_t* range, int nbconn)
+{
+    char buffer[FILENAMESZ*2] = "0";
+    struct timespec start = {0}, end = {0};
+    pthread_t* threads = NULL;
+    part_t* parts = NULL;
+    uint64_t length = 0;
+    double elapsed = 0.0;
+    int fd = 0, i = 0, ret = 0;
+
+    //open the soon to be file, at its final size
+    sprintf(buffer, "data/%s", filename);
+    if((fd = open(buffer, O_WRONLY|O_CREAT|O_TRUNC, 0644)) == -1)
+    {
+        print_error("client: open: %s", strerror(errno));
+        return -1;
+    }
+    if(ftruncate(fd, range->size) == -1)
+    {
+        print_error("client: ftruncate: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
 
+    //no connection for less than RANGE_MIN bytes
+    if((uint64_t)nbconn > (range->size + RANGE_MIN - 1) / RANGE_MIN)
+        nbconn = (range->size + RANGE_MIN - 1) / RANGE_MIN;
+    if(nbconn == 0)
+    {
+        close(fd);
+        return 0;
+    }
+
+    if((threads = calloc(nbconn, sizeof(pthread_t))) == NULL || (parts = calloc(nbconn, sizeof(part_t))) == NULL)
+    {
+        print_error("client: calloc: %s", strerror(errno));
+        free(threads);
+        close(fd);
+        return -1;
+    }
+
+    //split the file in ranges of (nearly) the same length, and fetch them at once
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    length = (range->size + nbconn - 1) / nbconn;
+    for(i = 0 ; i < nbconn ; i++)
+    {
+        parts[i].host = host;
+        parts[i].port = port;
+        parts[i].choice = choice;
+        parts[i].fd = fd;
+        parts[i].range.offset = length * i;
+        parts[i].range.length = (range->size - parts[i].range.offset < length ? range->size - parts[i].range.offset : length);
+        parts[i].range.size = range->size;
+        if(pthread_create(&threads[i], NULL, cli_part, &parts[i]) != 0)
+        {
+            print_error("client: pthread_create: unable to fetch the range %d", i);
+            parts[i].ret = -1;
+            threads[i] = 0;
+        }
+    }
+
+    for(i = 0 ; i < nbconn ; i++)
+    {
+        if(threads[i])
+            pthread_join(threads[i], NULL);
+        if(parts[i].ret == -1)
+            ret = -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    if(ret != -1)
+        print_neutral("client: %lu bytes received over %d connections in %.3f s (%.1f MB/s)", range->size, nbconn, elapsed, range->size / elapsed / 1e6);
+
+    free(threads);
+    free(parts);
     close(fd);
+    return ret;
+}
+
+/************************************************************************/
+/*  I : range to fetch (part_t)                                         */
+/*  P : Connects to the server, requests a range of the file and writes */
+/*          it in place                                                 */
+/*  O : NULL (the result is set in the part)                            */
+/************************************************************************/
+void* cli_part(void* arg)
+{
+    part_t* part = (part_t*)arg;
+    int sockfd = 0;
+
+    part->ret = -1;
+    if((sockfd = negociate_socket(part->host, part->port, SOCK_STREAM, CONNECT, print_error)) == -1)
+    {
+        print_error("client: unable to create a socket");
+        return NULL;
+    }
+
+    if(psndrange(sockfd, part->choice, &part->range, print_error) != -1
+       && prcvpart(sockfd, part->fd, &part->range, print_error) != -1)
+        part->ret = 0;
+
+    close(sockfd);
+    return NULL;
+}
+
+/************************************************************************/
+/*  I : choices made in advance, comma-separated (moved past the one    */
+/*          taken), or NULL if the user chooses                         */
+/*      choice of the next file (0 if none, the session ends)          */
+/*  P : Takes the next file of a kept session, from the ones chosen in  */
+/*          advance or from the user                                    */
+/*  O : 0 if ok                                                         */
+/*      -1 otherwise                                                    */
+/************************************************************************/
+int cli_next(char** choices, int* choice)
+{
+    char* end = NULL;
+
+    //the user chooses, nothing (or 0) ends the session
+    if(*choices == NULL)
+    {
+        if(cli_prompt("Choose another file to download (0 to quit): ", choice) == -1)
+            *choice = 0;
+
+        return 0;
+    }
+
+    //all the files chosen in advance have been fetched
+    if(**choices == '\0')
+    {
+        *choice = 0;
+        return 0;
+    }
+
+    if((*choice = strtol(*choices, &end, 10)) < 1 || (*end && *end != ','))
+    {
+        print_error("client: invalid choice %s", *choices);
+        return -1;
+    }
+    *choices = (*end ? end + 1 : end);
+
+    return 0;
+}
+
+/************************************************************************/
+/*  I : question asked to the user                                      */
+/*      choice of the user (filled)                                     */
+/*  P : Asks the user which file to download                            */
+/*  O : 0 if ok                                                         */
+/*      -1 otherwise (nothing more to read)                             */
+/************************************************************************/
+int cli_prompt(char* question, int* choice)
+{
+    char buffer[FILENAMESZ] = {0};
+
+    printf("%s", question);
+    if(fgets(buffer, FILENAMESZ, stdin) == NULL)
+        return -1;
+    printf("\n");
+    fflush(stdin);
+    buffer[strlen(buffer)]='\0';
+    *choice = atoi(buffer);
+
     return 0;
 }
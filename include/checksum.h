@@ -0,0 +1,24 @@
+#ifndef CHECKSUM_H_INCLUDED
+#define CHECKSUM_H_INCLUDED
+#include <stdint.h>
+#include <stddef.h>
+
+#define ADLER_INIT  1       // initial value of an Adler-32 checksum
+#define ADLER_MOD   65521   // largest prime smaller than 65536
+#define ADLER_NMAX  5552    // max bytes summed before the modulo is needed
+
+#define CRC32C_INIT 0           // initial value of a CRC32C
+#define CRC32C_POLY 0x82F63B78  // Castagnoli polynomial (reflected)
+#define CRC_LONG    8192        // bytes per stream in a long interleaved block
+#define CRC_SHORT   256         // bytes per stream in a short interleaved block
+
+//kernels computing the CRC32C
+#define CRC_AUTO    0   // best kernel supported by the CPU
+#define CRC_SCALAR  1   // tables, 8 bytes at a time
+#define CRC_SSE42   2   // crc32 instruction, 3 streams interleaved
+
+uint32_t adlersum(uint32_t adler, const void* buf, size_t len);
+uint32_t crc32c(uint32_t crc, const void* buf, size_t len);
+int setcrckernel(int kernel);
+
+#endif // CHECKSUM_H_INCLUDED
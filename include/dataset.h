@@ -4,16 +4,63 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
+#include <dirent.h>
 
 #define FILENAMESZ  128
 #define DATA_F  "128s"
+#define META_F  "QqC"   // metadata following a name in a list (size, modification time, type)
+#define META_SZ 17      // size of the serialised metadata (META_F)
+#define CATALOG_MAX 0xFFFFFFFF  // max amount of bytes in the arena of a catalog (32-bit offsets)
+
+typedef struct{
+    uint64_t size;          // size of the file, in bytes
+    int64_t mtime;          // time of the last modification (seconds since the epoch)
+    uint8_t type;           // type of the file (DT_* of dirent.h, DT_UNKNOWN if not read)
+}filemeta_t;
+
+typedef struct{
+    char name[FILENAMESZ];  // name of the file (first, so that it compares as a dataset)
+    filemeta_t meta;        // metadata of the file
+}fileinfo_t;
+
+typedef struct{
+    char* arena;            // names one after another, each one ended by '\0'
+    uint64_t arenasz;       // amount of bytes used in the arena
+    uint64_t arenacap;      // amount of bytes allocated for the arena
+    uint32_t* offsets;      // offset of each name in the arena (by name once sorted)
+    uint32_t nbnames;       // amount of names in the catalog
+    uint32_t capacity;      // amount of offsets allocated
+    uint32_t* slots;        // hash index : index + 1 of the name hashed there (0 if empty)
+    uint32_t mask;          // amount of slots - 1 (a power of 2)
+}catalog_t;
 
 // display methods
 int Print_dataset(void* rec, void* nullable);
 int printdatasetnum(void* lign, void* index);
+int printfileinfonum(void* lign, void* index);
 char* toString_dataset(void* current);
 
 // dynamic structures methods
 int compare_dataset(void* a, void* b);
 
+// catalog methods
+int catalog_add(catalog_t* cat, const char* name);
+int catalog_sort(catalog_t* cat);
+int64_t catalog_find(catalog_t* cat, const char* name);
+int catalog_hash(catalog_t* cat);
+int64_t catalog_lookup(catalog_t* cat, const char* name);
+void catalog_free(catalog_t* cat);
+
+/*
+** Index lookup : a catalog is an array, so a name is reached in O(1)
+*/
+static inline char* catalog_name(catalog_t* cat, uint32_t index)
+{
+    if(index >= cat->nbnames)
+        return NULL;
+
+    return cat->arena + cat->offsets[index];
+}
+
 #endif // DATASET_H_INCLUDED
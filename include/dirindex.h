@@ -0,0 +1,42 @@
+#ifndef DIRINDEX_H_INCLUDED
+#define DIRINDEX_H_INCLUDED
+#include <pthread.h>
+#include <search.h>
+#include <dirent.h>
+#include <sched.h>
+#include <sys/inotify.h>
+#include "global.h"
+#include "screen.h"
+#include "dataset.h"
+#include "protocol.h"
+
+#define DX_EVENTS   (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_CLOSE_WRITE | IN_ATTRIB)
+#define DX_BUFSZ    (64 * (sizeof(struct inotify_event) + NAME_MAX + 1))   // inotify events read at once
+#define DX_STATPAR  1024    // metadata to read at least before spreading them over threads
+#define DX_STATTHREADS 8    // threads reading the metadata at most (the publisher included)
+#define DX_STATCHUNK 64     // metadata claimed at once by a thread
+
+typedef struct{
+    plist_t cache;                  // names of the files, sorted and serialised
+    catalog_t names;                // names of the files, looked up by index or by name
+    int refs;                       // references held on the snapshot (atomic)
+}snapshot_t;
+
+typedef struct{
+    char* dirname;                  // directory indexed
+    void* tree;                     // names of the files (tsearch() tree)
+    uint32_t nbnames;               // amount of names in the tree
+    snapshot_t* current;            // last snapshot published (atomic)
+    int readers;                    // readers acquiring the current snapshot (atomic)
+    int fd;                         // inotify instance (-1 if not watching)
+    pthread_t watcher;              // thread applying the changes
+}dirindex_t;
+
+int dirindex_open(dirindex_t* idx, char* dirname);
+int dirindex_watch(dirindex_t* idx);
+void dirindex_close(dirindex_t* idx);
+snapshot_t* dirindex_acquire(dirindex_t* idx);
+void dirindex_release(snapshot_t* snap);
+snapshot_t* dirindex_snapshot(char* dirname);
+
+#endif // DIRINDEX_H_INCLUDED
@@ -0,0 +1,85 @@
+#ifndef EVENTLOOP_H_INCLUDED
+#define EVENTLOOP_H_INCLUDED
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#include <time.h>
+#include "global.h"
+#include "network.h"
+#include "screen.h"
+#include "dataset.h"
+#include "cstructures.h"
+#include "protocol.h"
+#include "dirindex.h"
+#include "zcache.h"
+#include "metrics.h"
+
+#define EV_MAXEVENTS    256 // max number of events handled per epoll_wait()
+
+//states of a connection, following the phases of the server
+#define PH0_HELLO   0   // waiting for the hello of the client
+#define PH0_RANGE   1   // waiting for the range following a range request
+#define PH0_NAME    2   // waiting for the name following a request by name
+#define PH1_SEND    3   // sending the files list
+#define PH1_ACK     4   // waiting for the list acknowledgement
+#define PH2_CHOICE  5   // waiting for the client's choice
+#define PH2_SEND    6   // sending the chosen file name
+#define PH2_ACK     7   // waiting for the file name acknowledgement
+#define PH3_RESUME  8   // waiting for the offset from which resume the file
+#define PH3_SEND    9   // sending the file (or its size, or a range of it)
+#define PH3_ACK     10  // waiting for the file (or session) acknowledgement
+#define PH4_NEXT    11  // waiting for the next request of a kept session (or its end)
+#define PH_DONE     12  // request (or kept session) processed
+
+typedef struct conn_t{
+    int sockfd;                             // connection socket
+    int state;                              // current phase of the request
+    char ip[INET6_ADDRSTRLEN];              // IP address of the client
+    head_t hello;                           // hello of the client (capabilities, choice)
+    unsigned char head[sizeof(head_t)];     // serialised header to send
+    unsigned char trail[sizeof(head_t)];    // serialised trailer to send (streaming)
+    struct iovec iov[3];                    // memory left to send (header, payload, trailer)
+    int iovcnt;                             // amount of memory segments left
+    int fd;                                 // file to send in phase 3
+    off_t foffset;                          // offset of the next byte of file to send
+    uint64_t fsize;                         // offset at which the file sent ends
+    unsigned char part[RANGE_SZ];           // serialised record sent before the file (range, resume)
+    unsigned char in[PNAMEMAX + 1];         // data received (hello, range, ack header, choice, name)
+    unsigned int inlen;                     // amount of bytes received
+    unsigned int inneed;                    // amount of bytes to receive
+    uint64_t expected;                      // amount of bytes to be acknowledged
+    uint32_t sum;                           // CRC32C of the message to be acknowledged
+    uint32_t events;                        // events currently watched by epoll
+    long deadline;                          // time after which no hello (or data) is expected (ms)
+    int late;                               // hello (or request) partly received when its deadline passed
+    int queued;                             // bytes sent not yet acknowledged by the client's TCP when its deadline passed (-1 if unknown)
+    long expectedat;                        // time since which data is expected (ms)
+    struct conn_t* prev;                    // previous connection waiting for a hello (or a request)
+    struct conn_t* next;                    // next connection waiting for a hello (or a request)
+    char filename[FILENAMESZ];              // name of the file chosen
+    snapshot_t* snap;                       // snapshot of the directory listed
+    uint64_t start;                         // time at which the connection was accepted (metrics, ns)
+    uint64_t mark;                          // time at which the current phase started (metrics, ns)
+    uint64_t tsend;                         // time at which the file or the message was sent (metrics, ns)
+    uint64_t tbytes;                        // amount of bytes of file to send (metrics)
+}conn_t;
+
+typedef struct{
+    int epfd;                               // epoll instance of the loop
+    int listener;                           // listening socket
+    dirindex_t* index;                      // index of the files (snapshots listed)
+    char* dirname;                          // directory containing the files
+    conn_t* waiting;                        // connections waiting for a hello (oldest first)
+    conn_t* lastwaiting;                    // last connection waiting for a hello
+    conn_t* idle;                           // kept sessions waiting for a request (oldest first)
+    conn_t* lastidle;                       // last kept session waiting for a request
+    conn_t* late;                           // connections finishing a hello (or a request) past their deadline, or the rest of a request (oldest first)
+    conn_t* lastlate;                       // last connection finishing a hello (or a request)
+    uint64_t woke;                          // time at which epoll_wait() returned (metrics, ns)
+}evloop_t;
+
+int run_eventloop(int listener, dirindex_t* index, char* dirname);
+
+#endif // EVENTLOOP_H_INCLUDED
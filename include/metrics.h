@@ -0,0 +1,71 @@
+#ifndef METRICS_H_INCLUDED
+#define METRICS_H_INCLUDED
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include "global.h"
+#include "screen.h"
+
+#define MET_SHARDS  16          // sets of counters, one per thread or process (shared beyond)
+#define MET_SUBBITS 4           // histograms precision : 2^MET_SUBBITS buckets per power of 2
+#define MET_MAXBITS 48          // histograms range : values up to 2^MET_MAXBITS
+#define MET_BUCKETS ((MET_MAXBITS - MET_SUBBITS + 1) << MET_SUBBITS)
+#define MET_DUMPSZ  65536       // size of the text exposing the metrics
+#define MET_BACKLOG 16          // scrapers waiting on the stats endpoint
+#define MET_WAIT    100000      // time given to a scraper to send its request (us)
+
+//histograms
+#define MH_ACCEPT   0   // connection accepted (or established) to handled, in ns
+#define MH_HELLO    1   // phase 0 (capabilities), in ns
+#define MH_LIST     2   // phase 1 (files list), in ns
+#define MH_CHOICE   3   // phase 2 (choice and file name), in ns
+#define MH_FILE     4   // phase 3 (file, or a range of it), in ns
+#define MH_ACK      5   // data sent to acknowledgement received, in ns
+#define MH_RATE     6   // throughput of a file transfer, in bytes per second
+#define MH_SESSION  7   // connection accepted (or established) to session done, in ns
+#define MH_COUNT    8
+
+//counters (gauges when they go down)
+#define MC_ACCEPTED 0   // connections accepted (or established)
+#define MC_DONE     1   // sessions processed
+#define MC_FAILED   2   // sessions failed
+#define MC_SENT     3   // bytes of files sent
+#define MC_RECEIVED 4   // bytes of files received
+#define MC_ACTIVE   5   // connections currently served
+#define MC_DGSENT   6   // datagrams of files sent (UDP transfers)
+#define MC_DGRESENT 7   // datagrams of files sent again (UDP transfers)
+#define MC_COUNT    8
+
+typedef struct{
+    int64_t counters[MC_COUNT];                 // counters
+    uint64_t sums[MH_COUNT];                    // sum of the values recorded per histogram
+    uint64_t buckets[MH_COUNT][MET_BUCKETS];    // histograms (log-linear buckets)
+}shard_t;
+
+typedef struct{
+    shard_t shards[MET_SHARDS];     // counters, one per thread or process
+    int claimed;                    // shards claimed so far
+    char role[16];                  // role of the process (server, client)
+}metrics_t;
+
+//metrics of the process (NULL when disabled : then nothing is measured)
+extern metrics_t* metrics;
+#define METRICS __builtin_expect(metrics != NULL, 0)
+
+int metrics_open(char* role);
+int metrics_serve(char* path);
+int metrics_dump(char* buffer, int size);
+uint64_t metrics_now();
+void metrics_count(int counter, int64_t value);
+void metrics_record(int histogram, uint64_t value);
+void metrics_since(int histogram, uint64_t* mark);
+void metrics_rate(uint64_t bytes, uint64_t start);
+void metrics_merge(shard_t* total);
+uint64_t metrics_quantile(uint64_t* buckets, double quantile);
+
+#endif // METRICS_H_INCLUDED
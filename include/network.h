@@ -3,22 +3,82 @@
 #include <stdio.h>
 #include <netdb.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <time.h>
+#include <endian.h>
+#ifdef NET_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
 
 #define NONE    0x00
 #define BIND    0x01
 #define CONNECT 0x02
 #define MULTI   0x04
 #define LISTEN  0x08
+#define REUSEPORT 0x10
+
+#define BACKLOG 10 // how many pending connections queue will hold (by default)
+
+#define RING_BUFS   8           // buffers registered in a ring (read/send pairs queued at once)
+#define RING_BUFSZ  65536       // size of a registered buffer
+
+#define UDP_DGRAMSZ 1472        // size of a datagram at most (fits in an Ethernet frame)
+#define UDP_HEADSZ  16          // size of the header of a datagram
+#define UDP_PAYLOAD (UDP_DGRAMSZ - UDP_HEADSZ)  // bytes of file carried by a datagram
+#define UDP_BATCH   32          // datagrams sent or received per system call
+#define UDP_WINDOW  65536       // datagrams sent beyond the last one received in order, at most (power of 2)
+#define UDP_BUFSZ   (8 << 20)   // size of the socket buffers requested
+#define UDP_REPORT  5000        // interval between the reports of the receiver (us)
+#define UDP_PROBE   50000       // silence after which the sender probes the receiver (us)
+#define UDP_TIMEOUT 5000000     // silence after which a transfer is given up (us)
+#define UDP_RATE_INIT (16ULL << 20)     // pacing rate of a transfer starting (bytes per second)
+#define UDP_RATE_MIN  (1ULL << 20)      // pacing rate at least
+#define UDP_RATE_MAX  (4ULL << 30)      // pacing rate at most
+#define UDP_RATE_STEP (1ULL << 20)      // pacing rate added per report without any loss, once a loss has been seen
+
+//datagrams of a transfer
+#define DG_DATA     1   // block of the file (seq : number of the block, stamp : time sent)
+#define DG_NACK     2   // report (seq : blocks received in order, stamp : time echoed, followed by the missing ranges)
+#define DG_DONE     3   // whole file received
 
-#define BACKLOG 10 // how many pending connections queue will hold
+typedef struct{
+    uint64_t sent;      // datagrams sent (retransmissions included)
+    uint64_t resent;    // datagrams sent again
+    uint64_t rate;      // pacing rate at the end of the transfer (bytes per second)
+    uint64_t rtt;       // smoothed round-trip time at the end of the transfer (us)
+}udpstat_t;
 
 void *get_in_addr(struct sockaddr *sa);
 int negociate_socket(char* host, char* service, int socktype, char ACTION, void (*on_error)(char*, ...));
+int setbacklog(int backlog);
+int setnodelay(int sockfd);
 int socket_to_ip(int* fd, char* address, int address_len);
 int acceptServ(int sockfd, char* client, int ip_size);
 int receiveData(int sockfd, void* buf, int bufsz, struct sockaddr_storage* client, int connected);
 int sendData(int sockfd, void* buf, int* length, struct sockaddr_storage* client, int connected);
+int64_t sendFile(int sockfd, int fd, uint64_t count);
+int64_t receiveFile(int sockfd, int fd, uint64_t offset, uint64_t count);
+int probeRing();
+int64_t sendFileRing(int sockfd, int fd, uint64_t count);
+void closeRing();
+int64_t sendVector(int sockfd, struct iovec* iov, int iovcnt);
+int bindUdp(int sockfd, uint16_t* port);
+int acceptUdp(int udpfd, int sockfd, uint16_t port);
+int connectUdp(int sockfd, uint16_t port, uint16_t* local);
+int64_t sendFileUdp(int udpfd, int sockfd, int fd, uint64_t count, udpstat_t* stat);
+int64_t receiveFileUdp(int udpfd, int fd, uint64_t offset, uint64_t count);
+int lingerUdp(int udpfd, int sockfd);
 #endif
@@ -1,15 +1,63 @@
 #ifndef PROTOCOL_H_INCLUDED
 #define PROTOCOL_H_INCLUDED
+#include <poll.h>
+#include <sys/mman.h>
+#include <zlib.h>
 #include "cstructures.h"
 #include "network.h"
 #include "serialisation.h"
+#include "checksum.h"
+#include "metrics.h"
+#include "dataset.h"
 
 #define MAXDATASIZE 4096 // max number of bytes we can get at once
+#define PZBUFSZ     65536 // max number of bytes inflated at once
+#define PFILEBUFSZ  (1 << 20) // max number of bytes of file received before being written at once
+#define PSUMCHUNK   (1 << 20) // max number of bytes of file sent by the kernel before being summed
 #define HEAD_F      "LLQ"
+#define HEAD_SZ     16  // size of a serialised header (HEAD_F)
+#define RANGE_F     "QQQ"
+#define RANGE_SZ    24  // size of a serialised range (RANGE_F)
 
 #define SLIST       0
 #define SFILE       1
 #define SSTRING     2
+#define SHELLO      3   // hello of a client, advertising its capabilities
+#define SACK        4   // acknowledgement of all the messages streamed
+#define STRAILER    5   // trailer following the data of a streamed message
+#define SRANGE      6   // range of a file (request of a part, or size of the file)
+#define SRESUME     7   // offset from which resume a file, with the checksum of the bytes before
+#define SCLOSE      8   // end of a kept session, sent by the client instead of its next hello
+#define SNAME       9   // file requested by its name, instead of a hello (the name follows)
+
+#define PVERSION    3   // version of the protocol (3 : CRC32C instead of Adler-32)
+#define PHELLO_WAIT 50  // milliseconds a server waits for a client hello
+#define PKEEP_IDLE  30000   // milliseconds a server waits for the next request of a kept session
+#define PHEAD_WAIT  5000    // milliseconds a server lets a hello (or a request) partly received complete
+#define PNAMEMAX    127     // length of a name requested at most (FILENAMESZ - 1)
+
+//capabilities, carried in the upper half of stype
+#define PF_STREAM   0x00010000  // messages pipelined, no acknowledgement in between
+#define PF_LISTZ    0x00020000  // list sent as length-prefixed names in one frame
+#define PF_RANGE    0x00040000  // file fetched by ranges, over several connections
+#define PF_RESUME   0x00080000  // file resumed from the data the client already has
+#define PF_DEFLATE  0x00200000  // file sent compressed (zlib stream), inflated by the client
+#define PF_KEEP     0x00400000  // connection kept for other requests, until the client closes it
+#define PF_NOLIST   0x00800000  // next request of a kept session, the list already received is used
+#define PF_STAT     0x01000000  // compact list carrying the size, modification time and type of each file
+#define PF_UDP      0x02000000  // file sent in datagrams (nbelem : UDP port of the sender, then of the receiver in its answer), the connection carrying the rest
+#define PF_ALL      (PF_STREAM | PF_LISTZ | PF_RANGE | PF_RESUME | PF_DEFLATE | PF_KEEP | PF_NOLIST | PF_STAT | PF_UDP)
+#define PF_CRC      0x00100000  // acknowledgement carrying the CRC32C of the data (in nbelem)
+
+#define PTYPE(stype)    ((stype) & 0x0000FFFF)
+#define PFLAGS(stype)   ((stype) & 0xFFFF0000)
+
+#define SND_COPY        0   // files are read in a buffer, then sent
+#define SND_ZEROCOPY    1   // files are handed to the kernel (sendfile/splice)
+#define SND_URING       2   // files are read and sent as a chain queued in an io_uring
+
+#define RCV_BATCH       0   // files are received in large aligned buffers, then written
+#define RCV_ZEROCOPY    1   // files are moved from the socket to the disk by the kernel (splice)
 
 typedef struct{
     uint32_t nbelem;
@@ -17,7 +65,99 @@ typedef struct{
     uint64_t szelem;
 }head_t;
 
+typedef struct{
+    uint64_t offset;    // first byte of the range
+    uint64_t length;    // amount of bytes in the range
+    uint64_t size;      // size of the whole file (checked by the server)
+}range_t;
+
+typedef struct{
+    uint32_t flags;     // capabilities carried by the last header received
+    uint32_t nbmsg;     // messages streamed since the last session acknowledgement
+    uint64_t bytes;     // bytes streamed since the last session acknowledgement
+}pstream_t;
+
+typedef struct{
+    unsigned char* map;     // read-only shared memory holding the serialised lists
+    size_t mapsz;           // size of the shared memory
+    unsigned char* list;    // list with one element per name (padded)
+    uint64_t listsz;        // size of the padded list
+    uint32_t listsum;       // checksum of the padded list
+    unsigned char* listz;   // list of length-prefixed names (PF_LISTZ)
+    uint64_t listzsz;       // size of the compact list
+    uint32_t listzsum;      // checksum of the compact list
+    unsigned char* liststat;    // list of names followed by their metadata (PF_STAT, NULL if none)
+    uint64_t liststatsz;    // size of the list with metadata
+    uint32_t liststatsum;   // checksum of the list with metadata
+    uint32_t nbelem;        // amount of names in the list
+    uint32_t elementsize;   // size of an element of the padded list
+}plist_t;
+
+/*
+** Header (de)serialisation : HEAD_F is fixed, so it is stored and loaded
+**  in straight line instead of being interpreted by pack()/unpack()
+*/
+static inline int pmkhead(unsigned char* serialised, head_t* header)
+{
+    storeu32(serialised, header->nbelem);
+    storeu32(serialised + 4, header->stype);
+    storeu64(serialised + 8, header->szelem);
+    return HEAD_SZ;
+}
+
+static inline void punpackhead(unsigned char* serialised, head_t* header)
+{
+    header->nbelem = loadu32(serialised);
+    header->stype = loadu32(serialised + 4);
+    header->szelem = loadu64(serialised + 8);
+}
+
+static inline int pmkrange(unsigned char* serialised, range_t* range)
+{
+    storeu64(serialised, range->offset);
+    storeu64(serialised + 8, range->length);
+    storeu64(serialised + 16, range->size);
+    return RANGE_SZ;
+}
+
+static inline void punpackrange(unsigned char* serialised, range_t* range)
+{
+    range->offset = loadu64(serialised);
+    range->length = loadu64(serialised + 8);
+    range->size = loadu64(serialised + 16);
+}
+
 int prcv(int sockfd, void* structure, void (*doPrint)(char*, ...));
 int psnd(int sockfd, void* structure, head_t* header, void (*doPrint)(char*, ...));
+int setsendmode(int mode);
+int setrecvmode(int mode);
+int pchkack(unsigned char* serialised, head_t* header, uint64_t size, uint32_t sum);
+int pmklist(meta_t* lis, unsigned char** payload, uint64_t* size);
+int pmklistz(meta_t* lis, unsigned char** payload, uint64_t* size);
+int pmkcache(meta_t* lis, plist_t* cache);
+int pmkcachearray(const void* elements, uint32_t nbelem, uint32_t elementsize, const filemeta_t* metas, plist_t* cache);
+char* pcachename(plist_t* cache, uint32_t index);
+void pfreecache(plist_t* cache);
+unsigned char* pcachelist(plist_t* cache, head_t* header, uint32_t* sum);
+int psndcache(int sockfd, plist_t* cache, head_t* header, void (*doPrint)(char*, ...));
+int pmktrailer(unsigned char* serialised, uint32_t sum, uint64_t size);
+uint32_t pfilesum(int fd, uint64_t offset, uint64_t size);
+uint32_t paddfilesum(uint32_t sum, int fd, uint64_t offset, uint64_t size);
+uint32_t pflags();
+int psndhello(int sockfd, uint32_t choice, uint32_t caps, void (*doPrint)(char*, ...));
+int prcvhello(int sockfd, head_t* hello, int timeout, void (*doPrint)(char*, ...));
+int phello(unsigned char* serialised, head_t* hello, void (*doPrint)(char*, ...));
+int psndack(int sockfd, void (*doPrint)(char*, ...));
+int psndclose(int sockfd, void (*doPrint)(char*, ...));
+int psndname(int sockfd, char* name, uint32_t caps, void (*doPrint)(char*, ...));
+int prcvname(int sockfd, head_t* request, char* name, void (*doPrint)(char*, ...));
+int prcvack(int sockfd, void (*doPrint)(char*, ...));
+int psndrange(int sockfd, uint32_t choice, range_t* range, void (*doPrint)(char*, ...));
+int prcvrange(int sockfd, range_t* range, void (*doPrint)(char*, ...));
+int pchkrange(range_t* range, uint64_t size);
+int prcvpart(int sockfd, int fd, range_t* range, void (*doPrint)(char*, ...));
+int psndresume(int sockfd, uint64_t offset, uint32_t sum, void (*doPrint)(char*, ...));
+int prcvresume(int sockfd, head_t* resume, void (*doPrint)(char*, ...));
+uint64_t pchkresume(int fd, uint64_t size, head_t* resume);
 
 #endif // PROTOCOL_H_INCLUDED
@@ -4,6 +4,14 @@
 #include <stdarg.h>
 #include <time.h>
 #include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #define RESET   0
 #define RED     31
@@ -16,11 +24,17 @@
 #define NORMAL  0
 #define BOLD    1
 
-#define SZLINE  128
+#define SZLINE  256
+
+#define LOG_SYNC    0           // messages formatted and written by the caller
+#define LOG_ASYNC   1           // messages queued, then formatted and written by a background thread
+#define LOG_SLOTS   1024        // messages held by the queue (power of 2)
+#define LOG_BATCH   65536       // bytes written at once by the background thread
 
 void format_output(char* final_msg, char* format, va_list* arg);
 void print_success(char* msg, ...);
 void print_error(char* msg, ...);
 void print_neutral(char* msg, ...);
+int setlogmode(int mode);
 
 #endif // SCREEN_H_INCLUDED
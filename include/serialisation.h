@@ -6,13 +6,68 @@
 #include <stdarg.h>
 #include <string.h>
 #include <stdint.h>
+#include <endian.h>
+#include <float.h>
+#include <math.h>
 
 #define pack754_16(f) (pack754((f), 16, 5))
+#define unpack754_16(i) (unpack754((i), 16, 5))
+
+//float-32 and float-64 reuse the native bits when the host is IEEE-754
+#if FLT_RADIX == 2 && FLT_MANT_DIG == 24 && DBL_MANT_DIG == 53
+#define pack754_32(f) (pack754_f32(f))
+#define pack754_64(f) (pack754_f64(f))
+#define unpack754_32(i) (unpack754_f32(i))
+#define unpack754_64(i) (unpack754_f64(i))
+#else
 #define pack754_32(f) (pack754((f), 32, 8))
 #define pack754_64(f) (pack754((f), 64, 11))
-#define unpack754_16(i) (unpack754((i), 16, 5))
 #define unpack754_32(i) (unpack754((i), 32, 8))
 #define unpack754_64(i) (unpack754((i), 64, 11))
+#endif
+
+#define PACKMAX 32  // max amount of fields in a compiled format
+
+//kernels used by the batch (un)packing functions
+#define SWAP_AUTO   0   // best kernel supported by the CPU
+#define SWAP_SCALAR 1   // one integer at a time
+#define SWAP_SSSE3  2   // 16 bytes per shuffle
+#define SWAP_AVX2   3   // 32 bytes per shuffle
+
+typedef struct{
+    unsigned int nbfields;          // amount of fields in the format
+    unsigned int size;              // total size of the serialised fields
+    unsigned char codes[PACKMAX];   // code of each field (as in pack())
+    unsigned char sizes[PACKMAX];   // serialised size of each field
+}packfmt_t;
+
+typedef struct{
+    unsigned char* buf;             // buffer read or written
+    size_t cap;                     // capacity of the buffer
+    size_t len;                     // amount of bytes available in the buffer
+    size_t pos;                     // position of the next byte to read or write
+    size_t need;                    // bytes missing for the last operation (0 if none)
+}cursor_t;
+
+/*
+** Straight-line stores and loads in network order (no call, no loop),
+**  meant for fixed formats on hot paths
+*/
+static inline void storeu16(unsigned char *buf, uint16_t i){ i = htobe16(i); memcpy(buf, &i, sizeof(i)); }
+static inline void storeu32(unsigned char *buf, uint32_t i){ i = htobe32(i); memcpy(buf, &i, sizeof(i)); }
+static inline void storeu64(unsigned char *buf, uint64_t i){ i = htobe64(i); memcpy(buf, &i, sizeof(i)); }
+static inline uint16_t loadu16(const unsigned char *buf){ uint16_t i; memcpy(&i, buf, sizeof(i)); return be16toh(i); }
+static inline uint32_t loadu32(const unsigned char *buf){ uint32_t i; memcpy(&i, buf, sizeof(i)); return be32toh(i); }
+static inline uint64_t loadu64(const unsigned char *buf){ uint64_t i; memcpy(&i, buf, sizeof(i)); return be64toh(i); }
+
+/*
+** Native IEEE-754 conversions : the bits of a float (double) already are
+**  the float-32 (float-64) format, subnormals, infinities and NaN included
+*/
+static inline uint32_t pack754_f32(float f){ uint32_t i; memcpy(&i, &f, sizeof(i)); return i; }
+static inline uint64_t pack754_f64(double f){ uint64_t i; memcpy(&i, &f, sizeof(i)); return i; }
+static inline float unpack754_f32(uint32_t i){ float f; memcpy(&f, &i, sizeof(f)); return f; }
+static inline double unpack754_f64(uint64_t i){ double f; memcpy(&f, &i, sizeof(f)); return f; }
 
 uint64_t pack754(long double f, unsigned bits, unsigned expbits);
 long double unpack754(uint64_t i, unsigned bits, unsigned expbits);
@@ -28,5 +83,24 @@ unsigned long long int unpacku64(unsigned char *buf);
 
 unsigned int pack(unsigned char *buf, char *format, ...);
 void unpack(unsigned char *buf, char *format, ...);
+int compile_format(packfmt_t* fmt, char* format);
+unsigned int packf(unsigned char *buf, packfmt_t* fmt, uint64_t* values);
+void unpackf(unsigned char *buf, packfmt_t* fmt, uint64_t* values);
+
+void cinit(cursor_t* cur, void* buf, size_t cap, size_t len);
+void cfeed(cursor_t* cur, size_t n);
+void ccompact(cursor_t* cur);
+int cpack(cursor_t* cur, char* format, ...);
+int cunpack(cursor_t* cur, char* format, ...);
+unsigned char* ctake(cursor_t* cur, size_t n);
+int cput(cursor_t* cur, const void* data, size_t n);
+
+int setswapkernel(int kernel);
+void packa16(unsigned char *buf, const uint16_t* values, size_t n);
+void packa32(unsigned char *buf, const uint32_t* values, size_t n);
+void packa64(unsigned char *buf, const uint64_t* values, size_t n);
+void unpacka16(uint16_t* values, const unsigned char *buf, size_t n);
+void unpacka32(uint32_t* values, const unsigned char *buf, size_t n);
+void unpacka64(uint64_t* values, const unsigned char *buf, size_t n);
 
 #endif // SERIALISATION_H_INCLUDED
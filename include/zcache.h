@@ -0,0 +1,28 @@
+#ifndef ZCACHE_H_INCLUDED
+#define ZCACHE_H_INCLUDED
+#include <pthread.h>
+#include <limits.h>
+#include <sys/file.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "global.h"
+#include "screen.h"
+
+#define ZC_SUFFIX   ".zcache"       // suffix of the cache directory, next to the directory served
+#define ZC_EXT      ".z"            // extension of the compressed files
+#define ZC_TMP      ".tmp"          // extension of a compressed file being built
+#define ZC_LEVEL    6               // compression level (built once, sent many times)
+#define ZC_MIN      4096            // files smaller than this are always sent raw
+#define ZC_SAMPLE   (1 << 20)       // bytes compressed before deciding whether the file is worth it
+#define ZC_RATIO    90              // max size of the compressed data, in % of the raw data
+#define ZC_CHUNK    65536           // bytes compressed at once
+
+//ways to build a missing compressed file
+#define ZC_WAIT     0   // build it before returning
+#define ZC_ASYNC    1   // build it in the background, the file is sent raw meanwhile
+
+int zcache_get(char* path, int fd, int mode);
+
+#endif // ZCACHE_H_INCLUDED
@@ -7,8 +7,12 @@ chead:= ../include
 
 #flags necessary to the compilation
 CC := gcc
-CFLAGS:= -fPIC -Wall -Werror -Wextra -g -I$(chead) -Icstructures/include
-lib_b:= libscreen.so libnetwork.so libdataset.so libserialisation.so libprotocol.so bcstructures
+CFLAGS:= -fPIC -Wall -Werror -Wextra -g -O2 -D_GNU_SOURCE -I$(chead) -Icstructures/include
+#optional io_uring engine (make URING=1)
+ifdef URING
+CFLAGS += -DNET_URING
+endif
+lib_b:= libscreen.so libnetwork.so libdataset.so libserialisation.so libchecksum.so libmetrics.so libprotocol.so libdirindex.so libzcache.so libeventloop.so bcstructures
 
 #objects compilation from the source files
 %.o: %.c
@@ -19,34 +23,64 @@ lib_b:= libscreen.so libnetwork.so libdataset.so libserialisation.so libprotocol
 #libraries compilation and linking (version number -> *.so file)
 libscreen.so : ../src/screen.o
 	@ echo "Building $@"
-	@ $(CC) -shared -fPIC -lc -Wl,-soname,$@.1 -o $@.1.0 $<
-	@ ldconfig -n . -l $@.1.0
+	@ $(CC) -shared -fPIC -lc -Wl,-soname,$@.1 -o $@.1.2 $< -lpthread
+	@ ldconfig -n . -l $@.1.2
 	@ ln -sf $@.1 $@
 
 libnetwork.so : ../src/network.o
 	@ echo "Building $@"
-	@ $(CC) -shared -fPIC -lc -Wl,-soname,$@.2 -o $@.2.0 $<
-	@ ldconfig -n . -l $@.2.0
+	@ $(CC) -shared -fPIC -lc -Wl,-soname,$@.2 -o $@.2.9 $<
+	@ ldconfig -n . -l $@.2.9
 	@ ln -sf $@.2 $@
 
 libdataset.so : ../src/dataset.o
 	@ echo "Building $@"
-	@ $(CC) -shared -fPIC -lc -Wl,-soname,$@.1 -o $@.1.2 $<
-	@ ldconfig -n . -l $@.1.2
+	@ $(CC) -shared -fPIC -lc -Wl,-soname,$@.1 -o $@.1.5 $<
+	@ ldconfig -n . -l $@.1.5
 	@ ln -sf $@.1 $@
 
 libserialisation.so : ../src/serialisation.o
 	@ echo "Building $@"
-	@ $(CC) -shared -fPIC -lc -Wl,-soname,$@.1 -o $@.1.1 $<
-	@ ldconfig -n . -l $@.1.1
+	@ $(CC) -shared -fPIC -lc -Wl,-soname,$@.1 -o $@.1.5 $< -lm
+	@ ldconfig -n . -l $@.1.5
 	@ ln -sf $@.1 $@
 
-libprotocol.so : ../src/protocol.o bcstructures libnetwork.so libserialisation.so
+libchecksum.so : ../src/checksum.o
 	@ echo "Building $@"
-	@ $(CC) -shared -fPIC -lc -L. -Lcstructures/lib -Wl,-soname,$@.2 -o $@.2.0 $< -lcstructures -lnetwork -lserialisation
+	@ $(CC) -shared -fPIC -lc -Wl,-soname,$@.2 -o $@.2.0 $<
 	@ ldconfig -n . -l $@.2.0
 	@ ln -sf $@.2 $@
 
+libmetrics.so : ../src/metrics.o libscreen.so
+	@ echo "Building $@"
+	@ $(CC) -shared -fPIC -lc -L. -Wl,-soname,$@.1 -o $@.1.2 $< -lscreen -lpthread
+	@ ldconfig -n . -l $@.1.2
+	@ ln -sf $@.1 $@
+
+libprotocol.so : ../src/protocol.o bcstructures libnetwork.so libserialisation.so libchecksum.so libmetrics.so
+	@ echo "Building $@"
+	@ $(CC) -shared -fPIC -lc -L. -Lcstructures/lib -Wl,-soname,$@.2 -o $@.2.24 $< -lcstructures -lnetwork -lserialisation -lchecksum -lmetrics -lz
+	@ ldconfig -n . -l $@.2.24
+	@ ln -sf $@.2 $@
+
+libdirindex.so : ../src/dirindex.o bcstructures libscreen.so libdataset.so libprotocol.so
+	@ echo "Building $@"
+	@ $(CC) -shared -fPIC -lc -L. -Lcstructures/lib -Wl,-soname,$@.1 -o $@.1.4 $< -lcstructures -lscreen -ldataset -lprotocol -lpthread
+	@ ldconfig -n . -l $@.1.4
+	@ ln -sf $@.1 $@
+
+libzcache.so : ../src/zcache.o libscreen.so
+	@ echo "Building $@"
+	@ $(CC) -shared -fPIC -lc -L. -Wl,-soname,$@.1 -o $@.1.1 $< -lscreen -lz -lpthread
+	@ ldconfig -n . -l $@.1.1
+	@ ln -sf $@.1 $@
+
+libeventloop.so : ../src/eventloop.o bcstructures libscreen.so libdataset.so libnetwork.so libprotocol.so libdirindex.so libzcache.so libmetrics.so
+	@ echo "Building $@"
+	@ $(CC) -shared -fPIC -lc -L. -Lcstructures/lib -Wl,-soname,$@.1 -o $@.1.20 $< -lcstructures -lscreen -ldataset -lnetwork -lprotocol -lchecksum -ldirindex -lzcache -lmetrics
+	@ ldconfig -n . -l $@.1.20
+	@ ln -sf $@.1 $@
+
 
 #overall functions
 all: $(lib_b)
@@ -4,9 +4,9 @@
 ** -------------------------------------------------------
 ** Based on Brian 'Beej Jorgensen' Hall's code
 ** Made by Gilles Henrard
-** Last modified : 31/10/2020
+** Last modified : 17/10/2026
 */
-#include <dirent.h>
+#include <pthread.h>
 #include "global.h"
 #include "network.h"
 #include "screen.h"
@@ -14,49 +14,131 @@
 #include "cstructures.h"
 #include "serialisation.h"
 #include "protocol.h"
+#include "dirindex.h"
+#include "eventloop.h"
+#include "zcache.h"
+#include "metrics.h"
+
+#define MODE_FORK   0   // one process forked per client
+#define MODE_EPOLL  1   // all the clients handled by an epoll event loop
+#define MODE_REUSEPORT 2 // one event loop per thread, each with its own listening socket
+
+typedef struct{
+    char* port;         // port on which listen
+    dirindex_t* index;  // files list, kept up to date (phases 1 and 2)
+    char* dirname;      // directory containing the files
+}worker_t;
 
 void sigchld_handler(int s);
-int ser_phase1(int rem_sock, meta_t* lis, char* rem_ip);
-int ser_phase2(int rem_sock, char* dirname, meta_t* lis, char* rem_ip);
-int ser_phase3(int rem_sock, char* filename, char* rem_ip);
+void ser_exit(int rem_sock, int status);
+void* reuseport_worker(void* arg);
+int ser_phase0(int rem_sock, head_t* hello, char* rem_ip);
+int ser_next(int rem_sock, head_t* hello, char* rem_ip, uint64_t* mark);
+int ser_name(int rem_sock, head_t* hello, catalog_t* names, snapshot_t** named, char* dirname, char* rem_ip);
+int ser_phase1(int rem_sock, plist_t* cache, char* rem_ip, head_t* hello);
+int ser_phase2(int rem_sock, char* dirname, catalog_t* names, char* rem_ip, head_t* hello);
+int ser_phase3(int rem_sock, char* filename, char* rem_ip, head_t* hello);
+int ser_size(int rem_sock, uint64_t fsize, char* rem_ip, head_t* hello);
+int ser_range(int rem_sock, char* dirname, catalog_t* names, char* rem_ip, head_t* request);
 
 int main(int argc, char *argv[])
 {
-    DIR *d = NULL;
-    struct dirent *dir = NULL;
-    meta_t lis = {NULL, NULL, 0, FILENAMESZ, compare_dataset, print_error};
-	int loc_socket=0, rem_socket=0;
+    dirindex_t index = {0};
+    snapshot_t *snap = NULL, *named = NULL;
+    head_t hello = {0};
+	int loc_socket=0, rem_socket=0, opt=0, mode=MODE_FORK, nbthreads=1, i=0, ret=0;
+	uint64_t mark = 0, start = 0;
+	pthread_t* threads = NULL;
+	worker_t worker = {0};
 	struct sigaction sa;
-	char s[INET6_ADDRSTRLEN]="0", dirname[FILENAMESZ]="0";
+	char s[INET6_ADDRSTRLEN]="0", dirname[FILENAMESZ]="0", path[FILENAMESZ]="0";
+
+	//parse the options
+	while((opt = getopt(argc, argv, "zuas:m:t:b:")) != -1)
+	{
+        switch(opt)
+        {
+            case 'z': //send the files without copying them in user space
+                setsendmode(SND_ZEROCOPY);
+                break;
+
+            case 'u': //read and send the files through an io_uring
+                if(probeRing() == -1)
+                    print_error("server: io_uring unavailable (%s), files sent by copy", strerror(errno));
+                else
+                    setsendmode(SND_URING);
+                break;
+
+            case 'a': //write the logs from a background thread
+                setlogmode(LOG_ASYNC);
+                break;
+
+            case 's': //expose the metrics on a UNIX socket
+                if(metrics_open("server") == -1 || metrics_serve(optarg) == -1)
+                {
+                    print_error("server: unable to expose the metrics on %s: %s", optarg, strerror(errno));
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'm': //way the clients are served
+                if(!strcmp(optarg, "fork"))
+                    mode = MODE_FORK;
+                else if(!strcmp(optarg, "epoll"))
+                    mode = MODE_EPOLL;
+                else if(!strcmp(optarg, "reuseport"))
+                    mode = MODE_REUSEPORT;
+                else
+                {
+                    print_error("server: unknown mode %s (fork, epoll or reuseport)", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 't': //amount of threads in reuseport mode
+                if((nbthreads = atoi(optarg)) < 1)
+                {
+                    print_error("server: invalid amount of threads %s", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'b': //amount of pending connections held by the listening sockets
+                if(atoi(optarg) < 1)
+                {
+                    print_error("server: invalid backlog %s", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                setbacklog(atoi(optarg));
+                break;
+
+            default:
+                print_error("usage: server [-z|-u] [-a] [-s socket] [-m fork|epoll|reuseport] [-t threads] [-b backlog] port [directory name]");
+                exit(EXIT_FAILURE);
+        }
+	}
 
 	//checks if the port number and directory path has been provided
-	if (argc!=3)
+	if (argc - optind != 2)
 	{
-		print_error("usage: server port [directory name]");
+		print_error("usage: server [-z|-u] [-a] [-s socket] [-m fork|epoll|reuseport] [-t threads] [-b backlog] port [directory name]");
 		exit(EXIT_FAILURE);
 	}
 
-    //create a list with all the files in the directory
-    if((d = opendir(argv[2])) != NULL)
-    {
-        while ((dir = readdir(d)) != NULL)
-        {
-            if(insertListSorted(&lis, dir->d_name) == -1)
-            {
-                print_error("server: insertlistbottom: error");
-                exit(EXIT_FAILURE);
-            }
-        }
-        closedir(d);
-    }
-    else
+    //copy the directory path in a buffer
+	strcpy(dirname, argv[optind+1]);
+
+    //index all the files in the directory, then keep the index up to date
+    if(dirindex_open(&index, dirname) == -1)
     {
-        print_error("server: opendir %s: %s", dirname, strerror(errno));
+        print_error("server: unable to index the directory %s", dirname);
         exit(EXIT_FAILURE);
     }
 
-    //copy the directory path in a buffer
-	strcpy(dirname, argv[2]);
+    if(dirindex_watch(&index) == -1)
+    {
+        print_error("server: the changes in %s will not be listed", dirname);
+    }
 
 	//prepare main process for SIGCHLD signals
 	sa.sa_handler = sigchld_handler;
@@ -68,8 +150,49 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
+	//a client leaving must not bring a whole event loop down
+	if(mode != MODE_FORK)
+	{
+        sa.sa_handler = SIG_IGN;
+        if (sigaction(SIGPIPE, &sa, NULL) == -1)
+        {
+            print_error("server: sigaction: %s", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+	}
+
+	//start the threads, each one listening on its own socket
+	if(mode == MODE_REUSEPORT)
+	{
+        worker.port = argv[optind];
+        worker.index = &index;
+        worker.dirname = dirname;
+        if((threads = calloc(nbthreads, sizeof(pthread_t))) == NULL)
+        {
+            print_error("server: calloc: %s", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        for(i = 0 ; i < nbthreads ; i++)
+        {
+            if(pthread_create(&threads[i], NULL, reuseport_worker, &worker) != 0)
+            {
+                print_error("server: pthread_create: unable to start the thread %d", i);
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        print_success("server: setup complete, %d threads waiting for connections...", nbthreads);
+        for(i = 0 ; i < nbthreads ; i++)
+            pthread_join(threads[i], NULL);
+
+        free(threads);
+        dirindex_close(&index);
+        exit(EXIT_FAILURE);
+	}
+
 	//create a local socket and handle any error
-    loc_socket = negociate_socket(NULL, argv[1], SOCK_STREAM, MULTI|BIND|LISTEN, print_error);
+    loc_socket = negociate_socket(NULL, argv[optind], SOCK_STREAM, MULTI|BIND|LISTEN, print_error);
     if(loc_socket == -1){
         print_error("server: unable to create a socket");
         exit(EXIT_FAILURE);
@@ -77,6 +200,15 @@ int main(int argc, char *argv[])
 
 	print_success("server: setup complete, waiting for connections...");
 
+	//serve all the clients from the current process
+	if(mode == MODE_EPOLL)
+	{
+        run_eventloop(loc_socket, &index, dirname);
+        close(loc_socket);
+        dirindex_close(&index);
+        exit(EXIT_FAILURE);
+	}
+
 	// main accept() loop
 	while(1)
 	{
@@ -89,10 +221,23 @@ int main(int argc, char *argv[])
 
 		print_neutral("server: %s -> connection received", s);
 
+		//the child serves the snapshot current when it is created
+		snap = dirindex_acquire(&index);
+
+		//counted before the fork, the child may end first
+		if(METRICS)
+		{
+            start = mark = metrics_now();
+            metrics_count(MC_ACCEPTED, 1);
+            metrics_count(MC_ACTIVE, 1);
+		}
+
 		//create subprocess for the child request
 		switch(fork()){
             case -1: //fork error
                 print_error("server: fork: %s", strerror(errno));
+                if(METRICS)
+                    metrics_count(MC_ACTIVE, -1);
                 break;
 
             case 0: //child process
@@ -100,47 +245,123 @@ int main(int argc, char *argv[])
                 close(loc_socket);
 
                 print_neutral("server: %s -> processing request", s);
+                if(METRICS)
+                    metrics_since(MH_ACCEPT, &mark);
 
-                //process the phase 1 : sending the files list to the client
-                if(ser_phase1(rem_socket, &lis, s) == -1)
+                //process the phase 0 : negociating the capabilities with the client
+                if(ser_phase0(rem_socket, &hello, s) == -1)
                 {
-                    print_error("server: phase1: unable to process the request from %s", s);
-                    close(rem_socket);
-                    freeDynList(&lis);
-                    exit(EXIT_FAILURE);
+                    print_error("server: phase0: unable to process the request from %s", s);
+                    ser_exit(rem_socket, EXIT_FAILURE);
                 }
 
-                //process the phase 2 : receiving the client's choice (update dirname)
-                if(ser_phase2(rem_socket, dirname, &lis, s) == -1)
+                if(METRICS)
+                    metrics_since(MH_HELLO, &mark);
+
+                //kept session : each request follows the acknowledgement of the last one
+                if((hello.stype & PF_KEEP) && setnodelay(rem_socket) == -1)
+                    print_error("server: %s -> setsockopt: %s", s, strerror(errno));
+
+                //range request : only send the part of file requested
+                if(PTYPE(hello.stype) == SRANGE)
                 {
-                    print_error("server: phase2: unable to process the request from %s", s);
-                    close(rem_socket);
-                    freeDynList(&lis);
-                    exit(EXIT_FAILURE);
+                    if(ser_range(rem_socket, dirname, &snap->names, s, &hello) == -1)
+                    {
+                        print_error("server: range: unable to process the request from %s", s);
+                        ser_exit(rem_socket, EXIT_FAILURE);
+                    }
+
+                    if(METRICS)
+                    {
+                        metrics_since(MH_FILE, &mark);
+                        metrics_record(MH_SESSION, mark - start);
+                    }
+
+                    print_success("server: %s -> range processed", s);
+                    ser_exit(rem_socket, EXIT_SUCCESS);
                 }
 
-                //the list is not needed anymore
-                freeDynList(&lis);
-
-                //process the phase 3 : sending the file chosen by the client
-                if(ser_phase3(rem_socket, dirname, s) == -1)
+                //process the requests of the session (a single one, unless kept by the client)
+                do
                 {
-                    print_error("server: phase3: unable to process the request from %s", s);
-                    close(rem_socket);
-                    exit(EXIT_FAILURE);
+                    //file requested by its name : no list at all
+                    if(PTYPE(hello.stype) == SNAME && ser_name(rem_socket, &hello, &snap->names, &named, dirname, s) == -1)
+                    {
+                        print_error("server: name: unable to process the request from %s", s);
+                        ser_exit(rem_socket, EXIT_FAILURE);
+                    }
+
+                    //process the phase 1 : sending the files list to the client (unless already sent)
+                    if(!(hello.stype & PF_NOLIST))
+                    {
+                        if(ser_phase1(rem_socket, &snap->cache, s, &hello) == -1)
+                        {
+                            print_error("server: phase1: unable to process the request from %s", s);
+                            ser_exit(rem_socket, EXIT_FAILURE);
+                        }
+
+                        if(METRICS)
+                            metrics_since(MH_LIST, &mark);
+                    }
+
+                    //process the phase 2 : receiving the client's choice (update path)
+                    //  (a name not in the snapshot of the child has been found in one of its own)
+                    strcpy(path, dirname);
+                    if(ser_phase2(rem_socket, path, (named ? &named->names : &snap->names), s, &hello) == -1)
+                    {
+                        print_error("server: phase2: unable to process the request from %s", s);
+                        ser_exit(rem_socket, EXIT_FAILURE);
+                    }
+
+                    if(named)
+                    {
+                        dirindex_release(named);
+                        named = NULL;
+                    }
+
+                    if(METRICS)
+                        metrics_since(MH_CHOICE, &mark);
+
+                    //process the phase 3 : sending the file chosen by the client
+                    if(ser_phase3(rem_socket, path, s, &hello) == -1)
+                    {
+                        print_error("server: phase3: unable to process the request from %s", s);
+                        ser_exit(rem_socket, EXIT_FAILURE);
+                    }
+
+                    //messages streamed : check the session acknowledgement
+                    if((hello.stype & PF_STREAM) && prcvack(rem_socket, print_error) == -1)
+                    {
+                        print_error("server: %s -> the client did not acknowledge the session", s);
+                        ser_exit(rem_socket, EXIT_FAILURE);
+                    }
+
+                    if(METRICS)
+                        metrics_since(MH_FILE, &mark);
+
+                    print_success("server: %s -> request processed", s);
+                }while((hello.stype & PF_KEEP) && (ret = ser_next(rem_socket, &hello, s, &mark)) > 0);
+
+                if(ret == -1)
+                {
+                    print_error("server: next: unable to process the request from %s", s);
+                    ser_exit(rem_socket, EXIT_FAILURE);
                 }
 
-                print_success("server: %s -> request processed", s);
+                if(METRICS)
+                    metrics_record(MH_SESSION, metrics_now() - start);
 
                 //close connection socket and exit child process
-                close(rem_socket);
-                exit(EXIT_SUCCESS);
+                ser_exit(rem_socket, EXIT_SUCCESS);
                 break;
 
             default: //parent process
                 close(rem_socket); // parent doesn't need this
                 break;
 		}
+
+		//the parent's reference is not needed anymore (the child has its own copy)
+		dirindex_release(snap);
 	}
 
 	exit(EXIT_SUCCESS);
@@ -160,32 +381,189 @@ void sigchld_handler(int s)
 	int saved_errno = errno;
 
 	//make sure any child process terminating has its ressources released
-	while (waitpid(-1, NULL, WNOHANG) > 0);
+	while (waitpid(-1, NULL, WNOHANG) > 0)
+	{
+        if(METRICS)
+            metrics_count(MC_ACTIVE, -1);
+	}
 
 	errno = saved_errno;
 }
 
+/************************************************************************/
+/*  I : connection socket                                               */
+/*      exit status of the child process                                */
+/*  P : Closes the connection and ends the child process which served   */
+/*          it, accounting the session as processed or failed           */
+/*  O : /                                                               */
+/************************************************************************/
+void ser_exit(int rem_sock, int status)
+{
+    if(METRICS)
+        metrics_count((status == EXIT_SUCCESS ? MC_DONE : MC_FAILED), 1);
+
+    close(rem_sock);
+    exit(status);
+}
+
+/************************************************************************/
+/*  I : worker information (port, files list, directory)                */
+/*  P : Creates a listening socket sharing the port with the other      */
+/*          threads, and serves its clients with an event loop          */
+/*  O : NULL                                                            */
+/************************************************************************/
+void* reuseport_worker(void* arg)
+{
+    worker_t* worker = (worker_t*)arg;
+    int loc_socket = 0;
+
+    loc_socket = negociate_socket(NULL, worker->port, SOCK_STREAM, MULTI|REUSEPORT|BIND|LISTEN, print_error);
+    if(loc_socket == -1){
+        print_error("server: unable to create a socket");
+        return NULL;
+    }
+
+    run_eventloop(loc_socket, worker->index, worker->dirname);
+    close(loc_socket);
+    return NULL;
+}
+
+/************************************************************************/
+/*  I : socket file descriptor from which receive the hello             */
+/*      header to fill with the hello (capabilities and choice)         */
+/*      IP address of the client                                        */
+/*  P : Handles the phase 0: wait for the hello of the client and keep  */
+/*          the capabilities supported (none for legacy clients)        */
+/*  O : -1 on error                                                     */
+/*       0 otherwise                                                    */
+/************************************************************************/
+int ser_phase0(int rem_sock, head_t* hello, char* rem_ip)
+{
+    int ret = 0;
+
+    memset(hello, 0, sizeof(head_t));
+    if((ret = prcvhello(rem_sock, hello, PHELLO_WAIT, print_error)) == -1)
+        return -1;
+
+    if(ret == 0)
+        hello->stype = SHELLO;
+
+    //the first request of a session always gets the list, nothing else ends it
+    if(PTYPE(hello->stype) == SCLOSE)
+    {
+        print_error("server: %s -> session closed before any request", rem_ip);
+        return -1;
+    }
+    hello->stype &= ~PF_NOLIST;
+
+    print_neutral("server: %s -> capabilities negociated: %#x", rem_ip, PFLAGS(hello->stype));
+    return 0;
+}
+
+/************************************************************************/
+/*  I : socket file descriptor of the kept session                      */
+/*      header to fill with the hello of the next request               */
+/*      IP address of the client                                        */
+/*      time at which the phase started (updated when a request comes)  */
+/*  P : Waits (for a while) for the next request of a kept session      */
+/*  O : -1 on error                                                     */
+/*       0 if the session is over (closed by the client, or idle)       */
+/*       1 if a request has been received                               */
+/************************************************************************/
+int ser_next(int rem_sock, head_t* hello, char* rem_ip, uint64_t* mark)
+{
+    int ret = 0;
+
+    memset(hello, 0, sizeof(head_t));
+    if((ret = prcvhello(rem_sock, hello, PKEEP_IDLE, print_error)) == -1)
+        return -1;
+
+    if(ret == 0)
+    {
+        print_neutral("server: %s -> session idle for %d ms, closed", rem_ip, PKEEP_IDLE);
+        return 0;
+    }
+
+    if(PTYPE(hello->stype) == SCLOSE)
+    {
+        print_neutral("server: %s -> session closed by the client", rem_ip);
+        return 0;
+    }
+
+    if(METRICS)
+        *mark = metrics_now();
+
+    //file requested by its name, or by its choice (a range request is served on a connection of its own)
+    if(PTYPE(hello->stype) != SHELLO && PTYPE(hello->stype) != SNAME)
+    {
+        print_error("server: %s -> unexpected header type %d in a kept session", rem_ip, PTYPE(hello->stype));
+        return -1;
+    }
+
+    print_neutral("server: %s -> next request, capabilities: %#x", rem_ip, PFLAGS(hello->stype));
+    return 1;
+}
+
+/************************************************************************/
+/*  I : socket file descriptor from which receive the name              */
+/*      request by name (turned into the hello of a choice)             */
+/*      catalog of the files (snapshot of the child)                    */
+/*      snapshot to fill if the directory is read again (to be          */
+/*          released by the caller, the choice then refers to it)       */
+/*      directory containing the files                                  */
+/*      IP address of the client                                        */
+/*  P : Receives the name requested and finds it through the hash index */
+/*          of the catalog, or of the directory read again if the file  */
+/*          came after the child started : the request goes on          */
+/*          streamed, as if the list had already been received          */
+/*  O : -1 on error (no file has this name)                             */
+/*       0 otherwise                                                    */
+/************************************************************************/
+int ser_name(int rem_sock, head_t* hello, catalog_t* names, snapshot_t** named, char* dirname, char* rem_ip)
+{
+    char name[PNAMEMAX + 1] = {0};
+    int64_t index = 0;
+
+    if(prcvname(rem_sock, hello, name, print_error) == -1)
+        return -1;
+
+    //the child does not get the updates of the index : a name it misses is looked for in the directory
+    if((index = catalog_lookup(names, name)) == -1 && (*named = dirindex_snapshot(dirname)) != NULL)
+        index = catalog_lookup(&(*named)->names, name);
+
+    if(index == -1)
+    {
+        print_error("server: %s -> no file named %s", rem_ip, name);
+        return -1;
+    }
+    print_neutral("server: %s -> client requested %s", rem_ip, name);
+
+    hello->nbelem = index + 1;
+    hello->stype = SHELLO | PFLAGS(hello->stype) | PF_STREAM | PF_NOLIST;
+    return 0;
+}
+
 /************************************************************************/
 /*  I : socket file descriptor to which send the reply                  */
-/*      list of the files in te directoty set in program argument       */
+/*      files list, serialised when the directory changed               */
 /*      IP address of the client                                        */
+/*      hello of the client                                             */
 /*  P : Handles the phase 1: send the files list to the client          */
 /*  O : -1 on error                                                     */
 /*       0 otherwise                                                    */
 /************************************************************************/
-int ser_phase1(int rem_sock, meta_t* lis, char* rem_ip)
+int ser_phase1(int rem_sock, plist_t* cache, char* rem_ip, head_t* hello)
 {
-    head_t header = {0, 0, FILENAMESZ};
+    head_t header = {0};
 
-    //prepare and send the header with the data information
-    header.stype = SLIST;
-    header.nbelem = lis->nbelements;
-    print_neutral("server: %s -> sending %d elements of %ld bytes", rem_ip, header.nbelem, header.szelem);
-    if(psnd(rem_sock, lis, &header, print_error) == -1)
+    //send the list already serialised (with the capabilities accepted)
+    header.stype = SLIST | PFLAGS(hello->stype);
+    if(psndcache(rem_sock, cache, &header, print_error) == -1)
     {
         print_error("server: %s -> error while sending the list to the client", rem_ip);
         return -1;
     }
+    print_neutral("server: %s -> %d elements of %ld bytes sent", rem_ip, header.nbelem, header.szelem);
 
     return 0;
 }
@@ -193,32 +571,40 @@ int ser_phase1(int rem_sock, meta_t* lis, char* rem_ip)
 /************************************************************************/
 /*  I : socket file descriptor to which send the reply                  */
 /*      name of the file chosen by the client                           */
-/*      list of files in the directory set in program argument          */
+/*      catalog of the files listed in phase 1                          */
 /*      IP address of the client                                        */
+/*      hello of the client                                             */
 /*  P : Handles the phase 2: wait for the client's choice and update    */
 /*          the full path of the file to send                           */
 /*  O : -1 on error                                                     */
 /*       0 otherwise                                                    */
 /************************************************************************/
-int ser_phase2(int rem_sock, char* dirname, meta_t* lis, char* rem_ip)
+int ser_phase2(int rem_sock, char* dirname, catalog_t* names, char* rem_ip, head_t* hello)
 {
     char filename[FILENAMESZ]={0}, fullpath[FILENAMESZ*2]={0};
     int choice=0;
     head_t header = {0};
 
-    //receive the client's reply
-    if (receiveData(rem_sock, &choice, sizeof(int), NULL, 1) == -1)
+    //receive the client's reply (already sent in the hello if streaming)
+    if(hello->stype & PF_STREAM)
+        choice = hello->nbelem;
+    else if (receiveData(rem_sock, &choice, sizeof(int), NULL, 1) == -1)
     {
         print_error("server: %s -> receiveData: %s", strerror(errno));
         return -1;
     }
 
     //interpret the choice number to a filename
-    strcpy(filename, (char*)get_listelem(lis, choice-1));
+    if(choice < 1 || catalog_name(names, choice-1) == NULL)
+    {
+        print_error("server: %s -> invalid choice %d", rem_ip, choice);
+        return -1;
+    }
+    strcpy(filename, catalog_name(names, choice-1));
     print_neutral("server: %s -> client chose %s", rem_ip, filename);
 
     //prepare and send the header with the data information
-    header.stype = SSTRING;
+    header.stype = SSTRING | (hello->stype & PF_STREAM);
     header.nbelem = 1;
     header.szelem = strlen(filename);
     print_neutral("server: %s -> sending %d elements of %ld bytes", rem_ip, header.nbelem, header.szelem);
@@ -239,29 +625,77 @@ int ser_phase2(int rem_sock, char* dirname, meta_t* lis, char* rem_ip)
 /*  I : socket file descriptor to which send the reply                  */
 /*      name of the file to transmit                                    */
 /*      IP address of the client                                        */
-/*  P : Handles the phase 3: sending the file to the client             */
+/*      hello of the client                                             */
+/*  P : Handles the phase 3: sending the file to the client (from the   */
+/*          offset the client already has, if resuming, in datagrams if */
+/*          the client receives them, or compressed if the client       */
+/*          inflates it and it is worth it)                             */
 /*  O : -1 on error                                                     */
 /*       0 otherwise                                                    */
 /************************************************************************/
-int ser_phase3(int rem_sock, char* filename, char* rem_ip)
+int ser_phase3(int rem_sock, char* filename, char* rem_ip, head_t* hello)
 {
-    head_t header = {0};
-    int fd = 0;
-    uint64_t fsize = 0;
+    head_t header = {0}, resume = {0};
+    int fd = 0, zfd = 0;
+    uint64_t fsize = 0, offset = 0;
 
     //open the requested file
     if((fd = open(filename, O_RDONLY)) == -1)
     {
-        print_error("server: %s -> open: %s", strerror(errno));
+        print_error("server: %s -> open: %s", rem_ip, strerror(errno));
         return -1;
     }
     fsize = lseek(fd, 0, SEEK_END);
     lseek(fd, 0, SEEK_SET);
 
+    //file fetched by ranges : only announce its size
+    if(hello->stype & PF_RANGE)
+    {
+        close(fd);
+        return ser_size(rem_sock, fsize, rem_ip, hello);
+    }
+
+    //file resumed : skip the data the client has, if it matches the file
+    if(hello->stype & PF_RESUME)
+    {
+        if(prcvresume(rem_sock, &resume, print_error) == -1)
+        {
+            close(fd);
+            return -1;
+        }
+
+        offset = pchkresume(fd, fsize, &resume);
+        if(psndresume(rem_sock, offset, resume.nbelem, print_error) == -1)
+        {
+            close(fd);
+            return -1;
+        }
+        lseek(fd, offset, SEEK_SET);
+        print_neutral("server: %s -> resuming from byte %lu (%lu requested)", rem_ip, offset, resume.szelem);
+    }
+
+    //file sent in datagrams if the client receives them (raw, as they may come in any order)
+    header.stype = SFILE | (hello->stype & PF_STREAM);
+    if((hello->stype & PF_UDP) && fsize > offset)
+    {
+        header.stype |= PF_UDP;
+        print_neutral("server: %s -> sending the file in datagrams", rem_ip);
+    }
+
+    //whole file inflated by the client : send its compressed version instead
+    if((hello->stype & PF_DEFLATE) && !(header.stype & PF_UDP) && offset == 0 && (zfd = zcache_get(filename, fd, ZC_WAIT)) != -1)
+    {
+        close(fd);
+        fd = zfd;
+        fsize = lseek(fd, 0, SEEK_END);
+        lseek(fd, 0, SEEK_SET);
+        header.stype |= PF_DEFLATE;
+        print_neutral("server: %s -> sending the file compressed", rem_ip);
+    }
+
     //prepare the header with the data information
-    header.szelem = fsize;
+    header.szelem = fsize - offset;
     header.nbelem = 1;
-    header.stype = SFILE;
 
     //send the file
     print_neutral("server: %s -> sending %d elements of %ld bytes", rem_ip, header.nbelem, header.szelem);
@@ -275,3 +709,92 @@ int ser_phase3(int rem_sock, char* filename, char* rem_ip)
     close(fd);
     return 0;
 }
+
+/************************************************************************/
+/*  I : socket file descriptor to which send the reply                  */
+/*      size of the file chosen by the client                           */
+/*      IP address of the client                                        */
+/*      hello of the client                                             */
+/*  P : Handles the phase 3 of a client fetching the file by ranges:    */
+/*          sends the size of the file instead of the file itself       */
+/*  O : -1 on error                                                     */
+/*       0 otherwise                                                    */
+/************************************************************************/
+int ser_size(int rem_sock, uint64_t fsize, char* rem_ip, head_t* hello)
+{
+    head_t header = {0};
+    range_t range = {0};
+
+    range.length = fsize;
+    range.size = fsize;
+    header.stype = SRANGE | (hello->stype & PF_STREAM);
+    print_neutral("server: %s -> announcing a file of %lu bytes, to be fetched by ranges", rem_ip, fsize);
+    if(psnd(rem_sock, &range, &header, print_error) == -1)
+    {
+        print_error("server: %s -> error while sending the size of the file to the client", rem_ip);
+        return -1;
+    }
+
+    return 0;
+}
+
+/************************************************************************/
+/*  I : socket file descriptor to which send the reply                  */
+/*      directory containing the files                                  */
+/*      catalog of the files (the choice of the request refers to)      */
+/*      IP address of the client                                        */
+/*      range request header (choice of the file)                       */
+/*  P : Handles a range request: receives the range, then sends this    */
+/*          part of the file only                                       */
+/*  O : -1 on error                                                     */
+/*       0 otherwise                                                    */
+/************************************************************************/
+int ser_range(int rem_sock, char* dirname, catalog_t* names, char* rem_ip, head_t* request)
+{
+    char fullpath[FILENAMESZ*2] = {0}, *filename = NULL;
+    head_t header = {0};
+    range_t range = {0};
+    uint64_t fsize = 0;
+    int fd = 0;
+
+    if(prcvrange(rem_sock, &range, print_error) == -1)
+        return -1;
+
+    //interpret the choice number to a filename
+    if((filename = catalog_name(names, request->nbelem - 1)) == NULL)
+    {
+        print_error("server: %s -> invalid choice %d", rem_ip, request->nbelem);
+        return -1;
+    }
+    sprintf(fullpath, "%s/%s", dirname, filename);
+
+    //open the requested file and check the range still fits in it
+    if((fd = open(fullpath, O_RDONLY)) == -1)
+    {
+        print_error("server: %s -> open: %s", rem_ip, strerror(errno));
+        return -1;
+    }
+    fsize = lseek(fd, 0, SEEK_END);
+    if(pchkrange(&range, fsize) == -1)
+    {
+        print_error("server: %s -> range %lu+%lu of %s can not be served", rem_ip, range.offset, range.length, filename);
+        close(fd);
+        return -1;
+    }
+    lseek(fd, range.offset, SEEK_SET);
+
+    //send the part of file as a file of its own
+    header.szelem = range.length;
+    header.nbelem = 1;
+    header.stype = SFILE;
+    print_neutral("server: %s -> sending bytes %lu to %lu of %s", rem_ip, range.offset, range.offset + range.length, filename);
+    if(psnd(rem_sock, &fd, &header, print_error) == -1)
+    {
+        print_error("server: %s -> error while sending the range to the client", rem_ip);
+        close(fd);
+        return -1;
+    }
+
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,311 @@
+/*
+** checksum.c
+** Library regrouping checksum-based functions
+** ------------------------------------------
+** Made by Gilles Henrard
+** Last modified : 17/10/2026
+*/
+#include <string.h>
+#include "checksum.h"
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#define CRC_X86
+#endif
+
+typedef uint32_t (*crcfn_t)(uint32_t, const void*, size_t);
+static uint32_t crc_scalar(uint32_t crc, const void* buf, size_t len);
+#ifdef CRC_X86
+static uint32_t crc_sse42(uint32_t crc, const void* buf, size_t len);
+#endif
+static uint32_t crc_shift(uint32_t zeros[][256], uint32_t crc);
+static uint32_t gf2_times(uint32_t* mat, uint32_t vec);
+static void crc_zeros(uint32_t zeros[][256], size_t len);
+
+static uint32_t crc_table[8][256];      // CRC of each byte, then of each byte followed by 1 to 7 zeros
+static uint32_t crc_long[4][256];       // shifts a CRC by CRC_LONG zeros
+static uint32_t crc_short[4][256];      // shifts a CRC by CRC_SHORT zeros
+static crcfn_t crcfn = crc_scalar;
+
+/************************************************************************/
+/*  I : checksum of the data already processed (ADLER_INIT at first)    */
+/*      buffer containing the next data                                 */
+/*      size of the buffer                                              */
+/*  P : Updates an Adler-32 checksum with the content of a buffer, so   */
+/*          it can be computed while the data flows                     */
+/*  O : updated checksum                                                */
+/************************************************************************/
+uint32_t adlersum(uint32_t adler, const void* buf, size_t len)
+{
+    const unsigned char* data = (const unsigned char*)buf;
+    uint32_t a = adler & 0xFFFF, b = adler >> 16;
+    size_t block = 0;
+
+    while(len > 0)
+    {
+        //delay the modulo as long as the sums can't overflow
+        block = (len < ADLER_NMAX ? len : ADLER_NMAX);
+        len -= block;
+        while(block--)
+        {
+            a += *data++;
+            b += a;
+        }
+
+        a %= ADLER_MOD;
+        b %= ADLER_MOD;
+    }
+
+    return (b << 16) | a;
+}
+
+/************************************************************************/
+/*  I : CRC of the data already processed (CRC32C_INIT at first)        */
+/*      buffer containing the next data                                 */
+/*      size of the buffer                                              */
+/*  P : Updates a CRC32C with the content of a buffer, so it can be     */
+/*          computed while the data flows (with the fastest kernel)     */
+/*  O : updated CRC                                                     */
+/************************************************************************/
+uint32_t crc32c(uint32_t crc, const void* buf, size_t len)
+{
+    return (*crcfn)(crc, buf, len);
+}
+
+/************************************************************************/
+/*  I : kernel to use (CRC_AUTO, CRC_SCALAR or CRC_SSE42)               */
+/*  P : Sets the kernel used by crc32c()                                */
+/*  O : -1 if the kernel is unknown or not supported by the CPU         */
+/*       0 otherwise                                                    */
+/************************************************************************/
+int setcrckernel(int kernel)
+{
+    switch(kernel)
+    {
+    case CRC_SCALAR:
+        crcfn = crc_scalar;
+        return 0;
+
+#ifdef CRC_X86
+    case CRC_SSE42:
+        __builtin_cpu_init();
+        if(!__builtin_cpu_supports("sse4.2"))
+            return -1;
+        crcfn = crc_sse42;
+        return 0;
+#endif
+
+    case CRC_AUTO:
+        if(setcrckernel(CRC_SSE42) == -1)
+            crcfn = crc_scalar;
+        return 0;
+
+    default:
+        return -1;
+    }
+}
+
+/************************************************************************/
+/*  I : CRC of the data already processed                               */
+/*      buffer containing the next data                                 */
+/*      size of the buffer                                              */
+/*  P : Updates a CRC32C with tables (slicing-by-8): 8 bytes per step,  */
+/*          whatever the byte order of the CPU                          */
+/*  O : updated CRC                                                     */
+/************************************************************************/
+static uint32_t crc_scalar(uint32_t crc, const void* buf, size_t len)
+{
+    const unsigned char* next = (const unsigned char*)buf;
+
+    crc = ~crc;
+    while(len >= 8)
+    {
+        crc ^= (uint32_t)next[0] | (uint32_t)next[1] << 8 | (uint32_t)next[2] << 16 | (uint32_t)next[3] << 24;
+        crc = crc_table[7][crc & 0xFF] ^ crc_table[6][(crc >> 8) & 0xFF]
+            ^ crc_table[5][(crc >> 16) & 0xFF] ^ crc_table[4][crc >> 24]
+            ^ crc_table[3][next[4]] ^ crc_table[2][next[5]]
+            ^ crc_table[1][next[6]] ^ crc_table[0][next[7]];
+        next += 8;
+        len -= 8;
+    }
+
+    while(len--)
+        crc = crc_table[0][(crc ^ *next++) & 0xFF] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+#ifdef CRC_X86
+/************************************************************************/
+/*  I : CRC of the data already processed                               */
+/*      buffer containing the next data                                 */
+/*      size of the buffer                                              */
+/*  P : Updates a CRC32C with the crc32 instruction: three blocks are   */
+/*          processed at once (the instruction has a latency of three   */
+/*          cycles), then their CRCs are combined by shifting them      */
+/*          through the zeros tables                                    */
+/*  O : updated CRC                                                     */
+/************************************************************************/
+__attribute__((target("sse4.2")))
+static uint32_t crc_sse42(uint32_t crc, const void* buf, size_t len)
+{
+    const unsigned char *next = (const unsigned char*)buf, *end = NULL;
+    uint64_t crc0 = ~crc & 0xFFFFFFFF, crc1 = 0, crc2 = 0, word = 0;
+
+    //align the data on 8 bytes
+    while(len > 0 && ((uintptr_t)next & 7) != 0)
+    {
+        crc0 = _mm_crc32_u8(crc0, *next++);
+        len--;
+    }
+
+    //three long blocks at once
+    while(len >= CRC_LONG * 3)
+    {
+        crc1 = 0;
+        crc2 = 0;
+        for(end = next + CRC_LONG ; next < end ; next += 8)
+        {
+            memcpy(&word, next, 8);
+            crc0 = _mm_crc32_u64(crc0, word);
+            memcpy(&word, next + CRC_LONG, 8);
+            crc1 = _mm_crc32_u64(crc1, word);
+            memcpy(&word, next + CRC_LONG * 2, 8);
+            crc2 = _mm_crc32_u64(crc2, word);
+        }
+        crc0 = crc_shift(crc_long, crc0) ^ crc1;
+        crc0 = crc_shift(crc_long, crc0) ^ crc2;
+        next += CRC_LONG * 2;
+        len -= CRC_LONG * 3;
+    }
+
+    //three short blocks at once
+    while(len >= CRC_SHORT * 3)
+    {
+        crc1 = 0;
+        crc2 = 0;
+        for(end = next + CRC_SHORT ; next < end ; next += 8)
+        {
+            memcpy(&word, next, 8);
+            crc0 = _mm_crc32_u64(crc0, word);
+            memcpy(&word, next + CRC_SHORT, 8);
+            crc1 = _mm_crc32_u64(crc1, word);
+            memcpy(&word, next + CRC_SHORT * 2, 8);
+            crc2 = _mm_crc32_u64(crc2, word);
+        }
+        crc0 = crc_shift(crc_short, crc0) ^ crc1;
+        crc0 = crc_shift(crc_short, crc0) ^ crc2;
+        next += CRC_SHORT * 2;
+        len -= CRC_SHORT * 3;
+    }
+
+    //what's left, 8 bytes then one byte at a time
+    for(end = next + (len & ~(size_t)7) ; next < end ; next += 8)
+    {
+        memcpy(&word, next, 8);
+        crc0 = _mm_crc32_u64(crc0, word);
+    }
+
+    for(len &= 7 ; len > 0 ; len--)
+        crc0 = _mm_crc32_u8(crc0, *next++);
+
+    return ~(uint32_t)crc0;
+}
+#endif
+
+/************************************************************************/
+/*  I : zeros table of a block size                                     */
+/*      CRC to shift                                                    */
+/*  P : Gives the CRC the data would have with a block of zeros         */
+/*          appended (used to combine the CRCs of consecutive blocks)   */
+/*  O : shifted CRC                                                     */
+/************************************************************************/
+static uint32_t crc_shift(uint32_t zeros[][256], uint32_t crc)
+{
+    return zeros[0][crc & 0xFF] ^ zeros[1][(crc >> 8) & 0xFF] ^ zeros[2][(crc >> 16) & 0xFF] ^ zeros[3][crc >> 24];
+}
+
+/************************************************************************/
+/*  I : matrix (32 columns) over GF(2)                                  */
+/*      vector to multiply                                              */
+/*  P : Multiplies a vector by a matrix over GF(2)                      */
+/*  O : product                                                         */
+/************************************************************************/
+static uint32_t gf2_times(uint32_t* mat, uint32_t vec)
+{
+    uint32_t sum = 0;
+
+    for( ; vec ; vec >>= 1, mat++)
+    {
+        if(vec & 1)
+            sum ^= *mat;
+    }
+
+    return sum;
+}
+
+/************************************************************************/
+/*  I : zeros table to fill                                             */
+/*      size of the block of zeros (power of 2)                         */
+/*  P : Builds the operator appending a block of zeros to a CRC (by     */
+/*          squaring the operator of a single zero bit), then tabulates */
+/*          it byte by byte                                             */
+/*  O : /                                                               */
+/************************************************************************/
+static void crc_zeros(uint32_t zeros[][256], size_t len)
+{
+    uint32_t op[32] = {0}, square[32] = {0};
+    size_t bits = 1;
+    int n = 0;
+
+    //operator for a single zero bit
+    op[0] = CRC32C_POLY;
+    for(n = 1 ; n < 32 ; n++)
+        op[n] = (uint32_t)1 << (n - 1);
+
+    //square it until it appends the whole block
+    for(bits = 1 ; bits < len * 8 ; bits <<= 1)
+    {
+        for(n = 0 ; n < 32 ; n++)
+            square[n] = gf2_times(op, op[n]);
+        memcpy(op, square, sizeof(op));
+    }
+
+    for(n = 0 ; n < 256 ; n++)
+    {
+        zeros[0][n] = gf2_times(op, n);
+        zeros[1][n] = gf2_times(op, (uint32_t)n << 8);
+        zeros[2][n] = gf2_times(op, (uint32_t)n << 16);
+        zeros[3][n] = gf2_times(op, (uint32_t)n << 24);
+    }
+}
+
+/************************************************************************/
+/*  I : /                                                               */
+/*  P : Builds the CRC32C tables and picks the best kernel when the     */
+/*          library is loaded                                           */
+/*  O : /                                                               */
+/************************************************************************/
+__attribute__((constructor))
+static void init_crc32c()
+{
+    uint32_t crc = 0;
+    int n = 0, k = 0;
+
+    for(n = 0 ; n < 256 ; n++)
+    {
+        crc = n;
+        for(k = 0 ; k < 8 ; k++)
+            crc = (crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1);
+        crc_table[0][n] = crc;
+    }
+
+    for(n = 0 ; n < 256 ; n++)
+    {
+        for(k = 1 ; k < 8 ; k++)
+            crc_table[k][n] = (crc_table[k - 1][n] >> 8) ^ crc_table[0][crc_table[k - 1][n] & 0xFF];
+    }
+
+    crc_zeros(crc_long, CRC_LONG);
+    crc_zeros(crc_short, CRC_SHORT);
+    setcrckernel(CRC_AUTO);
+}
@@ -3,10 +3,13 @@
 ** Library regrouping dataset-based functions
 ** ------------------------------------------
 ** Made by Gilles Henrard
-** Last modified : 31/10/2020
+** Last modified : 17/10/2026
 */
 #include "dataset.h"
 
+static int catalog_compare(const void* a, const void* b, void* arena);
+static uint64_t catalog_fnv(const char* name);
+
 /****************************************************************************************/
 /*  I : dataset record to print                                                         */
 /*  P : Prints an dataset record                                                        */
@@ -39,6 +42,38 @@ int printdatasetnum(void* lign, void* index)
     return 0;
 }
 
+/************************************************************************/
+/*  I : file information to print                                       */
+/*      index number to print                                           */
+/*  P : Prints a file numbered, with its type, size and modification    */
+/*          time, and increments the index                              */
+/*  O : /                                                               */
+/************************************************************************/
+int printfileinfonum(void* lign, void* index)
+{
+    fileinfo_t* info = (fileinfo_t*)lign;
+    int* i = (int*)index;
+    char date[32] = {0};
+    time_t mtime = (time_t)info->meta.mtime;
+    struct tm tm = {0};
+    char type = '?';
+
+    switch(info->meta.type)
+    {
+        case DT_REG: type = '-'; break;
+        case DT_DIR: type = 'd'; break;
+        case DT_LNK: type = 'l'; break;
+        default: break;
+    }
+
+    if(localtime_r(&mtime, &tm))
+        strftime(date, sizeof(date), "%Y-%m-%d %H:%M", &tm);
+
+    printf("%2d- %c %12lu %s %s\n", *i, type, (unsigned long)info->meta.size, date, info->name);
+    *i += 1;
+    return 0;
+}
+
 /************************************************************/
 /*  I : record to summarise as a string                     */
 /*      /                                                   */
@@ -70,3 +105,211 @@ int compare_dataset(void* a, void* b){
 
     return strcmp(tmp_a, tmp_b);
 }
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////// CATALOG METHODS ////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+
+/****************************************************************************************/
+/*  I : catalog to which add a name                                                     */
+/*      name to add                                                                     */
+/*  P : Copies a name at the end of the arena, and appends its offset (the catalog      */
+/*          has to be sorted again before being searched)                               */
+/*  O : -1 on error                                                                     */
+/*       0 otherwise                                                                    */
+/****************************************************************************************/
+int catalog_add(catalog_t* cat, const char* name){
+    size_t len = strlen(name) + 1;
+    uint64_t cap = 0;
+    uint32_t nb = 0;
+    void* tmp = NULL;
+
+    if(cat->arenasz + len > CATALOG_MAX || cat->nbnames == UINT32_MAX)
+        return -1;
+
+    //grow the arena and the offsets by doubling them
+    if(cat->arenasz + len > cat->arenacap){
+        for(cap = (cat->arenacap ? cat->arenacap : 4096) ; cap < cat->arenasz + len ; cap *= 2);
+        if((tmp = realloc(cat->arena, cap)) == NULL)
+            return -1;
+        cat->arena = tmp;
+        cat->arenacap = cap;
+    }
+
+    if(cat->nbnames == cat->capacity){
+        nb = (cat->capacity ? (cat->capacity > UINT32_MAX / 2 ? UINT32_MAX : cat->capacity * 2) : 64);
+        if((tmp = realloc(cat->offsets, (size_t)nb * sizeof(uint32_t))) == NULL)
+            return -1;
+        cat->offsets = tmp;
+        cat->capacity = nb;
+    }
+
+    memcpy(cat->arena + cat->arenasz, name, len);
+    cat->offsets[cat->nbnames] = (uint32_t)cat->arenasz;
+    cat->arenasz += len;
+    cat->nbnames++;
+
+    return 0;
+}
+
+/****************************************************************************************/
+/*  I : catalog to sort                                                                 */
+/*  P : Sorts the offsets by name (the names stay where they are in the arena), drops   */
+/*          the duplicates and trims the memory allocated in excess (the hash index,    */
+/*          if any, is dropped as the indexes change)                                   */
+/*  O : 0                                                                               */
+/****************************************************************************************/
+int catalog_sort(catalog_t* cat){
+    uint32_t i = 0, kept = 0;
+    void* tmp = NULL;
+
+    free(cat->slots);
+    cat->slots = NULL;
+    cat->mask = 0;
+
+    if(!cat->nbnames)
+        return 0;
+
+    qsort_r(cat->offsets, cat->nbnames, sizeof(uint32_t), catalog_compare, cat->arena);
+
+    //keep the first occurrence of each name
+    for(i = 1, kept = 1 ; i < cat->nbnames ; i++){
+        if(strcmp(cat->arena + cat->offsets[i], cat->arena + cat->offsets[kept - 1]))
+            cat->offsets[kept++] = cat->offsets[i];
+    }
+    cat->nbnames = kept;
+
+    //a failed shrink leaves the memory as it was
+    if((tmp = realloc(cat->arena, cat->arenasz)) != NULL){
+        cat->arena = tmp;
+        cat->arenacap = cat->arenasz;
+    }
+    if((tmp = realloc(cat->offsets, (size_t)cat->nbnames * sizeof(uint32_t))) != NULL){
+        cat->offsets = tmp;
+        cat->capacity = cat->nbnames;
+    }
+
+    return 0;
+}
+
+/****************************************************************************************/
+/*  I : catalog sorted, in which look for the name                                      */
+/*      name to look for                                                                */
+/*  P : Finds a name by binary search, in O(log n)                                      */
+/*  O : index of the name                                                               */
+/*      -1 if not in the catalog                                                        */
+/****************************************************************************************/
+int64_t catalog_find(catalog_t* cat, const char* name){
+    uint32_t low = 0, high = cat->nbnames, mid = 0;
+    int cmp = 0;
+
+    while(low < high){
+        mid = low + (high - low) / 2;
+        cmp = strcmp(name, cat->arena + cat->offsets[mid]);
+
+        if(!cmp)
+            return mid;
+        else if(cmp < 0)
+            high = mid;
+        else
+            low = mid + 1;
+    }
+
+    return -1;
+}
+
+/****************************************************************************************/
+/*  I : catalog sorted, of which index the names                                        */
+/*  P : Builds a hash index of the names (open addressing, linear probing, at most      */
+/*          half full), so that a name is found in O(1)                                 */
+/*  O : -1 on error                                                                     */
+/*       0 otherwise                                                                    */
+/****************************************************************************************/
+int catalog_hash(catalog_t* cat){
+    uint64_t size = 2;
+    uint32_t i = 0, slot = 0;
+
+    for( ; size < (uint64_t)cat->nbnames * 2 ; size *= 2);
+    if(size > UINT32_MAX)
+        return -1;
+
+    free(cat->slots);
+    if((cat->slots = calloc(size, sizeof(uint32_t))) == NULL){
+        cat->mask = 0;
+        return -1;
+    }
+    cat->mask = (uint32_t)(size - 1);
+
+    for(i = 0 ; i < cat->nbnames ; i++){
+        for(slot = catalog_fnv(catalog_name(cat, i)) & cat->mask ; cat->slots[slot] ; slot = (slot + 1) & cat->mask);
+        cat->slots[slot] = i + 1;
+    }
+
+    return 0;
+}
+
+/****************************************************************************************/
+/*  I : catalog hashed, in which look for the name                                      */
+/*      name to look for                                                                */
+/*  P : Finds a name through the hash index, in O(1) (by binary search if the catalog   */
+/*          has not been hashed)                                                        */
+/*  O : index of the name                                                               */
+/*      -1 if not in the catalog                                                        */
+/****************************************************************************************/
+int64_t catalog_lookup(catalog_t* cat, const char* name){
+    uint32_t slot = 0;
+
+    if(!cat->slots)
+        return catalog_find(cat, name);
+
+    for(slot = catalog_fnv(name) & cat->mask ; cat->slots[slot] ; slot = (slot + 1) & cat->mask){
+        if(!strcmp(name, cat->arena + cat->offsets[cat->slots[slot] - 1]))
+            return cat->slots[slot] - 1;
+    }
+
+    return -1;
+}
+
+/****************************************************************************************/
+/*  I : catalog to release                                                              */
+/*  P : Frees the arena, the offsets and the hash index of a catalog                    */
+/*  O : /                                                                               */
+/****************************************************************************************/
+void catalog_free(catalog_t* cat){
+    free(cat->arena);
+    free(cat->offsets);
+    free(cat->slots);
+    memset(cat, 0, sizeof(catalog_t));
+}
+
+/****************************************************************************************/
+/*  I : offset of the first name to compare                                             */
+/*      offset of the second name to compare                                            */
+/*      arena holding the names                                                         */
+/*  P : Compares two names of a catalog (for qsort_r())                                 */
+/*  O : result of strcmp()                                                              */
+/****************************************************************************************/
+static int catalog_compare(const void* a, const void* b, void* arena){
+    const char* names = (const char*)arena;
+
+    return strcmp(names + *(const uint32_t*)a, names + *(const uint32_t*)b);
+}
+
+/****************************************************************************************/
+/*  I : name to hash                                                                    */
+/*  P : Hashes a name with FNV-1a (64 bits), its upper half folded in the lower one     */
+/*          (the slots are picked by the lower bits)                                    */
+/*  O : hash of the name                                                                */
+/****************************************************************************************/
+static uint64_t catalog_fnv(const char* name){
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for( ; *name ; name++){
+        hash ^= (unsigned char)*name;
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash ^ (hash >> 32);
+}
@@ -0,0 +1,532 @@
+/*
+** dirindex.c
+** Library regrouping the directory index functions
+** ------------------------------------------
+** Made by Gilles Henrard
+** Last modified : 17/10/2026
+*/
+#include "dirindex.h"
+
+typedef struct{
+    filemeta_t meta;                // metadata of the file
+    int stale;                      // metadata to be read again
+    char name[];                    // name of the file
+}dx_node_t;
+
+typedef struct{
+    catalog_t* names;               // catalog being filled
+    dx_node_t** nodes;              // nodes of the names, in the order of the catalog
+    uint32_t nbnodes;               // amount of nodes collected
+    int failed;                     // a name could not be added
+}dx_builder_t;
+
+typedef struct{
+    int dirfd;                      // directory containing the files
+    dx_node_t** stale;              // nodes of which read the metadata
+    uint32_t nbstale;               // amount of nodes of which read the metadata
+    uint32_t next;                  // first node not claimed yet (atomic)
+}dx_stats_t;
+
+static int dx_compare(const void* a, const void* b);
+static int dx_scan(dirindex_t* idx);
+static int dx_rescan(dirindex_t* idx);
+static int dx_add(dirindex_t* idx, const char* name);
+static int dx_remove(dirindex_t* idx, const char* name);
+static void dx_collect(const void* node, VISIT which, void* closure);
+static int dx_stat(dirindex_t* idx, dx_node_t** nodes, uint32_t nbnodes);
+static void* dx_statworker(void* arg);
+static int dx_publish(dirindex_t* idx);
+static void* dx_watcher(void* arg);
+
+/************************************************************************/
+/*  I : index to initialise                                             */
+/*      directory to index                                              */
+/*  P : Reads the names of the files in the directory, and publishes    */
+/*          the first snapshot                                          */
+/*  O : -1 on error                                                     */
+/*       0 otherwise                                                    */
+/************************************************************************/
+int dirindex_open(dirindex_t* idx, char* dirname)
+{
+    memset(idx, 0, sizeof(dirindex_t));
+    idx->dirname = dirname;
+    idx->fd = -1;
+
+    if(dx_scan(idx) == -1 || dx_publish(idx) == -1)
+    {
+        tdestroy(idx->tree, free);
+        idx->tree = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/************************************************************************/
+/*  I : index to keep up to date                                        */
+/*  P : Watches the directory with inotify, a thread applying each      */
+/*          change to the index and publishing a new snapshot           */
+/*  O : -1 on error (the index stays as it is)                          */
+/*       0 otherwise                                                    */
+/************************************************************************/
+int dirindex_watch(dirindex_t* idx)
+{
+    if((idx->fd = inotify_init1(IN_CLOEXEC)) == -1)
+    {
+        print_error("dirindex: inotify_init1: %s", strerror(errno));
+        return -1;
+    }
+
+    //watch before rescanning, so that no change is missed in between
+    if(inotify_add_watch(idx->fd, idx->dirname, DX_EVENTS) == -1
+       || dx_rescan(idx) == -1 || dx_publish(idx) == -1)
+    {
+        print_error("dirindex: unable to watch %s: %s", idx->dirname, strerror(errno));
+        close(idx->fd);
+        idx->fd = -1;
+        return -1;
+    }
+
+    if(pthread_create(&idx->watcher, NULL, dx_watcher, idx) != 0)
+    {
+        print_error("dirindex: pthread_create: unable to start the watcher");
+        close(idx->fd);
+        idx->fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+/************************************************************************/
+/*  I : index to close                                                  */
+/*  P : Stops the watcher, then releases the index and its snapshot     */
+/*          (snapshots still referenced are freed by their last reader) */
+/*  O : /                                                               */
+/************************************************************************/
+void dirindex_close(dirindex_t* idx)
+{
+    if(idx->fd != -1)
+    {
+        pthread_cancel(idx->watcher);
+        pthread_join(idx->watcher, NULL);
+        close(idx->fd);
+        idx->fd = -1;
+    }
+
+    if(idx->current)
+        dirindex_release(idx->current);
+
+    tdestroy(idx->tree, free);
+    idx->tree = NULL;
+    idx->current = NULL;
+    idx->nbnames = 0;
+}
+
+/************************************************************************/
+/*  I : index of which read the snapshot                                */
+/*  P : Takes a reference on the current snapshot, without any lock:    */
+/*          the readers counter tells the publisher a pointer loaded    */
+/*          may not be referenced yet                                   */
+/*  O : snapshot (to be released with dirindex_release())               */
+/************************************************************************/
+snapshot_t* dirindex_acquire(dirindex_t* idx)
+{
+    snapshot_t* snap = NULL;
+
+    __atomic_add_fetch(&idx->readers, 1, __ATOMIC_SEQ_CST);
+    snap = __atomic_load_n(&idx->current, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&snap->refs, 1, __ATOMIC_SEQ_CST);
+    __atomic_sub_fetch(&idx->readers, 1, __ATOMIC_SEQ_CST);
+
+    return snap;
+}
+
+/************************************************************************/
+/*  I : snapshot not needed anymore                                     */
+/*  P : Drops a reference on a snapshot, and frees it with the last one */
+/*  O : /                                                               */
+/************************************************************************/
+void dirindex_release(snapshot_t* snap)
+{
+    if(__atomic_sub_fetch(&snap->refs, 1, __ATOMIC_SEQ_CST) == 0)
+    {
+        pfreecache(&snap->cache);
+        catalog_free(&snap->names);
+        free(snap);
+    }
+}
+
+/************************************************************************/
+/*  I : directory to read                                               */
+/*  P : Reads a directory in a snapshot of its own, no index being kept */
+/*          (for a process which does not get the updates of the index, */
+/*          such as a forked child)                                     */
+/*  O : snapshot (to be released with dirindex_release())               */
+/*      NULL on error                                                   */
+/************************************************************************/
+snapshot_t* dirindex_snapshot(char* dirname)
+{
+    dirindex_t idx = {0};
+    snapshot_t* snap = NULL;
+
+    if(dirindex_open(&idx, dirname) == -1)
+        return NULL;
+
+    //the snapshot outlives the index it was published by
+    snap = dirindex_acquire(&idx);
+    dirindex_close(&idx);
+    return snap;
+}
+
+/************************************************************************/
+/*  I : first name to compare                                           */
+/*      second name to compare                                          */
+/*  P : Compares two names the way the list does (for the tree)         */
+/*  O : result of compare_dataset()                                     */
+/************************************************************************/
+static int dx_compare(const void* a, const void* b)
+{
+    return compare_dataset(((dx_node_t*)a)->name, ((dx_node_t*)b)->name);
+}
+
+/************************************************************************/
+/*  I : index to fill                                                   */
+/*  P : Adds the names of all the files in the directory to the index   */
+/*          (names already indexed are kept once)                       */
+/*  O : -1 on error                                                     */
+/*       0 otherwise                                                    */
+/************************************************************************/
+static int dx_scan(dirindex_t* idx)
+{
+    DIR *d = NULL;
+    struct dirent *dir = NULL;
+
+    if((d = opendir(idx->dirname)) == NULL)
+    {
+        print_error("dirindex: opendir %s: %s", idx->dirname, strerror(errno));
+        return -1;
+    }
+
+    while ((dir = readdir(d)) != NULL)
+    {
+        if(dx_add(idx, dir->d_name) == -1)
+        {
+            closedir(d);
+            return -1;
+        }
+    }
+
+    closedir(d);
+    return 0;
+}
+
+/************************************************************************/
+/*  I : index to rebuild                                                */
+/*  P : Empties the index, then reads the whole directory again         */
+/*  O : -1 on error                                                     */
+/*       0 otherwise                                                    */
+/************************************************************************/
+static int dx_rescan(dirindex_t* idx)
+{
+    tdestroy(idx->tree, free);
+    idx->tree = NULL;
+    idx->nbnames = 0;
+
+    return dx_scan(idx);
+}
+
+/************************************************************************/
+/*  I : index to update                                                 */
+/*      name to add                                                     */
+/*  P : Adds a name to the tree, in O(log n) (each node only takes the  */
+/*          length of its name and its metadata), or marks the         */
+/*          metadata of a name already indexed to be read again         */
+/*  O : -1 on error                                                     */
+/*       0 otherwise                                                    */
+/************************************************************************/
+static int dx_add(dirindex_t* idx, const char* name)
+{
+    dx_node_t *node = NULL, **found = NULL;
+    size_t len = strnlen(name, FILENAMESZ - 1);
+
+    if((node = calloc(1, sizeof(dx_node_t) + len + 1)) == NULL)
+        return -1;
+    memcpy(node->name, name, len);
+    node->stale = 1;
+
+    if((found = tsearch(node, &idx->tree, dx_compare)) == NULL)
+    {
+        free(node);
+        return -1;
+    }
+
+    //already indexed (the file has changed)
+    if(*found != node)
+    {
+        free(node);
+        (*found)->stale = 1;
+    }
+    else
+        idx->nbnames++;
+
+    return 0;
+}
+
+/************************************************************************/
+/*  I : index to update                                                 */
+/*      name to remove                                                  */
+/*  P : Removes a name from the tree, in O(log n)                       */
+/*  O : 0 (a name not indexed is ignored)                               */
+/************************************************************************/
+static int dx_remove(dirindex_t* idx, const char* name)
+{
+    char buffer[sizeof(dx_node_t) + FILENAMESZ] __attribute__((aligned(__alignof__(dx_node_t)))) = {0};
+    dx_node_t *key = (dx_node_t*)buffer, **found = NULL, *node = NULL;
+
+    memcpy(key->name, name, strnlen(name, FILENAMESZ - 1));
+    if((found = tfind(key, &idx->tree, dx_compare)) == NULL)
+        return 0;
+
+    node = *found;
+    tdelete(key, &idx->tree, dx_compare);
+    free(node);
+    idx->nbnames--;
+
+    return 0;
+}
+
+/************************************************************************/
+/*  I : node of the tree visited                                        */
+/*      moment of the visit                                             */
+/*      builder of the catalog of names                                 */
+/*  P : Copies the names in the catalog and keeps their nodes, in order */
+/*          (for twalk_r())                                             */
+/*  O : /                                                               */
+/************************************************************************/
+static void dx_collect(const void* node, VISIT which, void* closure)
+{
+    dx_builder_t* builder = (dx_builder_t*)closure;
+    dx_node_t* file = *(dx_node_t* const*)node;
+
+    if(which != postorder && which != leaf)
+        return;
+
+    if(catalog_add(builder->names, file->name) == -1)
+        builder->failed = 1;
+    else
+        builder->nodes[builder->nbnodes++] = file;
+}
+
+/************************************************************************/
+/*  I : index of which read the metadata                                */
+/*      nodes of all the names of the index                             */
+/*      amount of nodes                                                 */
+/*  P : Reads the metadata of the files which changed since the last    */
+/*          snapshot : in place if they are few, spread over a pool of  */
+/*          threads otherwise (a whole directory being scanned)         */
+/*  O : -1 on error                                                     */
+/*       0 otherwise                                                    */
+/************************************************************************/
+static int dx_stat(dirindex_t* idx, dx_node_t** nodes, uint32_t nbnodes)
+{
+    pthread_t threads[DX_STATTHREADS];
+    dx_stats_t stats = {0};
+    long nbthreads = 0, started = 0, i = 0;
+    uint32_t n = 0;
+
+    if((stats.stale = calloc((nbnodes ? nbnodes : 1), sizeof(dx_node_t*))) == NULL)
+        return -1;
+
+    for(n = 0 ; n < nbnodes ; n++)
+    {
+        if(nodes[n]->stale)
+            stats.stale[stats.nbstale++] = nodes[n];
+    }
+
+    if(stats.nbstale == 0)
+    {
+        free(stats.stale);
+        return 0;
+    }
+
+    if((stats.dirfd = open(idx->dirname, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+    {
+        print_error("dirindex: open %s: %s", idx->dirname, strerror(errno));
+        free(stats.stale);
+        return -1;
+    }
+
+    //the publisher reads its share too (a failed thread only leaves it more)
+    if(stats.nbstale >= DX_STATPAR)
+    {
+        nbthreads = sysconf(_SC_NPROCESSORS_ONLN);
+        nbthreads = (nbthreads < 1 ? 1 : (nbthreads > DX_STATTHREADS ? DX_STATTHREADS : nbthreads));
+    }
+    for(i = 1 ; i < nbthreads ; i++)
+    {
+        if(pthread_create(&threads[started], NULL, dx_statworker, &stats) == 0)
+            started++;
+    }
+
+    dx_statworker(&stats);
+    for(i = 0 ; i < started ; i++)
+        pthread_join(threads[i], NULL);
+
+    close(stats.dirfd);
+    free(stats.stale);
+    return 0;
+}
+
+/************************************************************************/
+/*  I : metadata to read (dx_stats_t)                                   */
+/*  P : Claims the nodes by chunks and reads the metadata of their      */
+/*          files (a file already removed gets none, its removal is     */
+/*          on its way)                                                 */
+/*  O : NULL                                                            */
+/************************************************************************/
+static void* dx_statworker(void* arg)
+{
+    dx_stats_t* stats = (dx_stats_t*)arg;
+    struct stat st = {0};
+    uint32_t first = 0, last = 0, i = 0;
+    dx_node_t* node = NULL;
+
+    while((first = __atomic_fetch_add(&stats->next, DX_STATCHUNK, __ATOMIC_RELAXED)) < stats->nbstale)
+    {
+        last = (stats->nbstale - first < DX_STATCHUNK ? stats->nbstale : first + DX_STATCHUNK);
+        for(i = first ; i < last ; i++)
+        {
+            node = stats->stale[i];
+            memset(&node->meta, 0, sizeof(filemeta_t));
+            if(fstatat(stats->dirfd, node->name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+            {
+                node->meta.size = st.st_size;
+                node->meta.mtime = st.st_mtime;
+                node->meta.type = IFTODT(st.st_mode);
+            }
+            node->stale = 0;
+        }
+    }
+
+    return NULL;
+}
+
+/************************************************************************/
+/*  I : index of which publish a snapshot                               */
+/*  P : Copies the names of the tree in the catalog of a new snapshot,  */
+/*          reads the metadata which changed, hashes and serialises     */
+/*          them, swaps the snapshot with the current one, waits until  */
+/*          no reader can still be taking a reference on the former     */
+/*          one, then drops it                                          */
+/*  O : -1 on error                                                     */
+/*       0 otherwise                                                    */
+/************************************************************************/
+static int dx_publish(dirindex_t* idx)
+{
+    dx_builder_t builder = {0};
+    snapshot_t *snap = NULL, *former = NULL;
+    filemeta_t* metas = NULL;
+    char* padded = NULL;
+    uint32_t i = 0;
+
+    if((snap = calloc(1, sizeof(snapshot_t))) == NULL
+       || (builder.nodes = calloc((idx->nbnames ? idx->nbnames : 1), sizeof(dx_node_t*))) == NULL)
+    {
+        free(snap);
+        return -1;
+    }
+
+    builder.names = &snap->names;
+    twalk_r(idx->tree, dx_collect, &builder);
+    if(builder.failed || dx_stat(idx, builder.nodes, builder.nbnodes) == -1
+       || (padded = calloc((snap->names.nbnames ? snap->names.nbnames : 1), FILENAMESZ)) == NULL
+       || (metas = calloc((snap->names.nbnames ? snap->names.nbnames : 1), sizeof(filemeta_t))) == NULL)
+    {
+        print_error("dirindex: unable to catalog the names of %s", idx->dirname);
+        catalog_free(&snap->names);
+        free(builder.nodes);
+        free(padded);
+        free(snap);
+        return -1;
+    }
+
+    //the tree is walked in order : sorting only trims the catalog (its indexes are the ones of the nodes)
+    catalog_sort(&snap->names);
+
+    //the padded list and the metadata are only kept serialised
+    for(i = 0 ; i < snap->names.nbnames ; i++)
+    {
+        strcpy(padded + (size_t)i * FILENAMESZ, catalog_name(&snap->names, i));
+        metas[i] = builder.nodes[i]->meta;
+    }
+    free(builder.nodes);
+
+    //names requested by the clients are found through the hash index
+    if(catalog_hash(&snap->names) == -1
+       || pmkcachearray(padded, snap->names.nbnames, FILENAMESZ, metas, &snap->cache) == -1)
+    {
+        print_error("dirindex: unable to serialise the snapshot of %s", idx->dirname);
+        catalog_free(&snap->names);
+        free(padded);
+        free(metas);
+        free(snap);
+        return -1;
+    }
+    free(padded);
+    free(metas);
+
+    //the index holds one reference on the snapshot it publishes
+    snap->refs = 1;
+    former = __atomic_exchange_n(&idx->current, snap, __ATOMIC_SEQ_CST);
+
+    //grace period : let the readers which loaded the former pointer reference it
+    while(__atomic_load_n(&idx->readers, __ATOMIC_SEQ_CST) != 0)
+        sched_yield();
+
+    if(former)
+        dirindex_release(former);
+
+    return 0;
+}
+
+/************************************************************************/
+/*  I : index to keep up to date                                        */
+/*  P : Applies the changes reported by inotify to the index, and       */
+/*          publishes a snapshot after each batch of events             */
+/*  O : /                                                               */
+/************************************************************************/
+static void* dx_watcher(void* arg)
+{
+    dirindex_t* idx = (dirindex_t*)arg;
+    char buffer[DX_BUFSZ] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct inotify_event* event = NULL;
+    ssize_t len = 0;
+    char* cur = NULL;
+
+    while((len = read(idx->fd, buffer, sizeof(buffer))) > 0 || (len == -1 && errno == EINTR))
+    {
+        for(cur = buffer ; len > 0 && cur < buffer + len ; cur += sizeof(struct inotify_event) + event->len)
+        {
+            event = (struct inotify_event*)cur;
+
+            //events lost : rebuild the index from scratch
+            if(event->mask & IN_Q_OVERFLOW)
+                dx_rescan(idx);
+            else if(event->mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+                print_error("dirindex: %s has been moved or deleted", idx->dirname);
+            else if(event->len == 0)
+                continue;   //the directory itself has changed (attributes)
+            else if(event->mask & (IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE | IN_ATTRIB))
+                dx_add(idx, event->name);
+            else if(event->mask & (IN_DELETE | IN_MOVED_FROM))
+                dx_remove(idx, event->name);
+        }
+
+        if(len > 0)
+            dx_publish(idx);
+    }
+
+    print_error("dirindex: stopped watching %s", idx->dirname);
+    return NULL;
+}
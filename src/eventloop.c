@@ -0,0 +1,1074 @@
+/*
+** eventloop.c
+** Library regrouping the event-driven server functions
+** ------------------------------------------
+** Made by Gilles Henrard
+** Last modified : 17/10/2026
+*/
+#include "eventloop.h"
+
+static int ev_accept(evloop_t* ev);
+static int ev_drive(evloop_t* ev, conn_t* c);
+static void ev_phase1(evloop_t* ev, conn_t* c);
+static int ev_phase2(conn_t* c, catalog_t* names, int choice);
+static int ev_phase3(evloop_t* ev, conn_t* c);
+static int ev_range(evloop_t* ev, conn_t* c);
+static int ev_name(evloop_t* ev, conn_t* c);
+static int ev_flush(conn_t* c);
+static int ev_fill(evloop_t* ev, conn_t* c);
+static int ev_watch(evloop_t* ev, conn_t* c);
+static int ev_next(evloop_t* ev, conn_t* c);
+static void ev_expect(evloop_t* ev, conn_t* c, int state, unsigned int size);
+static void ev_wait(evloop_t* ev, conn_t* c, long delay);
+static void ev_unwait(evloop_t* ev, conn_t* c);
+static void ev_timeout(evloop_t* ev);
+static long ev_now();
+static void ev_close(evloop_t* ev, conn_t* c);
+
+/************************************************************************/
+/*  I : listening socket on which accept the clients                    */
+/*      index of the directory set in program argument                  */
+/*      directory containing the files                                  */
+/*  P : Serves all the clients from a single process: each connection   */
+/*          goes through the phases of the server as a state machine    */
+/*          over a non-blocking socket, driven by epoll                 */
+/*  O : -1 on error                                                     */
+/*       0 otherwise (never returns in normal operation)                */
+/************************************************************************/
+int run_eventloop(int listener, dirindex_t* index, char* dirname)
+{
+    struct epoll_event events[EV_MAXEVENTS], evt = {0};
+    struct rlimit lim = {0};
+    evloop_t ev = {0};
+    conn_t* c = NULL;
+    int nbevents = 0, i = 0, timeout = 0;
+
+    //one descriptor per client, allow as much as the system does
+    if(getrlimit(RLIMIT_NOFILE, &lim) == 0)
+    {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+
+    ev.listener = listener;
+    ev.index = index;
+    ev.dirname = dirname;
+
+    //create the epoll instance and watch the listening socket
+    if((ev.epfd = epoll_create1(0)) == -1)
+    {
+        print_error("eventloop: epoll_create1: %s", strerror(errno));
+        return -1;
+    }
+
+    fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) | O_NONBLOCK);
+    evt.events = EPOLLIN;
+    evt.data.ptr = NULL;
+    if(epoll_ctl(ev.epfd, EPOLL_CTL_ADD, listener, &evt) == -1)
+    {
+        print_error("eventloop: epoll_ctl: %s", strerror(errno));
+        close(ev.epfd);
+        return -1;
+    }
+
+    while(1)
+    {
+        //wake up in time for the oldest connection waiting for a hello (or a request)
+        timeout = -1;
+        if(ev.waiting)
+            timeout = (ev.waiting->deadline > ev_now() ? ev.waiting->deadline - ev_now() : 0);
+        if(ev.idle && (timeout == -1 || ev.idle->deadline - ev_now() < timeout))
+            timeout = (ev.idle->deadline > ev_now() ? ev.idle->deadline - ev_now() : 0);
+        if(ev.late && (timeout == -1 || ev.late->deadline - ev_now() < timeout))
+            timeout = (ev.late->deadline > ev_now() ? ev.late->deadline - ev_now() : 0);
+
+        if((nbevents = epoll_wait(ev.epfd, events, EV_MAXEVENTS, timeout)) == -1)
+        {
+            if(errno == EINTR)
+                continue;
+
+            print_error("eventloop: epoll_wait: %s", strerror(errno));
+            break;
+        }
+
+        if(METRICS)
+            ev.woke = metrics_now();
+
+        for(i = 0 ; i < nbevents ; i++)
+        {
+            //new clients are waiting on the listening socket
+            if(events[i].data.ptr == NULL)
+            {
+                ev_accept(&ev);
+                continue;
+            }
+
+            //make the connection progress as far as possible
+            c = (conn_t*)events[i].data.ptr;
+            if(ev_drive(&ev, c) == -1)
+            {
+                print_error("server: %s -> unable to process the request", c->ip);
+                ev_close(&ev, c);
+            }
+            else if(c->state == PH_DONE)
+            {
+                print_success("server: %s -> request processed", c->ip);
+                ev_close(&ev, c);
+            }
+            else if(ev_watch(&ev, c) == -1)
+                ev_close(&ev, c);
+        }
+
+        //legacy clients did not send any hello, serve them anyway (and close the idle sessions)
+        ev_timeout(&ev);
+    }
+
+    close(ev.epfd);
+    return -1;
+}
+
+/************************************************************************/
+/*  I : event loop                                                      */
+/*  P : Accepts all the pending clients and waits for their hello       */
+/*  O : -1 on error                                                     */
+/*       0 otherwise                                                    */
+/************************************************************************/
+static int ev_accept(evloop_t* ev)
+{
+    char s[INET6_ADDRSTRLEN] = "0";
+    conn_t* c = NULL;
+    int rem_socket = 0;
+
+    while((rem_socket = acceptServ(ev->listener, s, sizeof(s))) != -1)
+    {
+        print_neutral("server: %s -> connection received", s);
+
+        if((c = calloc(1, sizeof(conn_t))) == NULL)
+        {
+            print_error("server: %s -> calloc: %s", s, strerror(errno));
+            close(rem_socket);
+            continue;
+        }
+        fcntl(rem_socket, F_SETFL, fcntl(rem_socket, F_GETFL) | O_NONBLOCK);
+        c->sockfd = rem_socket;
+        c->fd = -1;
+        strcpy(c->ip, s);
+
+        //clients accepted by the same wake-up wait for the ones before them
+        if(METRICS)
+        {
+            c->start = c->mark = metrics_now();
+            metrics_record(MH_ACCEPT, c->mark - ev->woke);
+            metrics_count(MC_ACCEPTED, 1);
+            metrics_count(MC_ACTIVE, 1);
+        }
+
+        //phase 0 : wait (for a while) for the hello of the client
+        ev_expect(ev, c, PH0_HELLO, sizeof(head_t));
+        ev_wait(ev, c, PHELLO_WAIT);
+
+        if(ev_drive(ev, c) == -1 || ev_watch(ev, c) == -1)
+        {
+            print_error("server: %s -> unable to process the request", c->ip);
+            ev_close(ev, c);
+        }
+    }
+
+    if(errno != EAGAIN && errno != EWOULDBLOCK)
+    {
+        print_error("server: acceptServ: %s", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/************************************************************************/
+/*  I : event loop                                                      */
+/*      connection to make progress                                     */
+/*  P : Runs the state machine of a connection until it would block     */
+/*  O : -1 on error                                                     */
+/*       0 if waiting for the socket                                    */
+/*       1 if the request has been processed                            */
+/************************************************************************/
+static int ev_drive(evloop_t* ev, conn_t* c)
+{
+    head_t header = {0};
+    int ret = 1, choice = 0;
+
+    while(ret > 0 && c->state != PH_DONE)
+    {
+        switch(c->state)
+        {
+            case PH0_HELLO:
+                if((ret = ev_fill(ev, c)) > 0)
+                {
+                    if(phello(c->in, &c->hello, print_error) == -1)
+                        return -1;
+
+                    //the files are only sent over the connections (a transfer in datagrams would block the loop)
+                    c->hello.stype &= ~PF_UDP;
+
+                    //the first request of a session always gets the list, nothing else ends it
+                    if(PTYPE(c->hello.stype) == SCLOSE)
+                    {
+                        print_error("server: %s -> session closed before any request", c->ip);
+                        return -1;
+                    }
+                    c->hello.stype &= ~PF_NOLIST;
+
+                    print_neutral("server: %s -> capabilities negociated: %#x", c->ip, PFLAGS(c->hello.stype));
+
+                    //kept session : each request follows the acknowledgement of the last one
+                    if((c->hello.stype & PF_KEEP) && setnodelay(c->sockfd) == -1)
+                        print_error("server: %s -> setsockopt: %s", c->ip, strerror(errno));
+
+                    //range request (or request by name) : the range (or the name) follows, no list is sent
+                    if(PTYPE(c->hello.stype) == SRANGE)
+                        ev_expect(ev, c, PH0_RANGE, RANGE_SZ);
+                    else if(PTYPE(c->hello.stype) == SNAME)
+                        ev_expect(ev, c, PH0_NAME, c->hello.nbelem);
+                    else
+                        ev_phase1(ev, c);
+                }
+                break;
+
+            case PH0_RANGE:
+                if((ret = ev_fill(ev, c)) > 0)
+                    ret = ev_range(ev, c);
+                break;
+
+            case PH0_NAME:
+                if((ret = ev_fill(ev, c)) > 0)
+                    ret = ev_name(ev, c);
+                break;
+
+            case PH1_SEND:
+                if((ret = ev_flush(c)) > 0)
+                {
+                    if(METRICS)
+                        c->tsend = metrics_now();
+
+                    //list streamed, go on with the choice sent in the hello
+                    if(c->hello.stype & PF_STREAM)
+                        ret = ev_phase2(c, &c->snap->names, c->hello.nbelem);
+                    else
+                        ev_expect(ev, c, PH1_ACK, sizeof(head_t));
+                }
+                break;
+
+            case PH1_ACK:
+                if((ret = ev_fill(ev, c)) > 0)
+                {
+                    if(METRICS)
+                        metrics_since(MH_ACK, &c->tsend);
+
+                    if(pchkack(c->in, &header, c->expected, c->sum) == -1)
+                    {
+                        //hello arrived after PHELLO_WAIT : served as a legacy client, skip it
+                        if(PTYPE(header.stype) == SHELLO)
+                        {
+                            ev_expect(ev, c, PH1_ACK, sizeof(head_t));
+                            break;
+                        }
+
+                        print_error("server: %s -> acknowlegement header does not match the list sent", c->ip);
+                        return -1;
+                    }
+
+                    ev_expect(ev, c, PH2_CHOICE, sizeof(int));
+                }
+                break;
+
+            case PH2_CHOICE:
+                if((ret = ev_fill(ev, c)) > 0)
+                {
+                    memcpy(&choice, c->in, sizeof(int));
+                    ret = ev_phase2(c, &c->snap->names, choice);
+                }
+                break;
+
+            case PH2_SEND:
+                if((ret = ev_flush(c)) > 0)
+                {
+                    if(METRICS)
+                        c->tsend = metrics_now();
+
+                    //file name streamed, go on with the file
+                    if(c->hello.stype & PF_STREAM)
+                        ret = ev_phase3(ev, c);
+                    else
+                        ev_expect(ev, c, PH2_ACK, sizeof(head_t));
+                }
+                break;
+
+            case PH2_ACK:
+                if((ret = ev_fill(ev, c)) > 0)
+                {
+                    if(METRICS)
+                        metrics_since(MH_ACK, &c->tsend);
+
+                    if(pchkack(c->in, &header, c->expected, c->sum) == -1)
+                    {
+                        print_error("server: %s -> acknowlegement header does not match the filename sent", c->ip);
+                        return -1;
+                    }
+
+                    ret = ev_phase3(ev, c);
+                }
+                break;
+
+            case PH3_RESUME:
+                if((ret = ev_fill(ev, c)) > 0)
+                    ret = ev_phase3(ev, c);
+                break;
+
+            case PH3_SEND:
+                if((ret = ev_flush(c)) > 0)
+                {
+                    //file sent : account its bytes and its throughput
+                    if(METRICS)
+                    {
+                        if(c->tbytes)
+                        {
+                            metrics_count(MC_SENT, c->tbytes);
+                            metrics_rate(c->tbytes, c->tsend);
+                        }
+                        c->tsend = metrics_now();
+                    }
+
+                    ev_expect(ev, c, PH3_ACK, sizeof(head_t));
+                }
+                break;
+
+            case PH3_ACK:
+                if((ret = ev_fill(ev, c)) > 0)
+                {
+                    if(METRICS)
+                        metrics_since(MH_ACK, &c->tsend);
+
+                    //streamed session : all the messages are acknowledged at once (no list in a
+                    //  request of a kept session asking for none)
+                    if(pchkack(c->in, &header, c->expected, c->sum) == -1
+                       || ((c->hello.stype & PF_STREAM) && (PTYPE(header.stype) != SACK
+                           || header.nbelem != (c->hello.stype & PF_NOLIST ? 2U : 3U))))
+                    {
+                        print_error("server: %s -> acknowlegement header does not match the file sent", c->ip);
+                        return -1;
+                    }
+
+                    if(METRICS)
+                        metrics_since(MH_FILE, &c->mark);
+
+                    //kept session : wait for the next request
+                    if(c->hello.stype & PF_KEEP)
+                    {
+                        print_success("server: %s -> request processed", c->ip);
+                        ev_expect(ev, c, PH4_NEXT, sizeof(head_t));
+                        ev_wait(ev, c, PKEEP_IDLE);
+                    }
+                    else
+                        c->state = PH_DONE;
+                }
+                break;
+
+            case PH4_NEXT:
+                if((ret = ev_fill(ev, c)) > 0)
+                    ret = ev_next(ev, c);
+                break;
+
+            default:
+                return -1;
+        }
+    }
+
+    return ret;
+}
+
+/************************************************************************/
+/*  I : event loop                                                      */
+/*      connection of which prepare the phase 1                         */
+/*  P : Prepares the phase 1: sending the files list to the client      */
+/*  O : /                                                               */
+/************************************************************************/
+static void ev_phase1(evloop_t* ev, conn_t* c)
+{
+    head_t header = {0, SLIST, 0};
+    uint32_t sum = 0;
+
+    if(METRICS && c->state != PH4_NEXT)
+        metrics_since(MH_HELLO, &c->mark);
+
+    //the connection keeps the snapshot of the directory it lists until its end (or
+    //  until it lists it again, in a kept session)
+    header.stype |= PFLAGS(c->hello.stype);
+    if(c->snap)
+        dirindex_release(c->snap);
+    c->snap = dirindex_acquire(ev->index);
+    c->iov[1].iov_base = pcachelist(&c->snap->cache, &header, &sum);
+    c->iov[1].iov_len = header.nbelem * header.szelem;
+    print_neutral("server: %s -> sending %d elements of %ld bytes", c->ip, header.nbelem, header.szelem);
+    c->iov[0].iov_base = c->head;
+    c->iov[0].iov_len = pmkhead(c->head, &header);
+    c->iov[2].iov_base = c->trail;
+    c->iov[2].iov_len = pmktrailer(c->trail, sum, c->iov[1].iov_len);
+    c->iovcnt = (c->hello.stype & PF_STREAM ? 3 : 2);
+    c->expected = c->iov[1].iov_len;
+    c->sum = sum;
+    c->state = PH1_SEND;
+}
+
+/************************************************************************/
+/*  I : connection of which prepare the phase 2                         */
+/*      catalog the choice refers to                                    */
+/*      choice of the client                                            */
+/*  P : Prepares the phase 2: interpret the choice and send the name    */
+/*          of the file chosen                                          */
+/*  O : -1 on error                                                     */
+/*       1 otherwise                                                    */
+/************************************************************************/
+static int ev_phase2(conn_t* c, catalog_t* names, int choice)
+{
+    head_t header = {0, SSTRING, 0};
+    char* elem = NULL;
+
+    if(METRICS && !(c->hello.stype & PF_NOLIST))
+        metrics_since(MH_LIST, &c->mark);
+
+    //interpret the choice number to a filename
+    if((elem = catalog_name(names, choice-1)) == NULL)
+    {
+        print_error("server: %s -> invalid choice %d", c->ip, choice);
+        return -1;
+    }
+    strcpy(c->filename, elem);
+    print_neutral("server: %s -> client chose %s", c->ip, c->filename);
+
+    //prepare the header and the file name
+    header.stype |= (c->hello.stype & PF_STREAM);
+    header.nbelem = 1;
+    header.szelem = strlen(c->filename);
+    print_neutral("server: %s -> sending %d elements of %ld bytes", c->ip, header.nbelem, header.szelem);
+    c->iov[0].iov_base = c->head;
+    c->iov[0].iov_len = pmkhead(c->head, &header);
+    c->iov[1].iov_base = c->filename;
+    c->iov[1].iov_len = header.szelem;
+    c->iov[2].iov_base = c->trail;
+    c->sum = crc32c(CRC32C_INIT, c->filename, header.szelem);
+    c->iov[2].iov_len = pmktrailer(c->trail, c->sum, header.szelem);
+    c->iovcnt = (c->hello.stype & PF_STREAM ? 3 : 2);
+    c->expected = (c->hello.stype & PF_STREAM ? c->expected + header.szelem : header.szelem);
+    c->state = PH2_SEND;
+
+    return 1;
+}
+
+/************************************************************************/
+/*  I : event loop                                                      */
+/*      connection of which prepare the phase 3                         */
+/*  P : Prepares the phase 3: open the file chosen and send it (from    */
+/*          the offset the client already has, if resuming, or          */
+/*          compressed if the client inflates it and it is worth it)    */
+/*  O : -1 on error                                                     */
+/*       1 otherwise                                                    */
+/************************************************************************/
+static int ev_phase3(evloop_t* ev, conn_t* c)
+{
+    char fullpath[FILENAMESZ*2] = {0};
+    head_t header = {0, SFILE, 0}, resume = {0};
+    range_t range = {0};
+    uint64_t offset = 0;
+    int zfd = 0;
+
+    if(METRICS && c->state != PH3_RESUME)
+        metrics_since(MH_CHOICE, &c->mark);
+
+    //file resumed : wait for the offset the client already has
+    if((c->hello.stype & PF_RESUME) && !(c->hello.stype & PF_RANGE) && c->state != PH3_RESUME)
+    {
+        ev_expect(ev, c, PH3_RESUME, sizeof(head_t));
+        return 1;
+    }
+
+    //open the requested file
+    sprintf(fullpath, "%s/%s", ev->dirname, c->filename);
+    if((c->fd = open(fullpath, O_RDONLY)) == -1)
+    {
+        print_error("server: %s -> open: %s", c->ip, strerror(errno));
+        return -1;
+    }
+    c->fsize = lseek(c->fd, 0, SEEK_END);
+    c->foffset = 0;
+
+    //file fetched by ranges : only announce its size
+    if(c->hello.stype & PF_RANGE)
+    {
+        close(c->fd);
+        c->fd = -1;
+        range.length = c->fsize;
+        range.size = c->fsize;
+        header.stype = SRANGE | (c->hello.stype & PF_STREAM);
+        header.nbelem = 1;
+        header.szelem = RANGE_SZ;
+        print_neutral("server: %s -> announcing a file of %lu bytes, to be fetched by ranges", c->ip, c->fsize);
+        c->iov[0].iov_base = c->head;
+        c->iov[0].iov_len = pmkhead(c->head, &header);
+        c->iov[1].iov_base = c->part;
+        c->iov[1].iov_len = pmkrange(c->part, &range);
+        c->iov[2].iov_base = c->trail;
+        c->sum = crc32c(CRC32C_INIT, c->part, RANGE_SZ);
+        c->iov[2].iov_len = pmktrailer(c->trail, c->sum, RANGE_SZ);
+        c->iovcnt = (c->hello.stype & PF_STREAM ? 3 : 2);
+        c->expected = (c->hello.stype & PF_STREAM ? c->expected + RANGE_SZ : RANGE_SZ);
+        c->state = PH3_SEND;
+
+        return 1;
+    }
+
+    //file resumed : the offset accepted precedes the file header
+    c->iovcnt = 0;
+    if(c->state == PH3_RESUME)
+    {
+        punpackhead(c->in, &resume);
+        if(PTYPE(resume.stype) != SRESUME)
+        {
+            print_error("server: %s -> unexpected header type %d", c->ip, PTYPE(resume.stype));
+            return -1;
+        }
+
+        offset = pchkresume(c->fd, c->fsize, &resume);
+        print_neutral("server: %s -> resuming from byte %lu (%lu requested)", c->ip, offset, resume.szelem);
+        resume.szelem = offset;
+        c->iov[0].iov_base = c->part;
+        c->iov[0].iov_len = pmkhead(c->part, &resume);
+        c->iovcnt = 1;
+    }
+    c->foffset = offset;
+
+    //whole file inflated by the client : send its compressed version, once built
+    header.stype |= (c->hello.stype & PF_STREAM);
+    if((c->hello.stype & PF_DEFLATE) && offset == 0 && (zfd = zcache_get(fullpath, c->fd, ZC_ASYNC)) != -1)
+    {
+        close(c->fd);
+        c->fd = zfd;
+        c->fsize = lseek(c->fd, 0, SEEK_END);
+        header.stype |= PF_DEFLATE;
+        print_neutral("server: %s -> sending the file compressed", c->ip);
+    }
+
+    //prepare the header with the data information (the trailer follows the file)
+    header.nbelem = 1;
+    header.szelem = c->fsize - offset;
+    print_neutral("server: %s -> sending %d elements of %ld bytes", c->ip, header.nbelem, header.szelem);
+    c->iov[c->iovcnt].iov_base = c->head;
+    c->iov[c->iovcnt].iov_len = pmkhead(c->head, &header);
+    c->iovcnt++;
+    //the file is summed as it is sent, its checksum completes the trailer afterwards
+    c->sum = CRC32C_INIT;
+    if(c->hello.stype & PF_STREAM)
+    {
+        pmktrailer(c->trail, c->sum, header.szelem);
+
+        //nothing left to send, the trailer follows the header right away
+        if(header.szelem == 0)
+        {
+            c->iov[c->iovcnt].iov_base = c->trail;
+            c->iov[c->iovcnt].iov_len = sizeof(c->trail);
+            c->iovcnt++;
+        }
+    }
+
+    c->expected = (c->hello.stype & PF_STREAM ? c->expected + header.szelem : header.szelem);
+    c->state = PH3_SEND;
+    if(METRICS)
+    {
+        c->tsend = metrics_now();
+        c->tbytes = header.szelem;
+    }
+
+    return 1;
+}
+
+/************************************************************************/
+/*  I : event loop                                                      */
+/*      connection which received a range request                       */
+/*  P : Prepares the reply to a range request: open the file chosen and */
+/*          send the part of it requested                               */
+/*  O : -1 on error                                                     */
+/*       1 otherwise                                                    */
+/************************************************************************/
+static int ev_range(evloop_t* ev, conn_t* c)
+{
+    char fullpath[FILENAMESZ*2] = {0}, *elem = NULL;
+    head_t header = {0, SFILE, 0};
+    range_t range = {0};
+
+    if(METRICS)
+        metrics_since(MH_HELLO, &c->mark);
+
+    //interpret the choice number to a filename
+    punpackrange(c->in, &range);
+    c->snap = dirindex_acquire(ev->index);
+    if((elem = catalog_name(&c->snap->names, c->hello.nbelem - 1)) == NULL)
+    {
+        print_error("server: %s -> invalid choice %d", c->ip, c->hello.nbelem);
+        return -1;
+    }
+    strcpy(c->filename, elem);
+
+    //open the requested file and check the range still fits in it
+    sprintf(fullpath, "%s/%s", ev->dirname, c->filename);
+    if((c->fd = open(fullpath, O_RDONLY)) == -1)
+    {
+        print_error("server: %s -> open: %s", c->ip, strerror(errno));
+        return -1;
+    }
+    if(pchkrange(&range, lseek(c->fd, 0, SEEK_END)) == -1)
+    {
+        print_error("server: %s -> range %lu+%lu of %s can not be served", c->ip, range.offset, range.length, c->filename);
+        return -1;
+    }
+    c->foffset = range.offset;
+    c->fsize = range.offset + range.length;
+
+    //send the part of file as a file of its own
+    header.nbelem = 1;
+    header.szelem = range.length;
+    print_neutral("server: %s -> sending bytes %lu to %lu of %s", c->ip, range.offset, c->fsize, c->filename);
+    c->iov[0].iov_base = c->head;
+    c->iov[0].iov_len = pmkhead(c->head, &header);
+    c->iovcnt = 1;
+    c->expected = range.length;
+    c->sum = CRC32C_INIT;
+    c->state = PH3_SEND;
+    if(METRICS)
+    {
+        c->tsend = metrics_now();
+        c->tbytes = range.length;
+    }
+
+    return 1;
+}
+
+/************************************************************************/
+/*  I : event loop                                                      */
+/*      connection which received the name of the file it requests      */
+/*  P : Finds the name through the hash index of the current snapshot  */
+/*          of the directory, then goes on with the phase 2 as a        */
+/*          streamed request without the list                           */
+/*  O : -1 on error (no file has this name)                             */
+/*       1 otherwise                                                    */
+/************************************************************************/
+static int ev_name(evloop_t* ev, conn_t* c)
+{
+    char* name = (char*)c->in;
+    snapshot_t* snap = NULL;
+    int64_t index = 0;
+    int ret = 0;
+
+    name[c->hello.nbelem] = '\0';
+
+    //first request of the session : the hello ends with the name
+    if(METRICS && !c->snap)
+        metrics_since(MH_HELLO, &c->mark);
+
+    //the file may have come after the list of the session, find it in the current snapshot
+    snap = dirindex_acquire(ev->index);
+    if((index = catalog_lookup(&snap->names, name)) == -1)
+    {
+        print_error("server: %s -> no file named %s", c->ip, name);
+        dirindex_release(snap);
+        return -1;
+    }
+    print_neutral("server: %s -> client requested %s", c->ip, name);
+
+    c->hello.nbelem = index + 1;
+    c->hello.stype = SHELLO | PFLAGS(c->hello.stype) | PF_STREAM | PF_NOLIST;
+    ret = ev_phase2(c, &snap->names, c->hello.nbelem);
+
+    //the choices of a kept session refer to its list, if any (the name is copied)
+    if(c->snap)
+        dirindex_release(snap);
+    else
+        c->snap = snap;
+
+    return ret;
+}
+
+/************************************************************************/
+/*  I : event loop                                                      */
+/*      kept session which received its next header                     */
+/*  P : Ends the session if the client closes it, or starts its next    */
+/*          request (from the list, from the choice if the list has     */
+/*          already been received, or from the name of the file)       */
+/*  O : -1 on error                                                     */
+/*       1 otherwise                                                    */
+/************************************************************************/
+static int ev_next(evloop_t* ev, conn_t* c)
+{
+    int ret = 1;
+
+    if(phello(c->in, &c->hello, print_error) == -1)
+        return -1;
+    c->hello.stype &= ~PF_UDP;
+
+    if(PTYPE(c->hello.stype) == SCLOSE)
+    {
+        print_neutral("server: %s -> session closed by the client", c->ip);
+        c->state = PH_DONE;
+        return 1;
+    }
+
+    //a range request is served on a connection of its own
+    if(PTYPE(c->hello.stype) != SHELLO && PTYPE(c->hello.stype) != SNAME)
+    {
+        print_error("server: %s -> unexpected header type %d in a kept session", c->ip, PTYPE(c->hello.stype));
+        return -1;
+    }
+    print_neutral("server: %s -> next request, capabilities: %#x", c->ip, PFLAGS(c->hello.stype));
+
+    //forget the file of the last request
+    if(c->fd != -1)
+        close(c->fd);
+    c->fd = -1;
+    c->expected = 0;
+    c->tbytes = 0;
+    if(METRICS)
+        c->mark = metrics_now();
+
+    if(PTYPE(c->hello.stype) == SNAME)
+        ev_expect(ev, c, PH0_NAME, c->hello.nbelem);
+    else if(!(c->hello.stype & PF_NOLIST))
+        ev_phase1(ev, c);
+    else if(c->hello.stype & PF_STREAM)
+        ret = ev_phase2(c, &c->snap->names, c->hello.nbelem);
+    else
+        ev_expect(ev, c, PH2_CHOICE, sizeof(int));
+
+    return ret;
+}
+
+/************************************************************************/
+/*  I : connection on which send the data                               */
+/*  P : Sends the memory segments, then the file, summed as it is sent  */
+/*          (and its trailer if streaming), as far as possible          */
+/*  O : -1 on error                                                     */
+/*       0 if the socket would block                                    */
+/*       1 if everything has been sent                                  */
+/************************************************************************/
+static int ev_flush(conn_t* c)
+{
+    struct msghdr msg = {0};
+    head_t trailer = {0};
+    ssize_t numbytes = 0;
+    size_t len = 0;
+    off_t offset = 0;
+
+    while(1)
+    {
+        //send the memory segments (headers, payloads and trailers)
+        while(c->iovcnt > 0)
+        {
+            msg.msg_iov = c->iov;
+            msg.msg_iovlen = c->iovcnt;
+            if((numbytes = sendmsg(c->sockfd, &msg, MSG_NOSIGNAL)) == -1)
+                return (errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1);
+
+            //drop the segments sent
+            while(numbytes > 0 && c->iovcnt > 0)
+            {
+                len = ((size_t)numbytes < c->iov[0].iov_len ? (size_t)numbytes : c->iov[0].iov_len);
+                c->iov[0].iov_base = (char*)c->iov[0].iov_base + len;
+                c->iov[0].iov_len -= len;
+                numbytes -= len;
+
+                if(c->iov[0].iov_len == 0)
+                {
+                    memmove(&c->iov[0], &c->iov[1], sizeof(struct iovec) * 2);
+                    c->iovcnt--;
+                }
+            }
+        }
+
+        if(c->fd == -1 || (uint64_t)c->foffset >= c->fsize)
+            return 1;
+
+        //send the file without copying it in user space, and sum what the kernel sent
+        //  while its pages are still hot
+        while((uint64_t)c->foffset < c->fsize)
+        {
+            offset = c->foffset;
+            if((numbytes = sendfile(c->sockfd, c->fd, &c->foffset, c->fsize - c->foffset)) == -1)
+                return (errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1);
+
+            //file truncated while being sent
+            if(numbytes == 0)
+                return -1;
+
+            c->sum = paddfilesum(c->sum, c->fd, offset, numbytes);
+        }
+
+        //file sent, its trailer (now holding the checksum) follows if streaming
+        if(c->hello.stype & PF_STREAM)
+        {
+            punpackhead(c->trail, &trailer);
+            pmktrailer(c->trail, c->sum, trailer.szelem);
+            c->iov[0].iov_base = c->trail;
+            c->iov[0].iov_len = sizeof(c->trail);
+            c->iovcnt = 1;
+        }
+    }
+}
+
+/************************************************************************/
+/*  I : event loop                                                      */
+/*      connection from which receive the data                          */
+/*  P : Receives the expected amount of bytes, as far as possible (the  */
+/*          connection stops waiting for them once all received)        */
+/*  O : -1 on error (or connection closed)                              */
+/*       0 if the socket would block                                    */
+/*       1 if everything has been received                              */
+/************************************************************************/
+static int ev_fill(evloop_t* ev, conn_t* c)
+{
+    ssize_t numbytes = 0;
+
+    while(c->inlen < c->inneed)
+    {
+        if((numbytes = recv(c->sockfd, c->in + c->inlen, c->inneed - c->inlen, 0)) == -1)
+            return (errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1);
+
+        if(numbytes == 0)
+            return -1;
+
+        c->inlen += numbytes;
+    }
+
+    ev_unwait(ev, c);
+    return 1;
+}
+
+/************************************************************************/
+/*  I : event loop                                                      */
+/*      connection waiting for data                                     */
+/*      state in which the data is waited for                           */
+/*      amount of bytes to receive                                      */
+/*  P : Prepares a connection to receive an amount of bytes, within     */
+/*          PHEAD_WAIT (the hello and the next request of a kept        */
+/*          session get their own delay, see ev_wait())                 */
+/*  O : /                                                               */
+/************************************************************************/
+static void ev_expect(evloop_t* ev, conn_t* c, int state, unsigned int size)
+{
+    ev_unwait(ev, c);
+    c->state = state;
+    c->inlen = 0;
+    c->inneed = size;
+    c->queued = -1;
+    c->expectedat = ev_now();
+
+    if(state != PH0_HELLO && state != PH4_NEXT)
+        ev_wait(ev, c, PHEAD_WAIT);
+}
+
+/************************************************************************/
+/*  I : event loop                                                      */
+/*      connection waiting for its socket                               */
+/*  P : Watches the socket for reading or writing, depending on the     */
+/*          phase of the connection                                     */
+/*  O : -1 on error                                                     */
+/*       0 otherwise                                                    */
+/************************************************************************/
+static int ev_watch(evloop_t* ev, conn_t* c)
+{
+    struct epoll_event evt = {0};
+    int op = (c->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD);
+
+    evt.events = (c->state == PH1_SEND || c->state == PH2_SEND || c->state == PH3_SEND ? EPOLLOUT : EPOLLIN);
+    if(evt.events == c->events)
+        return 0;
+
+    evt.data.ptr = c;
+    if(epoll_ctl(ev->epfd, op, c->sockfd, &evt) == -1)
+    {
+        print_error("server: %s -> epoll_ctl: %s", c->ip, strerror(errno));
+        return -1;
+    }
+
+    c->events = evt.events;
+    return 0;
+}
+
+/************************************************************************/
+/*  I : event loop                                                      */
+/*      connection to wait for                                          */
+/*      milliseconds after which it is not waited for anymore           */
+/*  P : Adds a connection to the ones waiting for a hello (or, in a     */
+/*          kept session, to the ones waiting for a request, or to the  */
+/*          late ones and the ones receiving the rest of a request),    */
+/*          which stay sorted as they all wait for the same time        */
+/*  O : /                                                               */
+/************************************************************************/
+static void ev_wait(evloop_t* ev, conn_t* c, long delay)
+{
+    int late = (c->late || (c->state != PH0_HELLO && c->state != PH4_NEXT));
+    conn_t** first = (late ? &ev->late : (c->state == PH4_NEXT ? &ev->idle : &ev->waiting));
+    conn_t** last = (late ? &ev->lastlate : (c->state == PH4_NEXT ? &ev->lastidle : &ev->lastwaiting));
+
+    c->deadline = ev_now() + delay;
+    c->prev = *last;
+    if(*last)
+        (*last)->next = c;
+    else
+        *first = c;
+    *last = c;
+}
+
+/************************************************************************/
+/*  I : event loop                                                      */
+/*      connection not waiting for a hello (or a request) anymore       */
+/*  P : Removes a connection from the ones waiting for a hello (or a    */
+/*          request, or from the late ones)                             */
+/*  O : /                                                               */
+/************************************************************************/
+static void ev_unwait(evloop_t* ev, conn_t* c)
+{
+    int late = (c->late || (c->state != PH0_HELLO && c->state != PH4_NEXT));
+    conn_t** first = (late ? &ev->late : (c->state == PH4_NEXT ? &ev->idle : &ev->waiting));
+    conn_t** last = (late ? &ev->lastlate : (c->state == PH4_NEXT ? &ev->lastidle : &ev->lastwaiting));
+
+    if(c->prev)
+        c->prev->next = c->next;
+    else if(*first == c)
+        *first = c->next;
+
+    if(c->next)
+        c->next->prev = c->prev;
+    else if(*last == c)
+        *last = c->prev;
+
+    c->prev = NULL;
+    c->next = NULL;
+    c->late = 0;
+}
+
+/************************************************************************/
+/*  I : event loop                                                      */
+/*  P : Starts the phase 1 of the connections which did not receive any */
+/*          hello in time (legacy clients), and closes the kept         */
+/*          sessions idle for too long (a hello or a request partly     */
+/*          received gets PHEAD_WAIT more, then the connection closes), */
+/*          as well as the ones not receiving the rest of a request     */
+/*          (name, range, acknowledgement, choice, offset) in time,     */
+/*          unless the client still takes in the file it acknowledges   */
+/*  O : /                                                               */
+/************************************************************************/
+static void ev_timeout(evloop_t* ev)
+{
+    conn_t* c = NULL;
+    long now = ev_now();
+    int queued = 0;
+
+    while(ev->late && ev->late->deadline <= now)
+    {
+        c = ev->late;
+
+        //acknowledgement of a file the client is still taking in : give it more time as long
+        //  as its TCP makes progress, then as long as a kept session would wait (for the
+        //  client to read its own buffers)
+        if(!c->late && c->state == PH3_ACK && ioctl(c->sockfd, SIOCOUTQ, &queued) == 0
+           && ((queued > 0 && (c->queued == -1 || queued < c->queued)) || (queued == 0 && now - c->expectedat < PKEEP_IDLE)))
+        {
+            ev_unwait(ev, c);
+            c->queued = queued;
+            ev_wait(ev, c, PHEAD_WAIT);
+            continue;
+        }
+
+        if(c->late)
+            print_error("server: %s -> request still incomplete %d ms after its deadline, closed", c->ip, PHEAD_WAIT);
+        else
+            print_error("server: %s -> nothing complete received in %d ms (phase %d), closed", c->ip, PHEAD_WAIT, c->state);
+        ev_close(ev, c);
+    }
+
+    while(ev->idle && ev->idle->deadline <= now)
+    {
+        c = ev->idle;
+        ev_unwait(ev, c);
+
+        //a request is being received, let it finish (for a while)
+        if(c->inlen > 0)
+        {
+            c->late = 1;
+            ev_wait(ev, c, PHEAD_WAIT);
+            continue;
+        }
+
+        print_neutral("server: %s -> session idle for %d ms, closed", c->ip, PKEEP_IDLE);
+        c->state = PH_DONE;
+        ev_close(ev, c);
+    }
+
+    while(ev->waiting && ev->waiting->deadline <= now)
+    {
+        c = ev->waiting;
+        ev_unwait(ev, c);
+
+        //a hello is being received, let it finish (for a while)
+        if(c->inlen > 0)
+        {
+            c->late = 1;
+            ev_wait(ev, c, PHEAD_WAIT);
+            continue;
+        }
+
+        c->hello.stype = SHELLO;
+        ev_phase1(ev, c);
+        if(ev_drive(ev, c) == -1 || ev_watch(ev, c) == -1)
+        {
+            print_error("server: %s -> unable to process the request", c->ip);
+            ev_close(ev, c);
+        }
+    }
+}
+
+/************************************************************************/
+/*  I : /                                                               */
+/*  P : Gives the time of a monotonic clock                             */
+/*  O : time in milliseconds                                            */
+/************************************************************************/
+static long ev_now()
+{
+    struct timespec ts = {0};
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/************************************************************************/
+/*  I : event loop                                                      */
+/*      connection to close                                             */
+/*  P : Closes the connection, the file it sends, and releases it       */
+/*  O : /                                                               */
+/************************************************************************/
+static void ev_close(evloop_t* ev, conn_t* c)
+{
+    if(METRICS)
+    {
+        metrics_count(MC_ACTIVE, -1);
+        metrics_count((c->state == PH_DONE ? MC_DONE : MC_FAILED), 1);
+        if(c->state == PH_DONE)
+            metrics_record(MH_SESSION, metrics_now() - c->start);
+    }
+
+    //closing the socket removes it from the epoll instance
+    ev_unwait(ev, c);
+    close(c->sockfd);
+    if(c->fd != -1)
+        close(c->fd);
+    if(c->snap)
+        dirindex_release(c->snap);
+
+    free(c);
+}
@@ -0,0 +1,426 @@
+/*
+** metrics.c
+** Library regrouping the instrumentation functions (counters, latency histograms, stats endpoint)
+** ------------------------------------------
+** Made by Gilles Henrard
+** Last modified : 17/10/2026
+*/
+#include "metrics.h"
+
+typedef struct{
+    char* family;           // name of the metric family
+    char* label;            // label telling apart the histograms of a family
+    double scale;           // factor turning the values recorded into the unit exposed
+    char* help;             // description of the family
+}histdesc_t;
+
+static const histdesc_t histdescs[MH_COUNT] = {
+    {"ftp_accept_seconds", "", 1e-9, "Time from a connection accepted (or established) to its handling"},
+    {"ftp_phase_seconds", "phase=\"hello\"", 1e-9, "Time spent in each phase of a session"},
+    {"ftp_phase_seconds", "phase=\"list\"", 1e-9, NULL},
+    {"ftp_phase_seconds", "phase=\"choice\"", 1e-9, NULL},
+    {"ftp_phase_seconds", "phase=\"file\"", 1e-9, NULL},
+    {"ftp_ack_rtt_seconds", "", 1e-9, "Time from data sent to its acknowledgement received"},
+    {"ftp_transfer_bytes_per_second", "", 1.0, "Throughput of the file transfers"},
+    {"ftp_session_seconds", "", 1e-9, "Time from a connection accepted (or established) to its session done"},
+};
+
+metrics_t* metrics = NULL;
+static __thread shard_t* shard = NULL;
+
+static shard_t* met_shard();
+static void met_forked();
+static int met_bucket(uint64_t value);
+static uint64_t met_value(int bucket);
+static void met_printf(char* buffer, int size, int* len, char* format, ...);
+static void* met_endpoint(void* arg);
+
+/************************************************************************/
+/*  I : role of the process (server, client), exposed as a label        */
+/*  P : Enables the metrics : the counters are allocated in memory      */
+/*          shared with the processes forked afterwards                 */
+/*  O : -1 on error                                                     */
+/*       0 otherwise                                                    */
+/************************************************************************/
+int metrics_open(char* role)
+{
+    metrics_t* met = NULL;
+
+    if(metrics)
+        return 0;
+
+    if((met = mmap(NULL, sizeof(metrics_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+        return -1;
+
+    strncpy(met->role, role, sizeof(met->role) - 1);
+    pthread_atfork(NULL, NULL, met_forked);
+    metrics = met;
+
+    return 0;
+}
+
+/************************************************************************/
+/*  I : path of the UNIX socket on which expose the metrics             */
+/*  P : Starts a thread answering each connection on the socket with    */
+/*          the metrics (Prometheus text format, within an HTTP reply   */
+/*          if the connection starts with a GET request)                */
+/*  O : -1 on error                                                     */
+/*       0 otherwise                                                    */
+/************************************************************************/
+int metrics_serve(char* path)
+{
+    struct sockaddr_un addr = {0};
+    pthread_t thread;
+    int listener = 0;
+
+    if(!metrics || strlen(path) >= sizeof(addr.sun_path))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    if((listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1)
+        return -1;
+
+    if(bind(listener, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(listener, MET_BACKLOG) == -1
+       || pthread_create(&thread, NULL, met_endpoint, (void*)(intptr_t)listener) != 0)
+    {
+        close(listener);
+        return -1;
+    }
+
+    pthread_detach(thread);
+    return 0;
+}
+
+/************************************************************************/
+/*  I : buffer to fill with the metrics                                 */
+/*      size of the buffer                                              */
+/*  P : Writes all the metrics in the Prometheus text format : the      */
+/*          counters, the histograms (with a bucket per power of 2)     */
+/*          and their p50, p99 and p999 (from the precise buckets)      */
+/*  O : length of the text                                              */
+/************************************************************************/
+int metrics_dump(char* buffer, int size)
+{
+    const double quantiles[] = {0.5, 0.99, 0.999};
+    const histdesc_t* d = NULL;
+    shard_t* total = NULL;
+    char labels[64] = {0}, *role = NULL;
+    uint64_t cumul = 0;
+    int len = 0, h = 0, b = 0, k = 0, q = 0;
+
+    if(!metrics || (total = malloc(sizeof(shard_t))) == NULL)
+        return 0;
+
+    metrics_merge(total);
+    role = metrics->role;
+
+    met_printf(buffer, size, &len, "# HELP ftp_connections_accepted_total Connections accepted (or established)\n# TYPE ftp_connections_accepted_total counter\n");
+    met_printf(buffer, size, &len, "ftp_connections_accepted_total{role=\"%s\"} %ld\n", role, total->counters[MC_ACCEPTED]);
+    met_printf(buffer, size, &len, "# HELP ftp_connections_active Connections currently served\n# TYPE ftp_connections_active gauge\n");
+    met_printf(buffer, size, &len, "ftp_connections_active{role=\"%s\"} %ld\n", role, total->counters[MC_ACTIVE]);
+    met_printf(buffer, size, &len, "# HELP ftp_sessions_total Sessions ended, by result\n# TYPE ftp_sessions_total counter\n");
+    met_printf(buffer, size, &len, "ftp_sessions_total{role=\"%s\",result=\"done\"} %ld\n", role, total->counters[MC_DONE]);
+    met_printf(buffer, size, &len, "ftp_sessions_total{role=\"%s\",result=\"failed\"} %ld\n", role, total->counters[MC_FAILED]);
+    met_printf(buffer, size, &len, "# HELP ftp_file_bytes_total Bytes of files transferred\n# TYPE ftp_file_bytes_total counter\n");
+    met_printf(buffer, size, &len, "ftp_file_bytes_total{role=\"%s\",direction=\"sent\"} %ld\n", role, total->counters[MC_SENT]);
+    met_printf(buffer, size, &len, "ftp_file_bytes_total{role=\"%s\",direction=\"received\"} %ld\n", role, total->counters[MC_RECEIVED]);
+    met_printf(buffer, size, &len, "# HELP ftp_datagrams_total Datagrams of files sent over UDP, by kind\n# TYPE ftp_datagrams_total counter\n");
+    met_printf(buffer, size, &len, "ftp_datagrams_total{role=\"%s\",kind=\"sent\"} %ld\n", role, total->counters[MC_DGSENT]);
+    met_printf(buffer, size, &len, "ftp_datagrams_total{role=\"%s\",kind=\"resent\"} %ld\n", role, total->counters[MC_DGRESENT]);
+
+    //histograms, a bucket per power of 2 (the same ones at each scrape)
+    for(h = 0 ; h < MH_COUNT ; h++)
+    {
+        d = &histdescs[h];
+        snprintf(labels, sizeof(labels), "role=\"%s\"%s%s", role, (*d->label ? "," : ""), d->label);
+        if(d->help)
+            met_printf(buffer, size, &len, "# HELP %s %s\n# TYPE %s histogram\n", d->family, d->help, d->family);
+
+        for(k = MET_SUBBITS, b = 0, cumul = 0 ; k <= MET_MAXBITS ; k++)
+        {
+            for( ; b < ((k - MET_SUBBITS + 1) << MET_SUBBITS) ; b++)
+                cumul += total->buckets[h][b];
+
+            met_printf(buffer, size, &len, "%s_bucket{%s,le=\"%g\"} %lu\n", d->family, labels, (double)(1UL << k) * d->scale, cumul);
+        }
+        for( ; b < MET_BUCKETS ; b++)
+            cumul += total->buckets[h][b];
+
+        met_printf(buffer, size, &len, "%s_bucket{%s,le=\"+Inf\"} %lu\n", d->family, labels, cumul);
+        met_printf(buffer, size, &len, "%s_sum{%s} %g\n", d->family, labels, total->sums[h] * d->scale);
+        met_printf(buffer, size, &len, "%s_count{%s} %lu\n", d->family, labels, cumul);
+    }
+
+    //quantiles, from the precise buckets
+    for(h = 0 ; h < MH_COUNT ; h++)
+    {
+        d = &histdescs[h];
+        snprintf(labels, sizeof(labels), "role=\"%s\"%s%s", role, (*d->label ? "," : ""), d->label);
+        if(d->help)
+            met_printf(buffer, size, &len, "# HELP %s_quantile %s (quantiles)\n# TYPE %s_quantile gauge\n", d->family, d->help, d->family);
+
+        for(q = 0 ; q < 3 ; q++)
+            met_printf(buffer, size, &len, "%s_quantile{%s,quantile=\"%g\"} %g\n", d->family, labels, quantiles[q], metrics_quantile(total->buckets[h], quantiles[q]) * d->scale);
+    }
+
+    free(total);
+    return len;
+}
+
+/************************************************************************/
+/*  I : /                                                               */
+/*  P : Gives the time of a monotonic clock                             */
+/*  O : time in nanoseconds                                             */
+/************************************************************************/
+uint64_t metrics_now()
+{
+    struct timespec ts = {0};
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/************************************************************************/
+/*  I : counter to update                                               */
+/*      value to add (negative to decrease a gauge)                     */
+/*  P : Updates a counter of the calling thread (signal safe)           */
+/*  O : /                                                               */
+/************************************************************************/
+void metrics_count(int counter, int64_t value)
+{
+    __atomic_fetch_add(&met_shard()->counters[counter], value, __ATOMIC_RELAXED);
+}
+
+/************************************************************************/
+/*  I : histogram to update                                             */
+/*      value to record                                                 */
+/*  P : Records a value in a histogram of the calling thread            */
+/*  O : /                                                               */
+/************************************************************************/
+void metrics_record(int histogram, uint64_t value)
+{
+    shard_t* sh = met_shard();
+
+    __atomic_fetch_add(&sh->buckets[histogram][met_bucket(value)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&sh->sums[histogram], value, __ATOMIC_RELAXED);
+}
+
+/************************************************************************/
+/*  I : histogram to update                                             */
+/*      time at which the measure started (updated to the current time) */
+/*  P : Records the time elapsed since a mark, then moves the mark      */
+/*  O : /                                                               */
+/************************************************************************/
+void metrics_since(int histogram, uint64_t* mark)
+{
+    uint64_t now = metrics_now();
+
+    metrics_record(histogram, now - *mark);
+    *mark = now;
+}
+
+/************************************************************************/
+/*  I : amount of bytes transferred                                     */
+/*      time at which the transfer started                              */
+/*  P : Records the throughput of a transfer (if anything was sent)     */
+/*  O : /                                                               */
+/************************************************************************/
+void metrics_rate(uint64_t bytes, uint64_t start)
+{
+    uint64_t elapsed = metrics_now() - start;
+
+    if(elapsed > 0 && bytes > 0)
+        metrics_record(MH_RATE, (uint64_t)((double)bytes * 1e9 / elapsed));
+}
+
+/************************************************************************/
+/*  I : counters to fill                                                */
+/*  P : Sums the counters of all the threads and processes              */
+/*  O : /                                                               */
+/************************************************************************/
+void metrics_merge(shard_t* total)
+{
+    int s = 0, i = 0, b = 0;
+
+    memset(total, 0, sizeof(shard_t));
+    if(!metrics)
+        return;
+
+    for(s = 0 ; s < MET_SHARDS ; s++)
+    {
+        for(i = 0 ; i < MC_COUNT ; i++)
+            total->counters[i] += __atomic_load_n(&metrics->shards[s].counters[i], __ATOMIC_RELAXED);
+
+        for(i = 0 ; i < MH_COUNT ; i++)
+        {
+            total->sums[i] += __atomic_load_n(&metrics->shards[s].sums[i], __ATOMIC_RELAXED);
+            for(b = 0 ; b < MET_BUCKETS ; b++)
+                total->buckets[i][b] += __atomic_load_n(&metrics->shards[s].buckets[i][b], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/************************************************************************/
+/*  I : buckets of a histogram                                          */
+/*      quantile to compute (between 0 and 1)                           */
+/*  P : Computes a quantile of the values recorded in a histogram       */
+/*  O : highest value equivalent to the quantile (0 if empty)           */
+/************************************************************************/
+uint64_t metrics_quantile(uint64_t* buckets, double quantile)
+{
+    uint64_t count = 0, rank = 0, cumul = 0;
+    int b = 0;
+
+    for(b = 0 ; b < MET_BUCKETS ; b++)
+        count += buckets[b];
+
+    if(count == 0)
+        return 0;
+
+    rank = (uint64_t)(quantile * count + 0.5);
+    if(rank < 1)
+        rank = 1;
+
+    for(b = 0 ; b < MET_BUCKETS ; b++)
+    {
+        cumul += buckets[b];
+        if(cumul >= rank)
+            break;
+    }
+
+    return (b + 1 < MET_BUCKETS ? met_value(b + 1) - 1 : met_value(b));
+}
+
+/************************************************************************/
+/*  I : /                                                               */
+/*  P : Gives the counters of the calling thread, claiming them at its  */
+/*          first use (shared by several threads beyond MET_SHARDS)    */
+/*  O : counters of the calling thread                                  */
+/************************************************************************/
+static shard_t* met_shard()
+{
+    if(!shard)
+        shard = &metrics->shards[__atomic_fetch_add(&metrics->claimed, 1, __ATOMIC_RELAXED) % MET_SHARDS];
+
+    return shard;
+}
+
+/************************************************************************/
+/*  I : /                                                               */
+/*  P : Has a forked child claim counters of its own                    */
+/*  O : /                                                               */
+/************************************************************************/
+static void met_forked()
+{
+    shard = NULL;
+}
+
+/************************************************************************/
+/*  I : value recorded                                                  */
+/*  P : Gives the bucket of a value : exact below 2^MET_SUBBITS, then   */
+/*          2^MET_SUBBITS buckets per power of 2 (relative error of     */
+/*          1/2^MET_SUBBITS at most)                                    */
+/*  O : index of the bucket                                             */
+/************************************************************************/
+static int met_bucket(uint64_t value)
+{
+    int e = 0;
+
+    if(value < (1 << MET_SUBBITS))
+        return value;
+
+    e = 63 - __builtin_clzll(value);
+    if(e >= MET_MAXBITS)
+        return MET_BUCKETS - 1;
+
+    return ((e - MET_SUBBITS + 1) << MET_SUBBITS) | ((value >> (e - MET_SUBBITS)) & ((1 << MET_SUBBITS) - 1));
+}
+
+/************************************************************************/
+/*  I : index of a bucket                                               */
+/*  P : Gives the lowest value of a bucket                              */
+/*  O : lowest value                                                    */
+/************************************************************************/
+static uint64_t met_value(int bucket)
+{
+    int e = 0;
+
+    if(bucket < (1 << MET_SUBBITS))
+        return bucket;
+
+    e = (bucket >> MET_SUBBITS) + MET_SUBBITS - 1;
+    return (uint64_t)((1 << MET_SUBBITS) | (bucket & ((1 << MET_SUBBITS) - 1))) << (e - MET_SUBBITS);
+}
+
+/************************************************************************/
+/*  I : buffer to fill                                                  */
+/*      size of the buffer                                              */
+/*      length of the text in the buffer (updated)                      */
+/*      format string and its parameters                               */
+/*  P : Appends text to the buffer, as long as it fits                  */
+/*  O : /                                                               */
+/************************************************************************/
+static void met_printf(char* buffer, int size, int* len, char* format, ...)
+{
+    va_list arg;
+    int ret = 0;
+
+    if(*len >= size - 1)
+        return;
+
+    va_start(arg, format);
+    ret = vsnprintf(buffer + *len, size - *len, format, arg);
+    va_end(arg);
+
+    *len = (ret < 0 || *len + ret >= size ? size - 1 : *len + ret);
+}
+
+/************************************************************************/
+/*  I : listening UNIX socket                                           */
+/*  P : Answers each connection with the metrics, then closes it        */
+/*  O : NULL                                                            */
+/************************************************************************/
+static void* met_endpoint(void* arg)
+{
+    struct timeval wait = {.tv_usec = MET_WAIT};
+    char request[512] = {0}, head[128] = {0}, *buffer = NULL;
+    int listener = (int)(intptr_t)arg, sockfd = 0, len = 0, headlen = 0;
+
+    if((buffer = malloc(MET_DUMPSZ)) == NULL)
+        return NULL;
+
+    while(1)
+    {
+        if((sockfd = accept4(listener, NULL, NULL, SOCK_CLOEXEC)) == -1)
+        {
+            if(errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;
+        }
+
+        //an HTTP scraper sends its request right away, a plain reader sends nothing
+        setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof(wait));
+        memset(request, 0, sizeof(request));
+        recv(sockfd, request, sizeof(request) - 1, 0);
+
+        len = metrics_dump(buffer, MET_DUMPSZ);
+        headlen = 0;
+        if(!strncmp(request, "GET ", 4))
+            headlen = snprintf(head, sizeof(head), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %d\r\n\r\n", len);
+
+        if(headlen == 0 || send(sockfd, head, headlen, MSG_NOSIGNAL) == headlen)
+            send(sockfd, buffer, len, MSG_NOSIGNAL);
+
+        close(sockfd);
+    }
+
+    free(buffer);
+    close(listener);
+    return NULL;
+}
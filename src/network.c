@@ -4,11 +4,65 @@
 ** ------------------------------------------
 ** Based on Brian 'Beej Jorgensen' Hall's code
 ** Made by Gilles Henrard
-** Last modified : 29/11/2019
+** Last modified : 17/10/2026
 */
 
 #include "network.h"
 
+static int listen_backlog = BACKLOG;
+
+#ifdef NET_URING
+typedef struct{
+    int fd;                         // io_uring instance
+    unsigned *sqhead, *sqtail;      // submission queue head (kernel) and tail (user)
+    unsigned *sqmask, *sqarray;     // submission queue mask and indirection array
+    unsigned *cqhead, *cqtail;      // completion queue head (user) and tail (kernel)
+    unsigned *cqmask;               // completion queue mask
+    struct io_uring_sqe* sqes;      // submission queue entries
+    struct io_uring_cqe* cqes;      // completion queue entries
+    void *sqmap, *cqmap;            // rings mapped
+    size_t sqmapsz, cqmapsz, sqesz; // sizes of the mappings
+    unsigned char* buffers;         // registered buffers (RING_BUFS of RING_BUFSZ bytes)
+}ring_t;
+
+static __thread ring_t* ring = NULL;
+
+static int ring_open();
+static int ring_enter(unsigned submit, unsigned wait);
+static struct io_uring_sqe* ring_sqe();
+#endif
+
+typedef struct{
+    uint8_t type;           // type of the datagram (DG_*)
+    uint16_t count;         // amount of missing ranges following a report
+    uint32_t seq;           // number of the block (or blocks received in order)
+    uint64_t stamp;         // time the block has been sent (or time echoed to the sender), in us
+}dghead_t;
+
+typedef struct{
+    uint32_t nbblocks;      // blocks of the file
+    uint32_t next;          // first block never sent
+    uint32_t inorder;       // blocks received in order by the receiver
+    uint32_t recover;       // first block sent after the last decrease of the rate
+    uint64_t* sentat;       // time each block in flight has been sent last (us, UDP_WINDOW slots)
+    uint32_t* queue;        // blocks to send again (UDP_WINDOW slots, circular)
+    uint8_t* queued;        // blocks in flight already queued (UDP_WINDOW slots)
+    uint32_t qhead, qtail;  // first block queued, and slot following the last one
+    uint64_t rate;          // pacing rate (bytes per second)
+    uint64_t rtt;           // smoothed round-trip time (us, 0 until measured)
+    int slowstart;          // no loss seen yet : the rate doubles at each report
+    int done;               // whole file received
+}udpsend_t;
+
+static uint64_t udp_now();
+static void udp_mkhead(unsigned char* buf, dghead_t* head);
+static int udp_gethead(unsigned char* buf, int len, dghead_t* head);
+static void udp_feedback(udpsend_t* s, unsigned char* buf, int len, uint64_t now);
+static int64_t udp_burst(int udpfd, int fd, uint64_t offset, uint64_t count, udpsend_t* s, unsigned char* data, uint64_t now, udpstat_t* stat);
+static int udp_flush(int fd, struct iovec* run, int nbrun, uint64_t offset, ssize_t expected);
+static void udp_report(int udpfd, uint8_t* received, uint32_t inorder, uint32_t highest, uint64_t stamp);
+static int udp_sameaddr(struct sockaddr_storage* a, struct sockaddr_storage* b, uint16_t port);
+
 /************************************************************************/
 /*  I : socket                                                          */
 /*  P : get sockaddr, IPv4 or IPv6                                      */
@@ -30,6 +84,7 @@ void *get_in_addr(struct sockaddr *sa)
 /*      socket type (SOCK_STREAM or SOCK_DGRAM)                         */
 /*      additional action to perform (catenated with | operator)        */
 /*          MULTI   : make the socket able to reconnect if conn. exists */
+/*          REUSEPORT : share the port with other sockets (load balanced)*/
 /*          BIND    : binds the socket to a port or a service           */
 /*          CONNECT : initiates a connection on the socket              */
 /*          LISTEN  : listens to any connection on the specified port   */
@@ -78,6 +133,18 @@ int negociate_socket(char* host, char* service, int socktype, char ACTION, void
             }
         }
 
+        //let several sockets listen to the same port, the kernel spreading the connections
+        if (ACTION & REUSEPORT){
+            if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(int)) == -1){
+                if(on_error != NULL)
+                    (*on_error)("setsockopt: %s", strerror(errno));
+                else
+                    perror("setsockopt");
+                close(sockfd);
+                continue;
+            }
+        }
+
         //bind the socket to the desired port (useful in a server)
         if (ACTION & BIND){
             if (bind(sockfd, p->ai_addr, p->ai_addrlen) == -1){
@@ -122,7 +189,7 @@ int negociate_socket(char* host, char* service, int socktype, char ACTION, void
     //listen to socket created
     if(ACTION & LISTEN)
     {
-        if (listen(sockfd, BACKLOG) == -1){
+        if (listen(sockfd, listen_backlog) == -1){
             if(on_error != NULL)
                 (*on_error)("listen: %s", strerror(errno));
             else
@@ -135,6 +202,34 @@ int negociate_socket(char* host, char* service, int socktype, char ACTION, void
 	return sockfd;
 }
 
+/************************************************************************/
+/*  I : amount of pending connections the listening sockets will hold   */
+/*  P : Sets the backlog used by negociate_socket() when listening      */
+/*  O : previous backlog                                                */
+/************************************************************************/
+int setbacklog(int backlog)
+{
+    int previous = listen_backlog;
+
+    listen_backlog = backlog;
+    return previous;
+}
+
+/************************************************************************/
+/*  I : socket file descriptor                                          */
+/*  P : Sends the small messages at once (Nagle's algorithm disabled),  */
+/*          for the connections on which a message follows an          */
+/*          acknowledgement (kept sessions)                             */
+/*  O : -1 on error, and errno is set                                   */
+/*       0 otherwise                                                    */
+/************************************************************************/
+int setnodelay(int sockfd)
+{
+    int yes = 1;
+
+    return setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(int));
+}
+
 /************************************************************************/
 /*  I : file descriptor of the socket of which to get the IP            */
 /*      buffer to fill with the IP address                              */
@@ -209,7 +304,7 @@ int receiveData(int sockfd, void* buf, int bufsz, struct sockaddr_storage* clien
     else
     {
         //wait data on a non-connected socket
-        if ((numbytes = recvfrom(sockfd, buf, bufsz, 0, (struct sockaddr *)&client, &size)) == -1)
+        if ((numbytes = recvfrom(sockfd, buf, bufsz, 0, (struct sockaddr *)client, &size)) == -1)
             return -1;
     }
 
@@ -253,3 +348,1233 @@ int sendData(int sockfd, void* buf, int* length, struct sockaddr_storage* client
 
     return numbytes;
 }
+
+/************************************************************************/
+/*  I : file descriptor of the socket to which send the data            */
+/*      memory segments to send (updated as they are sent)              */
+/*      amount of memory segments                                       */
+/*  P : Sends several memory segments with as few writev() as possible  */
+/*  O : on success : number of bytes sent                               */
+/*      on error : -1, and errno is set                                 */
+/************************************************************************/
+int64_t sendVector(int sockfd, struct iovec* iov, int iovcnt)
+{
+    int64_t total = 0;
+    ssize_t numbytes = 0;
+
+    while(iovcnt > 0)
+    {
+        if((numbytes = writev(sockfd, iov, (iovcnt > IOV_MAX ? IOV_MAX : iovcnt))) == -1)
+        {
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+        total += numbytes;
+
+        //skip the segments entirely sent, and shift the one partially sent
+        while(iovcnt > 0 && (size_t)numbytes >= iov->iov_len)
+        {
+            numbytes -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if(iovcnt > 0)
+        {
+            iov->iov_base = (char*)iov->iov_base + numbytes;
+            iov->iov_len -= numbytes;
+        }
+    }
+
+    return total;
+}
+
+/************************************************************************/
+/*  I : file descriptor of the socket to which send the file            */
+/*      file descriptor of the file to send                             */
+/*      amount of bytes to send, from the current offset of the file    */
+/*  P : Sends a file without copying it in user space: sendfile() is    */
+/*          used first, splice() through a pipe if it is unsupported    */
+/*  O : on success : number of bytes sent                               */
+/*      on error : -1, and errno is set                                 */
+/************************************************************************/
+int64_t sendFile(int sockfd, int fd, uint64_t count)
+{
+    int pipefd[2] = {0};
+    ssize_t numbytes = 0, pending = 0, moved = 0;
+    uint64_t total = 0;
+
+    //let the kernel copy the file pages straight to the socket
+    while(total < count)
+    {
+        if((numbytes = sendfile(sockfd, fd, NULL, count - total)) <= 0)
+            break;
+
+        total += numbytes;
+    }
+
+    //everything sent, or end of file reached
+    if(numbytes >= 0)
+        return total;
+
+    if(errno != EINVAL && errno != ENOSYS)
+        return -1;
+
+    //sendfile() not supported by the descriptors, move the pages through a pipe
+    if(pipe(pipefd) == -1)
+        return -1;
+
+    while(total < count && numbytes >= 0)
+    {
+        //fill the pipe with the file pages
+        if((numbytes = splice(fd, NULL, pipefd[1], NULL, count - total, SPLICE_F_MOVE|SPLICE_F_MORE)) <= 0)
+            break;
+
+        //drain the pipe in the socket
+        pending = numbytes;
+        while(pending > 0)
+        {
+            if((moved = splice(pipefd[0], NULL, sockfd, NULL, pending, SPLICE_F_MOVE|SPLICE_F_MORE)) <= 0)
+            {
+                numbytes = -1;
+                break;
+            }
+            pending -= moved;
+        }
+
+        if(numbytes != -1)
+            total += numbytes;
+    }
+
+    close(pipefd[0]);
+    close(pipefd[1]);
+
+    return (numbytes == -1 ? -1 : (int64_t)total);
+}
+
+/************************************************************************/
+/*  I : file descriptor of the socket from which receive the data       */
+/*      file descriptor of the file to write                            */
+/*      offset at which write the data in the file                      */
+/*      amount of bytes to receive                                      */
+/*  P : Receives data straight in a file, without copying it in user   */
+/*          space: the socket pages are moved through a pipe, with      */
+/*          splice(), then written at their offset                      */
+/*  O : on success : number of bytes received (less if the connection   */
+/*          has been closed)                                            */
+/*      on error : -1, and errno is set                                 */
+/************************************************************************/
+int64_t receiveFile(int sockfd, int fd, uint64_t offset, uint64_t count)
+{
+    int pipefd[2] = {0};
+    ssize_t numbytes = 0, pending = 0, moved = 0;
+    loff_t off = offset;
+    uint64_t total = 0;
+
+    if(pipe(pipefd) == -1)
+        return -1;
+
+    while(total < count && numbytes >= 0)
+    {
+        //fill the pipe with the socket pages
+        if((numbytes = splice(sockfd, NULL, pipefd[1], NULL, count - total, SPLICE_F_MOVE|SPLICE_F_MORE)) <= 0)
+            break;
+
+        //drain the pipe in the file
+        pending = numbytes;
+        while(pending > 0)
+        {
+            if((moved = splice(pipefd[0], NULL, fd, &off, pending, SPLICE_F_MOVE|SPLICE_F_MORE)) <= 0)
+            {
+                numbytes = -1;
+                break;
+            }
+            pending -= moved;
+        }
+
+        if(numbytes != -1)
+            total += numbytes;
+    }
+
+    close(pipefd[0]);
+    close(pipefd[1]);
+
+    return (numbytes == -1 ? -1 : (int64_t)total);
+}
+
+/************************************************************************/
+/*  I : /                                                               */
+/*  P : Checks the io_uring engine is built in and usable by the kernel */
+/*          (reads of registered buffers and sends supported)           */
+/*  O : -1 if the engine can't be used (errno set)                      */
+/*       0 otherwise                                                    */
+/************************************************************************/
+int probeRing()
+{
+#ifdef NET_URING
+    struct io_uring_probe* probe = NULL;
+    int ret = 0;
+
+    if(ring_open() == -1)
+        return -1;
+
+    if((probe = calloc(1, sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op))) == NULL)
+        ret = -1;
+    else if(syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, 256) == -1)
+        ret = -1;
+    else if(probe->last_op < IORING_OP_SEND
+            || !(probe->ops[IORING_OP_READ_FIXED].flags & IO_URING_OP_SUPPORTED)
+            || !(probe->ops[IORING_OP_SEND].flags & IO_URING_OP_SUPPORTED))
+    {
+        errno = EOPNOTSUPP;
+        ret = -1;
+    }
+
+    free(probe);
+    closeRing();
+    return ret;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/************************************************************************/
+/*  I : file descriptor of the socket to which send the file            */
+/*      file descriptor of the file to send                             */
+/*      amount of bytes to send, from the current offset of the file    */
+/*  P : Sends a file through the io_uring of the calling thread (opened */
+/*          at its first use): the file and the socket are registered,  */
+/*          then reads of the registered buffers and sends are queued   */
+/*          as a single chain, submitted with one system call           */
+/*  O : on success : number of bytes sent (less if the file is shorter) */
+/*      on error : -1, and errno is set                                 */
+/************************************************************************/
+int64_t sendFileRing(int sockfd, int fd, uint64_t count)
+{
+#ifdef NET_URING
+    struct io_uring_files_update update = {0};
+    struct io_uring_sqe* sqe = NULL;
+    struct io_uring_cqe* cqe = NULL;
+    int files[2] = {0}, res[RING_BUFS * 2] = {0}, err = 0;
+    uint32_t lens[RING_BUFS] = {0};
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+    uint64_t total = 0, queued = 0;
+    unsigned n = 0, i = 0, head = 0;
+
+    if(offset == -1 || (!ring && ring_open() == -1))
+        return -1;
+
+    //fixed files : 0 is the file, 1 is the socket
+    files[0] = fd;
+    files[1] = sockfd;
+    update.fds = (uint64_t)(uintptr_t)files;
+    if(syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_FILES_UPDATE, &update, 2) == -1)
+        return -1;
+
+    while(total < count)
+    {
+        //chain a read and a send per buffer, the sends staying in order
+        for(n = 0, queued = 0 ; n < RING_BUFS && total + queued < count ; n++)
+        {
+            lens[n] = (count - total - queued < RING_BUFSZ ? count - total - queued : RING_BUFSZ);
+
+            sqe = ring_sqe();
+            sqe->opcode = IORING_OP_READ_FIXED;
+            sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+            sqe->fd = 0;
+            sqe->addr = (uint64_t)(uintptr_t)(ring->buffers + n * RING_BUFSZ);
+            sqe->len = lens[n];
+            sqe->off = offset + total + queued;
+            sqe->buf_index = n;
+            sqe->user_data = n * 2;
+
+            //a short send breaks the chain instead of letting the next one go
+            sqe = ring_sqe();
+            sqe->opcode = IORING_OP_SEND;
+            sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+            sqe->fd = 1;
+            sqe->addr = (uint64_t)(uintptr_t)(ring->buffers + n * RING_BUFSZ);
+            sqe->len = lens[n];
+            sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+            sqe->user_data = n * 2 + 1;
+
+            queued += lens[n];
+        }
+        sqe->flags &= ~IOSQE_IO_LINK;
+
+        //completions possibly left behind : start again with a new ring next time
+        if(ring_enter(n * 2, n * 2) == -1)
+        {
+            err = errno;
+            closeRing();
+            errno = err;
+            return -1;
+        }
+
+        //collect the results of the whole chain
+        head = *ring->cqhead;
+        for(i = 0 ; i < n * 2 ; i++, head++)
+        {
+            cqe = &ring->cqes[head & *ring->cqmask];
+            res[cqe->user_data] = cqe->res;
+        }
+        __atomic_store_n(ring->cqhead, head, __ATOMIC_RELEASE);
+
+        //account the pairs entirely sent, in order, and resume after the first one which is not
+        for(i = 0 ; i < n && res[i * 2] == (int)lens[i] && res[i * 2 + 1] == (int)lens[i] ; i++)
+            total += lens[i];
+
+        if(i < n)
+        {
+            //part of a buffer sent : go on from the next byte
+            if(res[i * 2 + 1] > 0)
+            {
+                total += res[i * 2 + 1];
+                continue;
+            }
+
+            //end of file reached
+            if(res[i * 2] == 0)
+                break;
+
+            //file shorter than expected : only what is left of it is to be sent
+            if(res[i * 2] > 0 && res[i * 2] < (int)lens[i])
+            {
+                count = total + res[i * 2];
+                continue;
+            }
+
+            //error (the read or the send which broke the chain)
+            err = (res[i * 2] < 0 && res[i * 2] != -ECANCELED ? -res[i * 2] : -res[i * 2 + 1]);
+            break;
+        }
+    }
+
+    //unregister the file and the socket, which would otherwise be held open by the ring
+    files[0] = -1;
+    files[1] = -1;
+    syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_FILES_UPDATE, &update, 2);
+
+    if(err)
+    {
+        errno = err;
+        return -1;
+    }
+
+    lseek(fd, offset + total, SEEK_SET);
+    return total;
+#else
+    //not built with the io_uring engine
+    (void)sockfd;
+    (void)fd;
+    (void)count;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/************************************************************************/
+/*  I : /                                                               */
+/*  P : Closes the io_uring of the calling thread, if opened            */
+/*  O : /                                                               */
+/************************************************************************/
+void closeRing()
+{
+#ifdef NET_URING
+    if(!ring)
+        return;
+
+    munmap(ring->sqes, ring->sqesz);
+    munmap(ring->sqmap, ring->sqmapsz);
+    munmap(ring->cqmap, ring->cqmapsz);
+    close(ring->fd);
+    free(ring->buffers);
+    free(ring);
+    ring = NULL;
+#endif
+}
+
+/************************************************************************/
+/*  I : connection of which the file is to be sent over UDP             */
+/*      port to fill with the one of the UDP socket                     */
+/*  P : Opens a UDP socket on the local address of the connection, on   */
+/*          a port chosen by the kernel, with large buffers             */
+/*  O : on success : UDP socket file descriptor                         */
+/*      on error : -1, and errno is set                                 */
+/************************************************************************/
+int bindUdp(int sockfd, uint16_t* port)
+{
+    struct sockaddr_storage addr = {0};
+    socklen_t size = sizeof(struct sockaddr_storage);
+    char address[INET6_ADDRSTRLEN] = {0};
+    int udpfd = 0, bufsz = UDP_BUFSZ;
+
+    if(getsockname(sockfd, (struct sockaddr *)&addr, &size) == -1)
+        return -1;
+
+    inet_ntop(addr.ss_family, get_in_addr((struct sockaddr *)&addr), address, sizeof(address));
+    if((udpfd = negociate_socket(address, "0", SOCK_DGRAM, BIND, NULL)) == -1)
+        return -1;
+
+    size = sizeof(struct sockaddr_storage);
+    if(getsockname(udpfd, (struct sockaddr *)&addr, &size) == -1)
+    {
+        close(udpfd);
+        return -1;
+    }
+    *port = ntohs(addr.ss_family == AF_INET ? ((struct sockaddr_in*)&addr)->sin_port : ((struct sockaddr_in6*)&addr)->sin6_port);
+
+    //bursts are paced, the buffers only absorb their jitter (capped by the system)
+    setsockopt(udpfd, SOL_SOCKET, SO_SNDBUF, &bufsz, sizeof(int));
+    setsockopt(udpfd, SOL_SOCKET, SO_RCVBUF, &bufsz, sizeof(int));
+
+    return udpfd;
+}
+
+/************************************************************************/
+/*  I : UDP socket opened with bindUdp()                                */
+/*      connection of which the file is to be sent over UDP             */
+/*      UDP port the receiver announced over the connection             */
+/*  P : Waits for the first report of the receiver, then connects the   */
+/*          UDP socket to it (datagrams coming from another address     */
+/*          than the one of the connection, or another port than the    */
+/*          one announced, are ignored)                                 */
+/*  O : on success : 0                                                  */
+/*      on error : -1, and errno is set (ETIMEDOUT if nothing came)     */
+/************************************************************************/
+int acceptUdp(int udpfd, int sockfd, uint16_t port)
+{
+    struct sockaddr_storage peer = {0}, from = {0};
+    socklen_t size = sizeof(struct sockaddr_storage);
+    struct pollfd pfd = {udpfd, POLLIN, 0};
+    unsigned char buf[UDP_DGRAMSZ];
+    uint64_t start = udp_now(), now = start;
+    int ret = 0;
+
+    if(getpeername(sockfd, (struct sockaddr *)&peer, &size) == -1)
+        return -1;
+
+    while(now - start < UDP_TIMEOUT)
+    {
+        if((ret = poll(&pfd, 1, (UDP_TIMEOUT - (now - start)) / 1000 + 1)) == -1 && errno != EINTR)
+            return -1;
+
+        size = sizeof(struct sockaddr_storage);
+        if(ret > 0 && recvfrom(udpfd, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr *)&from, &size) >= 0
+           && udp_sameaddr(&peer, &from, port))
+            return connect(udpfd, (struct sockaddr *)&from, size);
+
+        now = udp_now();
+    }
+
+    errno = ETIMEDOUT;
+    return -1;
+}
+
+/************************************************************************/
+/*  I : connection on which the file has been announced                 */
+/*      UDP port from which the sender sends the file                   */
+/*      port to fill with the one of the UDP socket (to announce)       */
+/*  P : Opens a UDP socket connected to the port of the peer of the     */
+/*          connection, with large buffers                              */
+/*  O : on success : UDP socket file descriptor                         */
+/*      on error : -1, and errno is set                                 */
+/************************************************************************/
+int connectUdp(int sockfd, uint16_t port, uint16_t* local)
+{
+    struct sockaddr_storage addr = {0};
+    socklen_t size = sizeof(struct sockaddr_storage);
+    char address[INET6_ADDRSTRLEN] = {0}, service[8] = {0};
+    int udpfd = 0, bufsz = UDP_BUFSZ;
+
+    if(socket_to_ip(&sockfd, address, sizeof(address)) == -1)
+        return -1;
+
+    sprintf(service, "%u", port);
+    if((udpfd = negociate_socket(address, service, SOCK_DGRAM, CONNECT, NULL)) == -1)
+        return -1;
+
+    if(getsockname(udpfd, (struct sockaddr *)&addr, &size) == -1)
+    {
+        close(udpfd);
+        return -1;
+    }
+    *local = ntohs(addr.ss_family == AF_INET ? ((struct sockaddr_in*)&addr)->sin_port : ((struct sockaddr_in6*)&addr)->sin6_port);
+
+    setsockopt(udpfd, SOL_SOCKET, SO_SNDBUF, &bufsz, sizeof(int));
+    setsockopt(udpfd, SOL_SOCKET, SO_RCVBUF, &bufsz, sizeof(int));
+
+    return udpfd;
+}
+
+/************************************************************************/
+/*  I : UDP socket connected to the receiver (see acceptUdp())          */
+/*      connection of the session (readable once the receiver is done)  */
+/*      file descriptor of the file to send                             */
+/*      amount of bytes to send, from the current offset of the file    */
+/*      statistics to fill (can be NULL)                                */
+/*  P : Sends a file in numbered datagrams, in batches (sendmmsg()):    */
+/*          - the batches are paced at a rate raised at each report of  */
+/*              the receiver, and lowered by 30 % once per window of    */
+/*              blocks in which losses are reported                     */
+/*          - the blocks reported missing are sent again first (once    */
+/*              the time they needed to be reported has passed)          */
+/*          - at most UDP_WINDOW blocks are sent beyond the ones        */
+/*              received in order                                       */
+/*      The transfer ends once the receiver reports it has the whole    */
+/*          file, or answers over the connection (it fails if the       */
+/*          connection hangs up or closes instead)                      */
+/*  O : on success : number of bytes sent (retransmissions excluded)    */
+/*      on error : -1, and errno is set (ETIMEDOUT if the receiver went */
+/*          silent)                                                     */
+/************************************************************************/
+int64_t sendFileUdp(int udpfd, int sockfd, int fd, uint64_t count, udpstat_t* stat)
+{
+    struct pollfd fds[2] = {{udpfd, POLLIN, 0}, {sockfd, POLLIN, 0}};
+    struct mmsghdr msgs[UDP_BATCH];
+    struct iovec iov[UDP_BATCH];
+    struct timespec wait = {0};
+    unsigned char *data = NULL, *reports = NULL, byte = 0;
+    udpsend_t s = {0};
+    udpstat_t local = {0};
+    uint64_t now = 0, due = 0, heard = 0, sent = 0, delay = 0;
+    int64_t offset = 0, ret = 0;
+    int n = 0, i = 0, pending = 0;
+
+    if((offset = lseek(fd, 0, SEEK_CUR)) == -1)
+        return -1;
+
+    if((count + UDP_PAYLOAD - 1) / UDP_PAYLOAD > UINT32_MAX)
+    {
+        errno = EFBIG;
+        return -1;
+    }
+
+    s.nbblocks = (count + UDP_PAYLOAD - 1) / UDP_PAYLOAD;
+    s.rate = UDP_RATE_INIT;
+    s.slowstart = 1;
+    s.sentat = calloc(UDP_WINDOW, sizeof(uint64_t));
+    s.queue = calloc(UDP_WINDOW, sizeof(uint32_t));
+    s.queued = calloc(UDP_WINDOW, sizeof(uint8_t));
+    data = malloc(UDP_BATCH * UDP_PAYLOAD);
+    reports = malloc(UDP_BATCH * UDP_DGRAMSZ);
+    if(!s.sentat || !s.queue || !s.queued || !data || !reports)
+    {
+        errno = ENOMEM;
+        ret = -1;
+    }
+
+    if(!stat)
+        stat = &local;
+    memset(stat, 0, sizeof(udpstat_t));
+
+    for(i = 0 ; i < UDP_BATCH ; i++)
+    {
+        iov[i].iov_base = reports + i * UDP_DGRAMSZ;
+        iov[i].iov_len = UDP_DGRAMSZ;
+        memset(&msgs[i], 0, sizeof(struct mmsghdr));
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    now = udp_now();
+    due = now;
+    heard = now;
+    while(ret != -1 && !s.done && s.inorder < s.nbblocks)
+    {
+        //blocks to send : the ones reported missing, then new ones (within the window)
+        pending = (s.qhead != s.qtail || (s.next < s.nbblocks && s.next - s.inorder < UDP_WINDOW));
+        delay = (pending ? (due > now ? due - now : 0) : UDP_PROBE);
+        wait.tv_sec = delay / 1000000;
+        wait.tv_nsec = (delay % 1000000) * 1000;
+        if(ppoll(fds, 2, &wait, NULL) == -1 && errno != EINTR)
+        {
+            ret = -1;
+            break;
+        }
+        now = udp_now();
+
+        //the receiver answered over the connection : it is done with the datagrams
+        //  (the connection hung up, failed or closed instead : the transfer is lost)
+        if(fds[1].revents)
+        {
+            n = ((fds[1].revents & POLLIN) ? recv(sockfd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) : 0);
+            if(n == 1)
+                break;
+
+            if(n == 0 || errno != EAGAIN || (fds[1].revents & ~POLLIN))
+            {
+                errno = (n == -1 && errno != EAGAIN ? errno : ECONNRESET);
+                ret = -1;
+                break;
+            }
+        }
+
+        //reports of the receiver
+        while((fds[0].revents & POLLIN) && (n = recvmmsg(udpfd, msgs, UDP_BATCH, MSG_DONTWAIT, NULL)) > 0)
+        {
+            for(i = 0 ; i < n ; i++)
+                udp_feedback(&s, reports + i * UDP_DGRAMSZ, msgs[i].msg_len, now);
+            heard = now;
+        }
+        fds[0].revents = 0;
+
+        if(now - heard > UDP_TIMEOUT)
+        {
+            errno = ETIMEDOUT;
+            ret = -1;
+            break;
+        }
+
+        //nothing left to send and nothing heard for a while : send the first block missing again, to get a report
+        if(!pending && now - heard >= UDP_PROBE && now - sent >= UDP_PROBE && !s.queued[s.inorder & (UDP_WINDOW - 1)])
+        {
+            s.queue[s.qtail++ & (UDP_WINDOW - 1)] = s.inorder;
+            s.queued[s.inorder & (UDP_WINDOW - 1)] = 1;
+            pending = 1;
+        }
+
+        //send a batch once the pacing allows it (no burst to catch up after an idle time)
+        if(!s.done && pending && now >= due)
+        {
+            if((n = udp_burst(udpfd, fd, offset, count, &s, data, now, stat)) == -1)
+            {
+                ret = -1;
+                break;
+            }
+
+            if(due + UDP_REPORT < now)
+                due = now;
+            due += (uint64_t)n * 1000000 / s.rate;
+            sent = now;
+        }
+    }
+
+    stat->rate = s.rate;
+    stat->rtt = s.rtt;
+    free(s.sentat);
+    free(s.queue);
+    free(s.queued);
+    free(data);
+    free(reports);
+
+    return (ret == -1 ? -1 : (int64_t)count);
+}
+
+/************************************************************************/
+/*  I : UDP socket connected to the sender (see connectUdp())           */
+/*      file descriptor of the file to write                            */
+/*      offset at which write the data in the file                      */
+/*      amount of bytes to receive                                      */
+/*  P : Receives a file sent with sendFileUdp(): the datagrams are      */
+/*          received in batches (recvmmsg()), the consecutive blocks    */
+/*          written at once at their offset (pwritev()), and the        */
+/*          blocks missing reported every UDP_REPORT us (the first      */
+/*          report lets the sender know where to send). The end is      */
+/*          reported once the whole file is received                   */
+/*  O : on success : number of bytes received                           */
+/*      on error : -1, and errno is set (ETIMEDOUT if the sender went   */
+/*          silent)                                                     */
+/************************************************************************/
+int64_t receiveFileUdp(int udpfd, int fd, uint64_t offset, uint64_t count)
+{
+    struct pollfd pfd = {udpfd, POLLIN, 0};
+    struct mmsghdr msgs[UDP_BATCH];
+    struct iovec iov[UDP_BATCH], run[UDP_BATCH];
+    struct timespec wait = {0};
+    unsigned char *buffers = NULL, done[UDP_HEADSZ] = {0};
+    uint8_t* received = NULL;
+    uint32_t nbblocks = (count + UDP_PAYLOAD - 1) / UDP_PAYLOAD, inorder = 0, highest = 0, got = 0, first = 0;
+    uint64_t now = udp_now(), reported = 0, heard = now, stamp = 0, stampedat = 0, delay = 0;
+    dghead_t head = {0}, end = {DG_DONE, 0, 0, 0};
+    int n = 0, i = 0, nbrun = 0, ret = 0;
+    ssize_t expected = 0;
+
+    if((count + UDP_PAYLOAD - 1) / UDP_PAYLOAD > UINT32_MAX)
+    {
+        errno = EFBIG;
+        return -1;
+    }
+
+    buffers = malloc(UDP_BATCH * UDP_DGRAMSZ);
+    received = calloc(nbblocks / 8 + 1, sizeof(uint8_t));
+    if(!buffers || !received)
+    {
+        free(buffers);
+        free(received);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for(i = 0 ; i < UDP_BATCH ; i++)
+    {
+        iov[i].iov_base = buffers + i * UDP_DGRAMSZ;
+        iov[i].iov_len = UDP_DGRAMSZ;
+        memset(&msgs[i], 0, sizeof(struct mmsghdr));
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    while(got < nbblocks && ret != -1)
+    {
+        //report the blocks missing (echoing the time the last block has been sent, plus the time it has been held)
+        if(now - reported >= UDP_REPORT)
+        {
+            udp_report(udpfd, received, inorder, highest, (stamp ? stamp + (now - stampedat) : 0));
+            reported = now;
+        }
+
+        delay = UDP_REPORT - (now - reported);
+        wait.tv_sec = delay / 1000000;
+        wait.tv_nsec = (delay % 1000000) * 1000;
+        if(ppoll(&pfd, 1, &wait, NULL) == -1 && errno != EINTR)
+        {
+            ret = -1;
+            break;
+        }
+
+        //nothing received yet : the reports may not have reached the sender so far
+        if((n = recvmmsg(udpfd, msgs, UDP_BATCH, MSG_DONTWAIT, NULL)) == -1)
+        {
+            if(errno != EAGAIN && errno != EINTR && errno != ECONNREFUSED)
+                ret = -1;
+            n = 0;
+        }
+        now = udp_now();
+
+        //write each run of consecutive blocks at once
+        for(i = 0, nbrun = 0 ; i <= n && ret != -1 ; i++)
+        {
+            if(i < n && udp_gethead(buffers + i * UDP_DGRAMSZ, msgs[i].msg_len, &head) == 0 && head.type == DG_DATA
+               && head.seq < nbblocks && msgs[i].msg_len == UDP_HEADSZ + (head.seq == nbblocks - 1 ? count - (uint64_t)head.seq * UDP_PAYLOAD : UDP_PAYLOAD))
+            {
+                stamp = head.stamp;
+                stampedat = now;
+                heard = now;
+
+                //block received already, or not following the run : the run is written first
+                if(nbrun && (head.seq != first + nbrun || (received[head.seq >> 3] & (1 << (head.seq & 7)))))
+                {
+                    ret = udp_flush(fd, run, nbrun, offset + (uint64_t)first * UDP_PAYLOAD, expected);
+                    nbrun = 0;
+                }
+
+                if(!(received[head.seq >> 3] & (1 << (head.seq & 7))))
+                {
+                    if(nbrun == 0)
+                    {
+                        first = head.seq;
+                        expected = 0;
+                    }
+                    run[nbrun].iov_base = buffers + i * UDP_DGRAMSZ + UDP_HEADSZ;
+                    run[nbrun].iov_len = msgs[i].msg_len - UDP_HEADSZ;
+                    expected += run[nbrun].iov_len;
+                    nbrun++;
+
+                    received[head.seq >> 3] |= (1 << (head.seq & 7));
+                    got++;
+                    if(head.seq >= highest)
+                        highest = head.seq + 1;
+                }
+            }
+            else if(i == n && nbrun)
+            {
+                ret = udp_flush(fd, run, nbrun, offset + (uint64_t)first * UDP_PAYLOAD, expected);
+                nbrun = 0;
+            }
+        }
+
+        while(inorder < nbblocks && (received[inorder >> 3] & (1 << (inorder & 7))))
+            inorder++;
+
+        if(ret != -1 && now - heard > UDP_TIMEOUT)
+        {
+            errno = ETIMEDOUT;
+            ret = -1;
+        }
+    }
+
+    //whole file received : let the sender know (it probes if this is lost)
+    if(ret != -1)
+    {
+        udp_mkhead(done, &end);
+        send(udpfd, done, sizeof(done), 0);
+    }
+
+    free(buffers);
+    free(received);
+
+    return (ret == -1 ? -1 : (int64_t)count);
+}
+
+/************************************************************************/
+/*  I : UDP socket of a file received (see receiveFileUdp())            */
+/*      connection of the session                                       */
+/*  P : Waits for the next message of the connection, reporting the end */
+/*          of the transfer again to each datagram still sent (the      */
+/*          sender probes until it knows the file has been received)    */
+/*  O : on success : 0                                                  */
+/*      on error : -1, and errno is set (ETIMEDOUT if nothing came)     */
+/************************************************************************/
+int lingerUdp(int udpfd, int sockfd)
+{
+    struct pollfd fds[2] = {{udpfd, POLLIN, 0}, {sockfd, POLLIN, 0}};
+    unsigned char buf[UDP_DGRAMSZ], done[UDP_HEADSZ] = {0};
+    dghead_t head = {DG_DONE, 0, 0, 0};
+    int ret = 0;
+
+    udp_mkhead(done, &head);
+    while((ret = poll(fds, 2, UDP_TIMEOUT / 1000)) != 0)
+    {
+        if(ret == -1 && errno != EINTR)
+            return -1;
+
+        if(fds[1].revents)
+            return 0;
+
+        if((fds[0].revents & POLLIN) && recv(udpfd, buf, sizeof(buf), MSG_DONTWAIT) >= 0)
+            send(udpfd, done, sizeof(done), 0);
+    }
+
+    errno = ETIMEDOUT;
+    return -1;
+}
+
+#ifdef NET_URING
+/************************************************************************/
+/*  I : /                                                               */
+/*  P : Opens the io_uring of the calling thread: maps its queues, then */
+/*          registers its buffers and a table of two fixed files        */
+/*  O : -1 on error (errno set)                                         */
+/*       0 otherwise                                                    */
+/************************************************************************/
+static int ring_open()
+{
+    struct io_uring_params params = {0};
+    struct iovec iov[RING_BUFS];
+    int files[2] = {-1, -1}, i = 0, err = 0;
+
+    if((ring = calloc(1, sizeof(ring_t))) == NULL)
+        return -1;
+
+    if((ring->fd = syscall(__NR_io_uring_setup, RING_BUFS * 2, &params)) == -1)
+    {
+        err = errno;
+        free(ring);
+        ring = NULL;
+        errno = err;
+        return -1;
+    }
+
+    //map the submission queue, its entries and the completion queue
+    ring->sqmapsz = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqmapsz = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqesz = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqmap = mmap(NULL, ring->sqmapsz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cqmap = mmap(NULL, ring->cqmapsz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqesz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if(ring->sqmap == MAP_FAILED || ring->cqmap == MAP_FAILED || ring->sqes == MAP_FAILED)
+    {
+        err = errno;
+        if(ring->sqmap != MAP_FAILED)
+            munmap(ring->sqmap, ring->sqmapsz);
+        if(ring->cqmap != MAP_FAILED)
+            munmap(ring->cqmap, ring->cqmapsz);
+        if(ring->sqes != MAP_FAILED)
+            munmap(ring->sqes, ring->sqesz);
+        close(ring->fd);
+        free(ring);
+        ring = NULL;
+        errno = err;
+        return -1;
+    }
+
+    ring->sqhead = (unsigned*)((char*)ring->sqmap + params.sq_off.head);
+    ring->sqtail = (unsigned*)((char*)ring->sqmap + params.sq_off.tail);
+    ring->sqmask = (unsigned*)((char*)ring->sqmap + params.sq_off.ring_mask);
+    ring->sqarray = (unsigned*)((char*)ring->sqmap + params.sq_off.array);
+    ring->cqhead = (unsigned*)((char*)ring->cqmap + params.cq_off.head);
+    ring->cqtail = (unsigned*)((char*)ring->cqmap + params.cq_off.tail);
+    ring->cqmask = (unsigned*)((char*)ring->cqmap + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)((char*)ring->cqmap + params.cq_off.cqes);
+
+    //register the buffers, and room for the file and the socket
+    if(posix_memalign((void**)&ring->buffers, sysconf(_SC_PAGESIZE), RING_BUFS * RING_BUFSZ) != 0)
+    {
+        ring->buffers = NULL;
+        closeRing();
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for(i = 0 ; i < RING_BUFS ; i++)
+    {
+        iov[i].iov_base = ring->buffers + i * RING_BUFSZ;
+        iov[i].iov_len = RING_BUFSZ;
+    }
+
+    if(syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iov, RING_BUFS) == -1
+       || syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_FILES, files, 2) == -1)
+    {
+        err = errno;
+        closeRing();
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
+
+/************************************************************************/
+/*  I : amount of entries to submit                                     */
+/*      amount of completions to wait for                               */
+/*  P : Submits the entries queued and waits for their completions      */
+/*  O : -1 on error (errno set)                                         */
+/*       0 otherwise                                                    */
+/************************************************************************/
+static int ring_enter(unsigned submit, unsigned wait)
+{
+    unsigned ready = 0;
+    int ret = 0;
+
+    while(submit > 0 || ready < wait)
+    {
+        if((ret = syscall(__NR_io_uring_enter, ring->fd, submit, wait - ready, IORING_ENTER_GETEVENTS, NULL, 0)) == -1)
+        {
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        submit -= ret;
+        ready = __atomic_load_n(ring->cqtail, __ATOMIC_ACQUIRE) - *ring->cqhead;
+    }
+
+    return 0;
+}
+
+/************************************************************************/
+/*  I : /                                                               */
+/*  P : Gives the next free submission queue entry, queued right away   */
+/*          (submitted with the next ring_enter())                      */
+/*  O : submission queue entry (cleared)                                */
+/************************************************************************/
+static struct io_uring_sqe* ring_sqe()
+{
+    unsigned tail = *ring->sqtail, index = tail & *ring->sqmask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sqarray[index] = index;
+    __atomic_store_n(ring->sqtail, tail + 1, __ATOMIC_RELEASE);
+
+    return sqe;
+}
+#endif
+
+/************************************************************************/
+/*  I : /                                                               */
+/*  P : Gives the time of a monotonic clock (to pace and time datagrams)*/
+/*  O : time in microseconds                                            */
+/************************************************************************/
+static uint64_t udp_now()
+{
+    struct timespec ts = {0};
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/************************************************************************/
+/*  I : buffer to fill (UDP_HEADSZ bytes)                               */
+/*      header of the datagram                                          */
+/*  P : Serialises the header of a datagram (network byte order)        */
+/*  O : /                                                               */
+/************************************************************************/
+static void udp_mkhead(unsigned char* buf, dghead_t* head)
+{
+    uint16_t count = htons(head->count);
+    uint32_t seq = htonl(head->seq);
+    uint64_t stamp = htobe64(head->stamp);
+
+    buf[0] = head->type;
+    buf[1] = 0;
+    memcpy(buf + 2, &count, sizeof(count));
+    memcpy(buf + 4, &seq, sizeof(seq));
+    memcpy(buf + 8, &stamp, sizeof(stamp));
+}
+
+/************************************************************************/
+/*  I : datagram received                                               */
+/*      size of the datagram                                            */
+/*      header to fill                                                  */
+/*  P : Deserialises the header of a datagram                           */
+/*  O : -1 if the datagram is too short to be one of a transfer         */
+/*       0 otherwise                                                    */
+/************************************************************************/
+static int udp_gethead(unsigned char* buf, int len, dghead_t* head)
+{
+    uint16_t count = 0;
+    uint32_t seq = 0;
+    uint64_t stamp = 0;
+
+    if(len < UDP_HEADSZ)
+        return -1;
+
+    memcpy(&count, buf + 2, sizeof(count));
+    memcpy(&seq, buf + 4, sizeof(seq));
+    memcpy(&stamp, buf + 8, sizeof(stamp));
+    head->type = buf[0];
+    head->count = ntohs(count);
+    head->seq = ntohl(seq);
+    head->stamp = be64toh(stamp);
+
+    return 0;
+}
+
+/************************************************************************/
+/*  I : state of the transfer                                           */
+/*      datagram received from the receiver                             */
+/*      size of the datagram                                            */
+/*      time it has been received (us)                                  */
+/*  P : Applies a report of the receiver: updates the blocks received   */
+/*          in order and the round-trip time, queues the blocks missing */
+/*          again, and adapts the pacing rate (lowered once per window  */
+/*          of blocks in which new losses are reported, raised          */
+/*          otherwise)                                                  */
+/*  O : /                                                               */
+/************************************************************************/
+static void udp_feedback(udpsend_t* s, unsigned char* buf, int len, uint64_t now)
+{
+    dghead_t head = {0};
+    uint32_t first = 0, length = 0, block = 0, r = 0;
+    uint64_t guard = 0;
+    int loss = 0;
+
+    if(udp_gethead(buf, len, &head) == -1)
+        return;
+
+    if(head.type == DG_DONE)
+    {
+        s->done = 1;
+        return;
+    }
+
+    if(head.type != DG_NACK || len < UDP_HEADSZ + head.count * 8)
+        return;
+
+    if(head.seq > s->inorder && head.seq <= s->next)
+        s->inorder = head.seq;
+    if(head.stamp && head.stamp < now)
+        s->rtt = (s->rtt ? (7 * s->rtt + (now - head.stamp)) / 8 : now - head.stamp);
+
+    //a block is sent again once it had the time to be received and reported
+    guard = s->rtt + 2 * UDP_REPORT;
+    for(r = 0 ; r < head.count ; r++)
+    {
+        memcpy(&first, buf + UDP_HEADSZ + r * 8, sizeof(first));
+        memcpy(&length, buf + UDP_HEADSZ + r * 8 + 4, sizeof(length));
+        first = ntohl(first);
+        length = ntohl(length);
+
+        for(block = (first > s->inorder ? first : s->inorder) ; block - first < length && block < s->next ; block++)
+        {
+            if(s->queued[block & (UDP_WINDOW - 1)] || now - s->sentat[block & (UDP_WINDOW - 1)] < guard)
+                continue;
+
+            s->queue[s->qtail++ & (UDP_WINDOW - 1)] = block;
+            s->queued[block & (UDP_WINDOW - 1)] = 1;
+            if(block >= s->recover)
+                loss = 1;
+        }
+    }
+
+    //losses among the blocks sent since the last decrease : slow down (a window of blocks later, again if needed)
+    if(loss)
+    {
+        s->rate = (s->rate * 7 / 10 > UDP_RATE_MIN ? s->rate * 7 / 10 : UDP_RATE_MIN);
+        s->recover = s->next;
+        s->slowstart = 0;
+    }
+    else
+    {
+        s->rate = (s->slowstart ? s->rate * 2 : s->rate + UDP_RATE_STEP);
+        if(s->rate > UDP_RATE_MAX)
+            s->rate = UDP_RATE_MAX;
+    }
+}
+
+/************************************************************************/
+/*  I : UDP socket connected to the receiver                            */
+/*      file descriptor of the file to send                             */
+/*      offset of the first byte to send in the file                    */
+/*      amount of bytes to send                                         */
+/*      state of the transfer                                           */
+/*      buffer of UDP_BATCH blocks                                      */
+/*      time of the batch (us)                                          */
+/*      statistics to update                                            */
+/*  P : Sends a batch of blocks at once (sendmmsg()): the ones queued   */
+/*          again first, then new ones, read with a single pread()      */
+/*  O : on success : number of bytes sent                               */
+/*      on error : -1, and errno is set                                 */
+/************************************************************************/
+static int64_t udp_burst(int udpfd, int fd, uint64_t offset, uint64_t count, udpsend_t* s, unsigned char* data, uint64_t now, udpstat_t* stat)
+{
+    unsigned char heads[UDP_BATCH][UDP_HEADSZ];
+    struct mmsghdr msgs[UDP_BATCH];
+    struct iovec iov[UDP_BATCH][2];
+    uint32_t blocks[UDP_BATCH], block = 0, nbnew = 0;
+    dghead_t head = {DG_DATA, 0, 0, now};
+    uint64_t bytes = 0, length = 0;
+    int nb = 0, i = 0;
+
+    //blocks reported missing (unless received in order since)
+    while(nb < UDP_BATCH && s->qhead != s->qtail)
+    {
+        block = s->queue[s->qhead++ & (UDP_WINDOW - 1)];
+        s->queued[block & (UDP_WINDOW - 1)] = 0;
+        if(block < s->inorder)
+            continue;
+
+        length = (block == s->nbblocks - 1 ? count - (uint64_t)block * UDP_PAYLOAD : UDP_PAYLOAD);
+        if(pread(fd, data + nb * UDP_PAYLOAD, length, offset + (uint64_t)block * UDP_PAYLOAD) != (ssize_t)length)
+        {
+            errno = (errno ? errno : EIO);
+            return -1;
+        }
+        blocks[nb++] = block;
+        stat->resent++;
+    }
+
+    //new blocks, following each other in the file
+    nbnew = UDP_BATCH - nb;
+    if(nbnew > s->nbblocks - s->next)
+        nbnew = s->nbblocks - s->next;
+    if(nbnew > UDP_WINDOW - (s->next - s->inorder))
+        nbnew = UDP_WINDOW - (s->next - s->inorder);
+    if(nbnew)
+    {
+        length = ((uint64_t)s->next + nbnew == s->nbblocks ? count - (uint64_t)s->next * UDP_PAYLOAD : (uint64_t)nbnew * UDP_PAYLOAD);
+        if(pread(fd, data + nb * UDP_PAYLOAD, length, offset + (uint64_t)s->next * UDP_PAYLOAD) != (ssize_t)length)
+        {
+            errno = (errno ? errno : EIO);
+            return -1;
+        }
+        for(i = 0 ; (uint32_t)i < nbnew ; i++)
+            blocks[nb++] = s->next++;
+    }
+
+    for(i = 0 ; i < nb ; i++)
+    {
+        head.seq = blocks[i];
+        udp_mkhead(heads[i], &head);
+        length = (blocks[i] == s->nbblocks - 1 ? count - (uint64_t)blocks[i] * UDP_PAYLOAD : UDP_PAYLOAD);
+        iov[i][0].iov_base = heads[i];
+        iov[i][0].iov_len = UDP_HEADSZ;
+        iov[i][1].iov_base = data + i * UDP_PAYLOAD;
+        iov[i][1].iov_len = length;
+        memset(&msgs[i], 0, sizeof(struct mmsghdr));
+        msgs[i].msg_hdr.msg_iov = iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 2;
+        s->sentat[blocks[i] & (UDP_WINDOW - 1)] = now;
+        bytes += UDP_HEADSZ + length;
+    }
+
+    //datagrams not sent (buffers full, receiver not listening yet) are reported missing, as lost ones
+    if(nb && sendmmsg(udpfd, msgs, nb, 0) == -1 && errno != EAGAIN && errno != ENOBUFS && errno != ECONNREFUSED)
+        return -1;
+
+    stat->sent += nb;
+    return bytes;
+}
+
+/************************************************************************/
+/*  I : file descriptor of the file written                             */
+/*      run of consecutive blocks                                       */
+/*      amount of blocks in the run                                     */
+/*      offset of the first block in the file                           */
+/*      amount of bytes in the run                                      */
+/*  P : Writes a run of consecutive blocks at once                      */
+/*  O : -1 on error (errno set)                                         */
+/*       0 otherwise                                                    */
+/************************************************************************/
+static int udp_flush(int fd, struct iovec* run, int nbrun, uint64_t offset, ssize_t expected)
+{
+    ssize_t written = 0;
+
+    if((written = pwritev(fd, run, nbrun, offset)) != expected)
+    {
+        if(written != -1)
+            errno = EIO;
+        return -1;
+    }
+
+    return 0;
+}
+
+/************************************************************************/
+/*  I : UDP socket connected to the sender                              */
+/*      blocks received (bitmap)                                        */
+/*      blocks received in order                                        */
+/*      block following the highest one received                        */
+/*      time to echo to the sender (0 if no block received yet)         */
+/*  P : Reports the ranges of blocks missing below the highest one      */
+/*          received, as many as a datagram holds (a lost report is    */
+/*          only followed by the next one)                              */
+/*  O : /                                                               */
+/************************************************************************/
+static void udp_report(int udpfd, uint8_t* received, uint32_t inorder, uint32_t highest, uint64_t stamp)
+{
+    unsigned char buf[UDP_DGRAMSZ];
+    dghead_t head = {DG_NACK, 0, inorder, stamp};
+    uint32_t block = inorder, first = 0, length = 0;
+
+    while(block < highest && UDP_HEADSZ + (head.count + 1) * 8 <= UDP_DGRAMSZ)
+    {
+        //skip the blocks received (a byte at once when all of them are)
+        if(!(block & 7) && received[block >> 3] == 0xFF)
+        {
+            block += 8;
+            continue;
+        }
+        if(received[block >> 3] & (1 << (block & 7)))
+        {
+            block++;
+            continue;
+        }
+
+        first = block;
+        while(block < highest && !(received[block >> 3] & (1 << (block & 7))))
+            block++;
+
+        first = htonl(first);
+        length = htonl(block - ntohl(first));
+        memcpy(buf + UDP_HEADSZ + head.count * 8, &first, sizeof(first));
+        memcpy(buf + UDP_HEADSZ + head.count * 8 + 4, &length, sizeof(length));
+        head.count++;
+    }
+
+    udp_mkhead(buf, &head);
+    send(udpfd, buf, UDP_HEADSZ + head.count * 8, 0);
+}
+
+/************************************************************************/
+/*  I : address of the expected host (its port ignored)                 */
+/*      address to check                                                */
+/*      port expected                                                   */
+/*  P : Checks an address designates the expected host and port         */
+/*  O : 1 if it does                                                    */
+/*      0 otherwise                                                     */
+/************************************************************************/
+static int udp_sameaddr(struct sockaddr_storage* a, struct sockaddr_storage* b, uint16_t port)
+{
+    if(a->ss_family != b->ss_family)
+        return 0;
+
+    if(ntohs(b->ss_family == AF_INET ? ((struct sockaddr_in*)b)->sin_port : ((struct sockaddr_in6*)b)->sin6_port) != port)
+        return 0;
+
+    return !memcmp(get_in_addr((struct sockaddr *)a), get_in_addr((struct sockaddr *)b),
+                   (a->ss_family == AF_INET ? sizeof(struct in_addr) : sizeof(struct in6_addr)));
+}
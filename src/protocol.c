@@ -3,35 +3,101 @@
 ** Library regrouping protocol-based functions
 ** ------------------------------------------
 ** Made by Gilles Henrard
-** Last modified : 16/12/2019
+** Last modified : 17/10/2026
 */
 #include "protocol.h"
 
+static int send_mode = SND_COPY;
+static int recv_mode = RCV_BATCH;
+static __thread pstream_t stream = {0};
+
+static int precv(int sockfd, void* structure, range_t* range, void (*doPrint)(char*, ...));
+static int precvall(int sockfd, void* buf, int len);
+static int precvackhead(int sockfd, unsigned char* serialised);
+static int psndlistz(int sockfd, meta_t* lis, head_t* header, void (*doPrint)(char*, ...));
+static int psndframe(int sockfd, head_t* frame, unsigned char* payload, uint32_t sum, void (*doPrint)(char*, ...));
+static int pinflate(z_stream* zs, int fd, unsigned char* data, size_t len);
+static int precvfile(int sockfd, int fd, range_t* range, uint64_t size, uint64_t* received, uint32_t* sum);
+static int precvudp(int sockfd, uint64_t size, uint16_t* port);
+
+/************************************************************************/
+/*  I : way files are sent by psnd() (SND_COPY, SND_ZEROCOPY, SND_URING)*/
+/*  P : Sets the way files are sent to the receiver                     */
+/*  O : previous mode                                                   */
+/************************************************************************/
+int setsendmode(int mode)
+{
+    int previous = send_mode;
+
+    send_mode = mode;
+    return previous;
+}
+
+/************************************************************************/
+/*  I : way files are received by prcv() (RCV_BATCH or RCV_ZEROCOPY)    */
+/*  P : Sets the way files are received from the sender                 */
+/*  O : previous mode                                                   */
+/************************************************************************/
+int setrecvmode(int mode)
+{
+    int previous = recv_mode;
+
+    recv_mode = mode;
+    return previous;
+}
+
+/************************************************************************/
+/*  I : socket from which receive data                                  */
+/*      structure to which add the data (file, list, string buffer, ...)*/
+/*      function to print errors (can be NULL)                          */
+/*  P : Receives a message (see precv())                                */
+/*  O : -1 if error                                                     */
+/*      0 otherwise                                                     */
+/************************************************************************/
+int prcv(int sockfd, void* structure, void (*doPrint)(char*, ...))
+{
+    return precv(sockfd, structure, NULL, doPrint);
+}
 
 /************************************************************************/
 /*  I : socket from which receive data                                  */
 /*      structure to which add the data (file, list, string buffer, ...)*/
+/*      range of the file received (NULL if the whole file is sent)     */
 /*      function to print errors (can be NULL)                          */
 /*  P : Follow the established protocol on the receiver side:           */
 /*          1- receive the header indicating how many bytes and type to */
 /*              receive                                                 */
 /*          2- receive the data and store it in the data structure      */
 /*          3- send an acknowledge header with the actual bytes amount  */
-/*              received                                                */
+/*              received and their CRC32C, computed on the fly (or, if  */
+/*              the message is streamed, check its trailer and account  */
+/*              it for the session acknowledgement)                     */
+/*      A raw file is received apart, in large batches (see precvfile())*/
+/*      A compressed file (PF_DEFLATE) is inflated as it is received    */
 /*  O : -1 if error                                                     */
 /*      0 otherwise                                                     */
 /************************************************************************/
-int prcv(int sockfd, void* structure, void (*doPrint)(char*, ...))
+static int precv(int sockfd, void* structure, range_t* range, void (*doPrint)(char*, ...))
 {
-    unsigned char serialised[MAXDATASIZE] = {0};
-    char buffer[MAXDATASIZE] = {0};
-	head_t header = {0};
+    unsigned char serialised[sizeof(head_t)] = {0};
+    unsigned char buffer[MAXDATASIZE], *record = NULL, *element = NULL;
+	head_t header = {0}, trailer = {0}, announce = {0};
+	cursor_t cur = {0};
 	meta_t* lis = NULL;
-	int ret = 1, *fd = NULL;
-	uint64_t received = 0, size = 0;
+	char format[16] = {0};
+	int ret = 1, *fd = NULL, compact = 0, udpfd = -1, len = 0, err = 0;
+	uint64_t received = 0, size = 0, want = 0, offset = 0;
+	uint16_t port = 0;
+	uint32_t sum = CRC32C_INIT, namemax = 0;
+	z_stream zs = {0};
+	int inflated = 0;
+	uint64_t start = 0;
+	unsigned long long msize = 0;
+	long long mtime = 0;
+	unsigned char mtype = 0;
 
 	//wait for the header containing the data info
-    if (receiveData(sockfd, serialised, sizeof(head_t), NULL, 1) == -1)
+    if (precvall(sockfd, serialised, sizeof(head_t)) <= 0)
     {
         if(doPrint)
             (*doPrint)("prcv: error while receiving the data header");
@@ -39,67 +105,314 @@ int prcv(int sockfd, void* structure, void (*doPrint)(char*, ...))
     }
 
     //deserialise it and set the header
-    unpack(serialised, HEAD_F, &header.nbelem, &header.stype, &header.szelem);
+    punpackhead(serialised, &header);
     memset(&serialised, 0, sizeof(serialised));
+    stream.flags = PFLAGS(header.stype);
 
-    //unpack all the data sent by the sender and store it in the right structure
+    //records (list elements, strings) are decoded in place from a receive
+    //  buffer, so they must fit in it (compact lists are decoded name by name)
     size = header.nbelem * header.szelem;
+    compact = (PTYPE(header.stype) == SLIST && (header.stype & PF_LISTZ));
+
+    //file sent in datagrams : nbelem carries the port of the sender
+    if(PTYPE(header.stype) == SFILE && (header.stype & PF_UDP))
+        size = header.szelem;
+    if(PTYPE(header.stype) != SFILE && !compact && size && (header.szelem == 0 || header.szelem > sizeof(buffer)))
+    {
+        if(doPrint)
+            (*doPrint)("prcv: elements of %lu bytes can not be received", header.szelem);
+        return -1;
+    }
+
+    //a range is a fixed record, a part of file must be the one requested (and raw, over the connection),
+    //  a file sent in datagrams is raw
+    if((PTYPE(header.stype) == SRANGE && header.szelem != RANGE_SZ)
+       || (range && (PTYPE(header.stype) != SFILE || size != range->length || (header.stype & (PF_DEFLATE | PF_UDP))))
+       || (PTYPE(header.stype) == SFILE && (header.stype & PF_UDP) && ((header.stype & PF_DEFLATE) || header.nbelem == 0 || header.nbelem > 0xFFFF)))
+    {
+        if(doPrint)
+            (*doPrint)("prcv: unexpected message of %lu bytes (type %d)", size, PTYPE(header.stype));
+        return -1;
+    }
+
+    //compressed file : inflated as it is received
+    if(PTYPE(header.stype) == SFILE && (header.stype & PF_DEFLATE) && inflateInit(&zs) != Z_OK)
+    {
+        if(doPrint)
+            (*doPrint)("prcv: unable to initialise the decompression");
+        return -1;
+    }
+
+    //compact list (or list of elements shorter than the ones of the list) : each name
+    //  is unpacked in a full list element, followed by its metadata if any
+    //  (the names must leave room for their terminating NUL)
+    if(PTYPE(header.stype) == SLIST && (compact || header.szelem < ((meta_t*)structure)->elementsize))
+    {
+        lis = (meta_t*)structure;
+        namemax = lis->elementsize;
+        if(header.stype & PF_STAT)
+        {
+            if(lis->elementsize < sizeof(fileinfo_t))
+            {
+                if(doPrint)
+                    (*doPrint)("prcv: elements of %u bytes can not hold the file metadata", lis->elementsize);
+                return -1;
+            }
+            namemax = FILENAMESZ;
+        }
+        sprintf(format, "%us%s", namemax - 1, (header.stype & PF_STAT ? META_F : ""));
+
+        if((record = calloc(1, lis->elementsize)) == NULL)
+        {
+            if(doPrint)
+                (*doPrint)("prcv: unable to allocate a list element");
+            return -1;
+        }
+    }
+
+    if(METRICS)
+        start = metrics_now();
+
+    //file sent in datagrams : received apart, then summed from the file written
+    if(PTYPE(header.stype) == SFILE && (header.stype & PF_UDP))
+    {
+        fd = (int*)structure;
+        offset = lseek(*fd, 0, SEEK_CUR);
+
+        //announce the port the reports are sent from, the only one the sender
+        //  accepts them from (0 if there is none : the sender gives up)
+        udpfd = connectUdp(sockfd, header.nbelem, &port);
+        err = errno;
+        announce.nbelem = (udpfd == -1 ? 0 : port);
+        announce.stype = SFILE | PF_UDP;
+        announce.szelem = size;
+        len = pmkhead(serialised, &announce);
+        if(udpfd == -1 || sendData(sockfd, serialised, &len, NULL, 1) == -1 || receiveFileUdp(udpfd, *fd, offset, size) == -1)
+        {
+            if(udpfd == -1)
+            {
+                sendData(sockfd, serialised, &len, NULL, 1);
+                errno = err;
+            }
+            if(doPrint)
+                (*doPrint)("prcv: receiving the file in datagrams: %s", strerror(errno));
+            ret = -1;
+        }
+        else
+        {
+            received = size;
+            sum = pfilesum(*fd, offset, size);
+            lseek(*fd, offset + size, SEEK_SET);
+        }
+    }
+
+    //raw file : received in large batches, written at once
+    else if(PTYPE(header.stype) == SFILE && !(header.stype & PF_DEFLATE) && size)
+    {
+        fd = (int*)structure;
+        if((ret = precvfile(sockfd, *fd, range, size, &received, &sum)) == -1)
+        {
+            if(doPrint)
+                (*doPrint)("prcv: receiving the file: %s", strerror(errno));
+        }
+    }
+
+    //unpack all the data sent by the sender and store it in the right structure
+    cinit(&cur, buffer, sizeof(buffer), 0);
     while(received < size && ret > 0)
     {
-        //receive package from the sender
-        if ((ret = receiveData(sockfd, buffer, (header.szelem < sizeof(buffer) ? header.szelem : sizeof(buffer)), NULL, 1)) == -1)
+        //never read past the current message, the next one may follow,
+        //  and receive as many bytes as the room left allows
+        want = size - received;
+        if(want > cur.cap - cur.len)
+            want = cur.cap - cur.len;
+
+        ret = receiveData(sockfd, cur.buf + cur.len, want, NULL, 1);
+        if (ret == -1)
         {
             if(doPrint)
                 (*doPrint)("prcv: error while receiving the data");
         }
 
-        //unpack the data and store it
-        switch(header.stype)
+        if(ret <= 0)
+            break;
+
+        sum = crc32c(sum, cur.buf + cur.len, ret);
+        cfeed(&cur, ret);
+        received += ret;
+
+        //store the data (records as soon as they are complete)
+        switch(PTYPE(header.stype))
         {
             case SLIST: // receive a list
                 lis = (meta_t*)structure;
-                if(insertListSorted(lis, buffer) == -1)
+                while(compact && ret != -1)
+                {
+                    //a name as long as the element (or the name of the metadata) is malformed
+                    if(cur.len - cur.pos >= 2 && loadu16(cur.buf + cur.pos) >= namemax)
+                    {
+                        if(doPrint)
+                            (*doPrint)("prcv: malformed compact list");
+
+                        ret = -1;
+                        break;
+                    }
+
+                    if(cunpack(&cur, format, (char*)record, &msize, &mtime, &mtype) <= 0)
+                        break;
+
+                    if(header.stype & PF_STAT)
+                    {
+                        ((fileinfo_t*)record)->meta.size = msize;
+                        ((fileinfo_t*)record)->meta.mtime = mtime;
+                        ((fileinfo_t*)record)->meta.type = mtype;
+                    }
+
+                    if(insertListSorted(lis, record) == -1)
+                    {
+                        if(doPrint)
+                            (*doPrint)("prcv: error while inserting data in the list");
+
+                        ret = -1;
+                    }
+                    memset(record, 0, lis->elementsize);
+                }
+
+                //a name longer than the receive buffer can't be decoded
+                if(compact && ret != -1 && cur.need > cur.cap - (cur.len - cur.pos))
                 {
                     if(doPrint)
-                        (*doPrint)("prcv: error while inserting data in the list");
+                        (*doPrint)("prcv: malformed compact list");
 
                     ret = -1;
                 }
+
+                while(!compact && ret != -1 && (element = ctake(&cur, header.szelem)))
+                {
+                    //element shorter than the ones of the list : padded
+                    if(record)
+                    {
+                        memset(record, 0, lis->elementsize);
+                        memcpy(record, element, header.szelem);
+                        element = record;
+                    }
+
+                    if(insertListSorted(lis, element) == -1)
+                    {
+                        if(doPrint)
+                            (*doPrint)("prcv: error while inserting data in the list");
+
+                        ret = -1;
+                    }
+                }
                 break;
 
-            case SFILE: // receive a file
+            case SFILE: // receive a compressed file
                 fd = (int*)structure;
-                if(write(*fd, buffer, ret) != ret)
+                if((inflated = pinflate(&zs, *fd, cur.buf, cur.len)) == -1)
                 {
                     if(doPrint)
-                        (*doPrint)("prcv: writing in the file: %s", strerror(errno));
+                        (*doPrint)("prcv: inflating the file: %s", (zs.msg ? zs.msg : strerror(errno)));
 
                     ret = -1;
                 }
+                cur.pos = cur.len;
                 break;
 
             case SSTRING: // receive a string
-                strcpy((char*)structure, (char*)buffer);
+                if((element = ctake(&cur, header.szelem)))
+                {
+                    memcpy(structure, element, strnlen((char*)element, header.szelem));
+                    ((char*)structure)[strnlen((char*)element, header.szelem)] = '\0';
+                }
+                break;
+
+            case SRANGE: // receive a range
+                if((element = ctake(&cur, RANGE_SZ)))
+                    punpackrange(element, (range_t*)structure);
                 break;
 
             default:
+                cur.pos = cur.len;
                 break;
         }
 
-        if(ret != -1)
+        ccompact(&cur);
+    }
+
+    //compact list : no truncated name may be left
+    if(compact)
+    {
+        if(ret > 0 && cur.len != cur.pos)
+        {
+            if(doPrint)
+                (*doPrint)("prcv: malformed compact list");
+
+            ret = -1;
+        }
+    }
+    free(record);
+
+    //compressed file : the stream must end with the data
+    if(PTYPE(header.stype) == SFILE && (header.stype & PF_DEFLATE))
+    {
+        if(ret > 0 && received == size && inflated != 1)
+        {
+            if(doPrint)
+                (*doPrint)("prcv: the compressed file is truncated");
+
+            ret = -1;
+        }
+        inflateEnd(&zs);
+    }
+
+    //file received : account its bytes (as transferred) and its throughput
+    if(METRICS && PTYPE(header.stype) == SFILE && ret > 0)
+    {
+        metrics_count(MC_RECEIVED, received);
+        metrics_rate(received, start);
+    }
+
+    //file sent in datagrams : the sender is done with them once it knows the file is received
+    if(udpfd != -1)
+    {
+        if(ret > 0 && (header.stype & PF_STREAM) && lingerUdp(udpfd, sockfd) == -1 && doPrint)
+            (*doPrint)("prcv: waiting for the end of the datagrams: %s", strerror(errno));
+        close(udpfd);
+    }
+
+    //streamed message : check the trailer instead of acknowledging
+    if(header.stype & PF_STREAM)
+    {
+        if(precvall(sockfd, serialised, sizeof(head_t)) <= 0)
+        {
+            if(doPrint)
+                (*doPrint)("prcv: error while receiving the data trailer");
+
+            return -1;
+        }
+
+        punpackhead(serialised, &trailer);
+        if(ret == -1 || PTYPE(trailer.stype) != STRAILER || trailer.szelem != received || trailer.nbelem != sum)
         {
-            //clear the memory buffers
-            memset(&buffer, 0, sizeof(buffer));
-            received += ret;
+            if(doPrint)
+                (*doPrint)("prcv: trailer does not match the data received");
+
+            return -1;
         }
+
+        //account the message for the session acknowledgement
+        stream.nbmsg++;
+        stream.bytes += received;
+        return ret;
     }
 
-    //prepare the reply header to be sent
-    header.nbelem = 1;
+    //prepare the reply header to be sent (with the CRC of the data received)
+    header.nbelem = sum;
+    header.stype |= PF_CRC;
     header.szelem = (ret == -1 ? 0 : received);
     memset(serialised, 0, sizeof(serialised));
-    pack(serialised, HEAD_F, header.nbelem, header.stype, header.szelem);
-    size = sizeof(head_t);
+    size = pmkhead(serialised, &header);
 
     //send it to the sender
     if(sendData(sockfd, serialised, (int*)&size, NULL, 1) == -1)
@@ -124,7 +437,9 @@ int prcv(int sockfd, void* structure, void (*doPrint)(char*, ...))
 /*              receive                                                 */
 /*          2- read the data structure and send it                      */
 /*          3- receive an acknowledgement header with the actual bytes  */
-/*              amount received                                         */
+/*              amount received and their CRC32C (or, if the message is */
+/*              streamed, send a trailer and let prcvack() check the    */
+/*              whole session)                                          */
 /*  O : -1 if error                                                     */
 /*      0 otherwise                                                     */
 /************************************************************************/
@@ -132,31 +447,117 @@ int psnd(int sockfd, void* structure, head_t* header, void (*doPrint)(char*, ...
 {
     unsigned char serialised[MAXDATASIZE] = {0};
     char* buffer = NULL;
-    int ret=0, *fd=NULL;
-    uint64_t sent = 0, size = 0;
+    int ret=0, *fd=NULL, udpfd = -1;
+    uint64_t sent = 0, size = 0, start = 0, offset = 0, chunk = 0;
+    int64_t moved = 0;
+    uint32_t sum = CRC32C_INIT;
+    uint16_t port = 0;
     meta_t *lis = NULL;
     dyndata_t* tmp = NULL;
+    udpstat_t udp = {0};
+
+    //compact list : the header, the names and the trailer go in a single frame
+    if(PTYPE(header->stype) == SLIST && (header->stype & PF_LISTZ))
+        return psndlistz(sockfd, (meta_t*)structure, header, doPrint);
+
+    //range : a single record, sent in a single frame as well
+    if(PTYPE(header->stype) == SRANGE)
+    {
+        header->nbelem = 1;
+        header->szelem = pmkrange(serialised, (range_t*)structure);
+        return psndframe(sockfd, header, serialised, crc32c(CRC32C_INIT, serialised, header->szelem), doPrint);
+    }
+
+    //file sent in datagrams : the header announces the port from which they are sent
+    if(PTYPE(header->stype) == SFILE && (header->stype & PF_UDP))
+    {
+        if((udpfd = bindUdp(sockfd, &port)) == -1)
+        {
+            if(doPrint)
+                (*doPrint)("psnd: unable to open a socket for the datagrams: %s", strerror(errno));
+
+            return -1;
+        }
+        header->nbelem = port;
+    }
 
     //serialize the header and send it to the receiver
-    pack(serialised, HEAD_F, header->nbelem, header->stype, header->szelem);
-    ret = sizeof(head_t);
+    ret = pmkhead(serialised, header);
     if(sendData(sockfd, serialised, &ret, NULL, 1) == -1)
     {
         if(doPrint)
             (*doPrint)("psnd: error while sending the data header");
 
+        if(udpfd != -1)
+            close(udpfd);
         return -1;
     }
 
     //send the actual data to the receiver
-    switch(header->stype)
+    switch(PTYPE(header->stype))
     {
         case SFILE: // send a file
             fd = (int*)structure;
-            size = header->nbelem * header->szelem;
+            size = (udpfd != -1 ? header->szelem : header->nbelem * header->szelem);
+            if(METRICS)
+                start = metrics_now();
+
+            //in datagrams, to the address and port the receiver announced (summed once
+            //  sent, the trailer or the acknowledgement only comes after them)
+            if(udpfd != -1)
+            {
+                offset = lseek(*fd, 0, SEEK_CUR);
+                if(precvudp(sockfd, size, &port) == -1 || acceptUdp(udpfd, sockfd, port) == -1
+                   || sendFileUdp(udpfd, sockfd, *fd, size, &udp) == -1)
+                {
+                    if(doPrint)
+                        (*doPrint)("psnd: error while sending the file in datagrams: %s", strerror(errno));
+
+                    ret = -1;
+                }
+                else
+                    sum = pfilesum(*fd, offset, size);
+                close(udpfd);
+
+                if(METRICS)
+                {
+                    metrics_count(MC_DGSENT, udp.sent);
+                    metrics_count(MC_DGRESENT, udp.resent);
+                }
+                break;
+            }
+
+            //let the kernel send the file, without any copy in user space or any ping-pong,
+            //  by chunks summed once sent (while their pages are still hot)
+            if(send_mode != SND_COPY)
+            {
+                offset = lseek(*fd, 0, SEEK_CUR);
+                while(sent < size)
+                {
+                    chunk = (size - sent < PSUMCHUNK ? size - sent : PSUMCHUNK);
+                    if((moved = (send_mode == SND_URING ? sendFileRing(sockfd, *fd, chunk) : sendFile(sockfd, *fd, chunk))) == -1)
+                    {
+                        if(doPrint)
+                            (*doPrint)("psnd: error while sending the file: %s", strerror(errno));
+
+                        ret = -1;
+                        break;
+                    }
+
+                    sum = paddfilesum(sum, *fd, offset + sent, moved);
+                    sent += moved;
+
+                    //file shorter than announced
+                    if((uint64_t)moved < chunk)
+                        break;
+                }
+                break;
+            }
+
             while(sent < size && ret > 0)
             {
-                if((ret = read(*fd, serialised, sizeof(serialised))) == -1)
+                //never read past the amount announced (a range may end before the file)
+                if((ret = read(*fd, serialised, (size - sent < sizeof(serialised) ? size - sent : sizeof(serialised)))) == -1)
                 {
                     if(doPrint)
                         (*doPrint)("psnd: reading the file: %s", strerror(errno));
@@ -165,6 +566,7 @@ int psnd(int sockfd, void* structure, head_t* header, void (*doPrint)(char*, ...
                 //send the data
                 if(ret != -1)
                 {
+                    sum = crc32c(sum, serialised, ret);
                     if((ret = sendData(sockfd, serialised, &ret, NULL, 1)) == -1)
                     {
                         if(doPrint)
@@ -187,6 +589,7 @@ int psnd(int sockfd, void* structure, head_t* header, void (*doPrint)(char*, ...
             do
             {
                 buffer = getdata(tmp);
+                sum = crc32c(sum, buffer, lis->elementsize);
                 if ((ret = sendData(sockfd, buffer, (int*)&lis->elementsize, NULL, 1)) == -1)
                 {
                     if(doPrint)
@@ -202,6 +605,7 @@ int psnd(int sockfd, void* structure, head_t* header, void (*doPrint)(char*, ...
 
         case SSTRING: //send a string
             buffer = (char*)structure;
+            sum = crc32c(sum, buffer, header->szelem);
             if((ret = sendData(sockfd, buffer, (int*)&header->szelem, NULL, 1)) == -1)
             {
                 if(doPrint)
@@ -214,13 +618,39 @@ int psnd(int sockfd, void* structure, head_t* header, void (*doPrint)(char*, ...
             break;
     }
 
+    //file sent : account its bytes and its throughput
+    if(METRICS && PTYPE(header->stype) == SFILE && ret != -1)
+    {
+        metrics_count(MC_SENT, size);
+        metrics_rate(size, start);
+    }
+
+    //streamed message : send the trailer, the acknowledgement comes later
+    if(header->stype & PF_STREAM)
+    {
+        if(ret != -1)
+        {
+            ret = pmktrailer(serialised, sum, size);
+            if(sendData(sockfd, serialised, &ret, NULL, 1) == -1)
+            {
+                if(doPrint)
+                    (*doPrint)("psnd: error while sending the data trailer");
+
+                ret = -1;
+            }
+        }
+
+        stream.nbmsg++;
+        stream.bytes += size;
+        return ret;
+    }
+
     //reset the header and receive the receiver's acknowlegement
     memset(serialised, 0, sizeof(serialised));
-    receiveData(sockfd, serialised, sizeof(head_t), NULL, 1);
-    unpack(serialised, HEAD_F, &header->nbelem, &header->stype, &header->szelem);
+    precvackhead(sockfd, serialised);
 
     //check if it matches the one sent by the receiver
-    if(header->szelem != size)
+    if(pchkack(serialised, header, size, sum) == -1)
     {
         if(doPrint)
             (*doPrint)("psnd: acknowlegement header does not match the data sent");
@@ -230,3 +660,1087 @@ int psnd(int sockfd, void* structure, head_t* header, void (*doPrint)(char*, ...
 
     return ret;
 }
+
+/************************************************************************/
+/*  I : serialised acknowledgement header received                      */
+/*      header to fill with the acknowledgement                         */
+/*      amount of bytes the receiver should have acknowledged           */
+/*      CRC32C of the data sent                                         */
+/*  P : Deserialises an acknowledgement header and compares it to the   */
+/*          amount of bytes actually sent, and to their CRC if the      */
+/*          receiver computed it (PF_CRC, legacy receivers do not)      */
+/*  O : -1 if the acknowledgement does not match                        */
+/*      0 otherwise                                                     */
+/************************************************************************/
+int pchkack(unsigned char* serialised, head_t* header, uint64_t size, uint32_t sum)
+{
+    punpackhead(serialised, header);
+
+    if(header->szelem != size)
+        return -1;
+
+    return ((header->stype & PF_CRC) && header->nbelem != sum ? -1 : 0);
+}
+
+/************************************************************************/
+/*  I : list to serialise                                               */
+/*      pointer to the buffer to allocate and fill                      */
+/*      amount of bytes written in the buffer                           */
+/*  P : Serialises a whole list in a single buffer, the way psnd()      */
+/*          sends it element by element                                 */
+/*  O : -1 if error                                                     */
+/*      0 otherwise                                                     */
+/************************************************************************/
+int pmklist(meta_t* lis, unsigned char** payload, uint64_t* size)
+{
+    dyndata_t* tmp = NULL;
+    unsigned char* cur = NULL;
+
+    *size = (uint64_t)lis->nbelements * lis->elementsize;
+    if((*payload = calloc(1, (*size ? *size : 1))) == NULL)
+        return -1;
+
+    //copy each element one after another
+    cur = *payload;
+    for(tmp = lis->structure ; tmp ; tmp = getright(tmp))
+    {
+        memcpy(cur, getdata(tmp), lis->elementsize);
+        cur += lis->elementsize;
+    }
+
+    return 0;
+}
+
+/************************************************************************/
+/*  I : list to serialise                                               */
+/*      pointer to the buffer to allocate and fill                      */
+/*      amount of bytes written in the buffer                           */
+/*  P : Serialises a whole list of names in a single buffer, each name  */
+/*          being prefixed by its 16-bit length instead of padded to    */
+/*          the size of an element (compact list, PF_LISTZ)             */
+/*  O : -1 if error                                                     */
+/*      0 otherwise                                                     */
+/************************************************************************/
+int pmklistz(meta_t* lis, unsigned char** payload, uint64_t* size)
+{
+    dyndata_t* tmp = NULL;
+    cursor_t cur = {0};
+    size_t len = 0;
+
+    //measure the names, then copy them one after another
+    *size = 0;
+    for(tmp = lis->structure ; tmp ; tmp = getright(tmp))
+        *size += 2 + strnlen((char*)getdata(tmp), lis->elementsize);
+
+    if((*payload = calloc(1, (*size ? *size : 1))) == NULL)
+        return -1;
+
+    cinit(&cur, *payload, *size, 0);
+    for(tmp = lis->structure ; tmp ; tmp = getright(tmp))
+    {
+        len = strnlen((char*)getdata(tmp), lis->elementsize);
+        cpack(&cur, "H", len);
+        cput(&cur, getdata(tmp), len);
+    }
+
+    return 0;
+}
+
+/************************************************************************/
+/*  I : list to serialise                                               */
+/*      cache to fill                                                   */
+/*  P : Serialises a list once (padded and compact), in a read-only     */
+/*          shared memory, so that every connection (processes forked   */
+/*          included) sends the same buffers without rebuilding them    */
+/*  O : -1 if error                                                     */
+/*      0 otherwise                                                     */
+/************************************************************************/
+int pmkcache(meta_t* lis, plist_t* cache)
+{
+    unsigned char *list = NULL;
+    uint64_t size = 0;
+    int ret = 0;
+
+    if(pmklist(lis, &list, &size) == -1)
+        return -1;
+
+    ret = pmkcachearray(list, lis->nbelements, lis->elementsize, NULL, cache);
+    free(list);
+    return ret;
+}
+
+/************************************************************************/
+/*  I : array of names to serialise (one after another, padded)         */
+/*      amount of names in the array                                    */
+/*      size of each name in the array                                  */
+/*      metadata of each name (NULL if none)                            */
+/*      cache to fill                                                   */
+/*  P : Serialises an array of names once (padded, compact, and with    */
+/*          their metadata if any), in a read-only shared memory (see   */
+/*          pmkcache())                                                 */
+/*  O : -1 if error                                                     */
+/*      0 otherwise                                                     */
+/************************************************************************/
+int pmkcachearray(const void* elements, uint32_t nbelem, uint32_t elementsize, const filemeta_t* metas, plist_t* cache)
+{
+    const char* name = NULL;
+    cursor_t cur = {0};
+    size_t len = 0;
+    uint32_t i = 0;
+
+    //measure the compact list (and the one with metadata, the same with META_SZ bytes more per name)
+    memset(cache, 0, sizeof(plist_t));
+    cache->listsz = (uint64_t)nbelem * elementsize;
+    for(i = 0, name = elements ; i < nbelem ; i++, name += elementsize)
+        cache->listzsz += 2 + strnlen(name, elementsize);
+    if(metas)
+        cache->liststatsz = cache->listzsz + (uint64_t)nbelem * META_SZ;
+
+    //map the lists one after the other
+    cache->mapsz = cache->listsz + cache->listzsz + cache->liststatsz;
+    cache->map = mmap(NULL, (cache->mapsz ? cache->mapsz : 1), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(cache->map == MAP_FAILED)
+    {
+        memset(cache, 0, sizeof(plist_t));
+        return -1;
+    }
+
+    cache->list = cache->map;
+    cache->listz = cache->map + cache->listsz;
+    memcpy(cache->list, elements, cache->listsz);
+    cinit(&cur, cache->listz, cache->listzsz, 0);
+    for(i = 0, name = elements ; i < nbelem ; i++, name += elementsize)
+    {
+        len = strnlen(name, elementsize);
+        cpack(&cur, "H", len);
+        cput(&cur, name, len);
+    }
+
+    //each name followed by its metadata
+    if(metas)
+    {
+        cache->liststat = cache->listz + cache->listzsz;
+        cinit(&cur, cache->liststat, cache->liststatsz, 0);
+        for(i = 0, name = elements ; i < nbelem ; i++, name += elementsize)
+        {
+            len = strnlen(name, elementsize);
+            cpack(&cur, "H", len);
+            cput(&cur, name, len);
+            cpack(&cur, META_F, (unsigned long long)metas[i].size, (long long)metas[i].mtime, (unsigned int)metas[i].type);
+        }
+        cache->liststatsum = crc32c(CRC32C_INIT, cache->liststat, cache->liststatsz);
+    }
+
+    cache->listsum = crc32c(CRC32C_INIT, cache->list, cache->listsz);
+    cache->listzsum = crc32c(CRC32C_INIT, cache->listz, cache->listzsz);
+    cache->nbelem = nbelem;
+    cache->elementsize = elementsize;
+
+    //the lists are immutable from now on
+    mprotect(cache->map, (cache->mapsz ? cache->mapsz : 1), PROT_READ);
+    return 0;
+}
+
+/************************************************************************/
+/*  I : cache holding the serialised lists                              */
+/*      index of the name (from 0)                                      */
+/*  P : Gives a name of the list, straight from the padded list         */
+/*  O : name, NULL if the index is out of the list                      */
+/************************************************************************/
+char* pcachename(plist_t* cache, uint32_t index)
+{
+    if(index >= cache->nbelem)
+        return NULL;
+
+    return (char*)cache->list + (uint64_t)index * cache->elementsize;
+}
+
+/************************************************************************/
+/*  I : cache to release                                                */
+/*  P : Unmaps the serialised lists of a cache                          */
+/*  O : /                                                               */
+/************************************************************************/
+void pfreecache(plist_t* cache)
+{
+    if(cache->map)
+        munmap(cache->map, (cache->mapsz ? cache->mapsz : 1));
+
+    memset(cache, 0, sizeof(plist_t));
+}
+
+/************************************************************************/
+/*  I : cache holding the serialised lists                              */
+/*      header of the list to send (flags set, the rest is filled)      */
+/*      checksum of the list chosen (filled)                            */
+/*  P : Chooses the serialised list matching the flags of the header    */
+/*          (with metadata if PF_STAT and available, compact if         */
+/*          PF_LISTZ, padded otherwise)                                 */
+/*  O : list to send (nbelem * szelem bytes)                            */
+/************************************************************************/
+unsigned char* pcachelist(plist_t* cache, head_t* header, uint32_t* sum)
+{
+    //list with metadata : a compact list, each name followed by META_F
+    if(!cache->liststat)
+        header->stype &= ~PF_STAT;
+    if(header->stype & PF_STAT)
+    {
+        header->nbelem = 1;
+        header->szelem = cache->liststatsz;
+        *sum = cache->liststatsum;
+        return cache->liststat;
+    }
+
+    //compact list : the whole payload is a single element
+    if(header->stype & PF_LISTZ)
+    {
+        header->nbelem = 1;
+        header->szelem = cache->listzsz;
+        *sum = cache->listzsum;
+        return cache->listz;
+    }
+
+    header->nbelem = cache->nbelem;
+    header->szelem = cache->elementsize;
+    *sum = cache->listsum;
+    return cache->list;
+}
+
+/************************************************************************/
+/*  I : socket to which send the list                                   */
+/*      cache holding the serialised lists                              */
+/*      header of the list to send (flags set, the rest is filled)      */
+/*      function to print error messages (can be NULL)                  */
+/*  P : Sends a list serialised in a cache, the way psnd() would        */
+/*  O : -1 if error                                                     */
+/*      1 otherwise                                                     */
+/************************************************************************/
+int psndcache(int sockfd, plist_t* cache, head_t* header, void (*doPrint)(char*, ...))
+{
+    unsigned char* payload = NULL;
+    uint32_t sum = 0;
+
+    header->stype = SLIST | PFLAGS(header->stype);
+    payload = pcachelist(cache, header, &sum);
+    return psndframe(sockfd, header, payload, sum, doPrint);
+}
+
+/************************************************************************/
+/*  I : buffer to fill with the serialised trailer                      */
+/*      checksum of the data sent                                       */
+/*      amount of bytes sent                                            */
+/*  P : Serialises the trailer sent after the data of a streamed message*/
+/*  O : size of the serialised trailer                                  */
+/************************************************************************/
+int pmktrailer(unsigned char* serialised, uint32_t sum, uint64_t size)
+{
+    head_t trailer = {0, STRAILER, 0};
+
+    trailer.nbelem = sum;
+    trailer.szelem = size;
+    return pmkhead(serialised, &trailer);
+}
+
+/************************************************************************/
+/*  I : file of which compute the checksum                              */
+/*      offset of the first byte to check                               */
+/*      amount of bytes to check                                        */
+/*  P : Computes the checksum of a part of a file (mapped in memory, so */
+/*          it can be sent afterwards without any copy)                 */
+/*  O : checksum of the data                                            */
+/************************************************************************/
+uint32_t pfilesum(int fd, uint64_t offset, uint64_t size)
+{
+    return paddfilesum(CRC32C_INIT, fd, offset, size);
+}
+
+/************************************************************************/
+/*  I : checksum of the data preceding the part of file                 */
+/*      file of which add a part to the checksum                        */
+/*      offset of the first byte to add                                 */
+/*      amount of bytes to add                                          */
+/*  P : Updates a checksum with a part of a file, mapped in memory (so  */
+/*          a part just sent by the kernel is summed from its pages)    */
+/*  O : checksum of the data and of the part of file                    */
+/************************************************************************/
+uint32_t paddfilesum(uint32_t sum, int fd, uint64_t offset, uint64_t size)
+{
+    unsigned char buffer[MAXDATASIZE] = {0}, *map = NULL;
+    uint64_t start = offset & ~((uint64_t)sysconf(_SC_PAGESIZE) - 1);
+    ssize_t ret = 0;
+
+    if(size == 0)
+        return sum;
+
+    //map the file pages (from a page boundary) and sum them
+    if((map = mmap(NULL, size + offset - start, PROT_READ, MAP_SHARED, fd, start)) != MAP_FAILED)
+    {
+        sum = crc32c(sum, map + offset - start, size);
+        munmap(map, size + offset - start);
+        return sum;
+    }
+
+    //file can't be mapped, read it
+    while(size > 0 && (ret = pread(fd, buffer, (size < sizeof(buffer) ? size : sizeof(buffer)), offset)) > 0)
+    {
+        sum = crc32c(sum, buffer, ret);
+        offset += ret;
+        size -= ret;
+    }
+
+    return sum;
+}
+
+/************************************************************************/
+/*  I : /                                                               */
+/*  P : Gives the capabilities carried by the last header received      */
+/*  O : capabilities flags (PF_*)                                       */
+/************************************************************************/
+uint32_t pflags()
+{
+    return stream.flags;
+}
+
+/************************************************************************/
+/*  I : socket to which send the hello                                  */
+/*      choice of the file to download (0 if not known yet)             */
+/*      capabilities of the client (PF_*)                               */
+/*      function to print error messages (can be NULL)                  */
+/*  P : Sends the hello header advertising the client capabilities      */
+/*  O : -1 if error                                                     */
+/*      0 otherwise                                                     */
+/************************************************************************/
+int psndhello(int sockfd, uint32_t choice, uint32_t caps, void (*doPrint)(char*, ...))
+{
+    unsigned char serialised[sizeof(head_t)] = {0};
+    head_t hello = {0, SHELLO, PVERSION};
+    int len = 0;
+
+    hello.nbelem = choice;
+    hello.stype |= PFLAGS(caps);
+    len = pmkhead(serialised, &hello);
+    if(sendData(sockfd, serialised, &len, NULL, 1) == -1)
+    {
+        if(doPrint)
+            (*doPrint)("psndhello: error while sending the hello header");
+
+        return -1;
+    }
+
+    return 0;
+}
+
+/************************************************************************/
+/*  I : socket from which receive the hello                             */
+/*      header to fill with the hello                                   */
+/*      milliseconds to wait for the hello                              */
+/*      function to print error messages (can be NULL)                  */
+/*  P : Waits for the hello header of a client, legacy clients not      */
+/*          sending any                                                 */
+/*  O : -1 if error                                                     */
+/*      0 if no hello has been received in time                         */
+/*      1 if a hello has been received                                  */
+/************************************************************************/
+int prcvhello(int sockfd, head_t* hello, int timeout, void (*doPrint)(char*, ...))
+{
+    unsigned char serialised[sizeof(head_t)] = {0};
+    struct pollfd pfd = {0};
+    int ret = 0;
+
+    //legacy clients wait for the list without sending anything
+    pfd.fd = sockfd;
+    pfd.events = POLLIN;
+    if((ret = poll(&pfd, 1, timeout)) <= 0)
+        return ret;
+
+    if(precvall(sockfd, serialised, sizeof(head_t)) <= 0)
+    {
+        if(doPrint)
+            (*doPrint)("prcvhello: error while receiving the hello header");
+
+        return -1;
+    }
+
+    return phello(serialised, hello, doPrint);
+}
+
+/************************************************************************/
+/*  I : serialised hello header received                                */
+/*      header to fill with the hello                                   */
+/*      function to print error messages (can be NULL)                  */
+/*  P : Deserialises a hello header (or a range request or a request    */
+/*          by name, which come instead of it, or the end of a kept     */
+/*          session) and keeps only the capabilities supported          */
+/*  O : -1 if the header is not a hello                                 */
+/*      1 otherwise                                                     */
+/************************************************************************/
+int phello(unsigned char* serialised, head_t* hello, void (*doPrint)(char*, ...))
+{
+    punpackhead(serialised, hello);
+    if(PTYPE(hello->stype) != SHELLO && PTYPE(hello->stype) != SRANGE && PTYPE(hello->stype) != SCLOSE
+       && PTYPE(hello->stype) != SNAME)
+    {
+        if(doPrint)
+            (*doPrint)("phello: unexpected header type %d", PTYPE(hello->stype));
+
+        return -1;
+    }
+
+    //a request by name carries the length of the name
+    if(PTYPE(hello->stype) == SNAME && (hello->nbelem == 0 || hello->nbelem > PNAMEMAX))
+    {
+        if(doPrint)
+            (*doPrint)("phello: invalid length of name %u", hello->nbelem);
+
+        return -1;
+    }
+
+    //pipelining needs the choice before the list is sent, and is useless
+    //  for a range request (a single message)
+    hello->stype &= (PF_ALL | 0x0000FFFF);
+    if(hello->nbelem == 0 || PTYPE(hello->stype) == SRANGE)
+        hello->stype &= ~PF_STREAM;
+
+    //a range request is served on a connection of its own (and over it)
+    if(PTYPE(hello->stype) == SRANGE)
+        hello->stype &= ~(PF_KEEP | PF_NOLIST | PF_UDP);
+
+    //the metadata only follow the names of a compact list
+    if(!(hello->stype & PF_LISTZ))
+        hello->stype &= ~PF_STAT;
+
+    //ranges are requested by their choice in the list
+    if(PTYPE(hello->stype) == SNAME)
+        hello->stype &= ~PF_RANGE;
+
+    //before version 3, trailers and resumed prefixes were summed with Adler-32
+    if(hello->szelem < 3)
+        hello->stype &= ~(PF_STREAM | PF_RESUME);
+
+    return 1;
+}
+
+/************************************************************************/
+/*  I : socket to which send the session acknowledgement                */
+/*      function to print error messages (can be NULL)                  */
+/*  P : Acknowledges all the messages streamed since the last session   */
+/*          acknowledgement (receiver side)                             */
+/*  O : -1 if error                                                     */
+/*      0 otherwise                                                     */
+/************************************************************************/
+int psndack(int sockfd, void (*doPrint)(char*, ...))
+{
+    unsigned char serialised[sizeof(head_t)] = {0};
+    head_t ack = {0, SACK, 0};
+    int len = 0;
+
+    ack.nbelem = stream.nbmsg;
+    ack.szelem = stream.bytes;
+    stream.nbmsg = 0;
+    stream.bytes = 0;
+
+    len = pmkhead(serialised, &ack);
+    if(sendData(sockfd, serialised, &len, NULL, 1) == -1)
+    {
+        if(doPrint)
+            (*doPrint)("psndack: error while sending the session acknowledgement");
+
+        return -1;
+    }
+
+    return 0;
+}
+
+/************************************************************************/
+/*  I : socket of the kept session to end                               */
+/*      function to print error messages (can be NULL)                  */
+/*  P : Ends a kept session : the client sends an SCLOSE header instead */
+/*          of the hello of its next request                            */
+/*  O : -1 if error                                                     */
+/*      0 otherwise                                                     */
+/************************************************************************/
+int psndclose(int sockfd, void (*doPrint)(char*, ...))
+{
+    unsigned char serialised[sizeof(head_t)] = {0};
+    head_t end = {0, SCLOSE, PVERSION};
+    int len = 0;
+
+    len = pmkhead(serialised, &end);
+    if(sendData(sockfd, serialised, &len, NULL, 1) == -1)
+    {
+        if(doPrint)
+            (*doPrint)("psndclose: error while sending the end of the session");
+
+        return -1;
+    }
+
+    return 0;
+}
+
+/************************************************************************/
+/*  I : socket to which send the request                                */
+/*      name of the file requested                                      */
+/*      capabilities of the client (PF_*)                               */
+/*      function to print error messages (can be NULL)                  */
+/*  P : Requests a file by its name, instead of a hello : the server    */
+/*          streams it without sending any list                         */
+/*  O : -1 if error                                                     */
+/*      0 otherwise                                                     */
+/************************************************************************/
+int psndname(int sockfd, char* name, uint32_t caps, void (*doPrint)(char*, ...))
+{
+    unsigned char serialised[HEAD_SZ + PNAMEMAX] = {0};
+    head_t request = {0, SNAME, PVERSION};
+    int len = 0;
+
+    if((request.nbelem = strlen(name)) == 0 || request.nbelem > PNAMEMAX)
+    {
+        if(doPrint)
+            (*doPrint)("psndname: invalid length of name %u", request.nbelem);
+
+        return -1;
+    }
+
+    //the header and the name in a single segment
+    request.stype |= PFLAGS(caps);
+    len = pmkhead(serialised, &request);
+    memcpy(serialised + len, name, request.nbelem);
+    len += request.nbelem;
+    if(sendData(sockfd, serialised, &len, NULL, 1) == -1)
+    {
+        if(doPrint)
+            (*doPrint)("psndname: error while sending the request");
+
+        return -1;
+    }
+
+    return 0;
+}
+
+/************************************************************************/
+/*  I : socket from which receive the name                              */
+/*      request by name received (length of the name)                   */
+/*      buffer to fill with the name (PNAMEMAX + 1 bytes)               */
+/*      function to print error messages (can be NULL)                  */
+/*  P : Receives the name following a request by name                   */
+/*  O : -1 if error                                                     */
+/*      0 otherwise                                                     */
+/************************************************************************/
+int prcvname(int sockfd, head_t* request, char* name, void (*doPrint)(char*, ...))
+{
+    if(precvall(sockfd, name, request->nbelem) <= 0)
+    {
+        if(doPrint)
+            (*doPrint)("prcvname: error while receiving the name requested");
+
+        return -1;
+    }
+    name[request->nbelem] = '\0';
+
+    return 0;
+}
+
+/************************************************************************/
+/*  I : socket from which receive the session acknowledgement           */
+/*      function to print error messages (can be NULL)                  */
+/*  P : Receives the session acknowledgement and checks it against all  */
+/*          the messages streamed since the last one (sender side)      */
+/*  O : -1 if error                                                     */
+/*      0 otherwise                                                     */
+/************************************************************************/
+int prcvack(int sockfd, void (*doPrint)(char*, ...))
+{
+    unsigned char serialised[sizeof(head_t)] = {0};
+    head_t ack = {0};
+    uint32_t nbmsg = stream.nbmsg;
+    uint64_t start = 0;
+
+    if(METRICS)
+        start = metrics_now();
+
+    stream.nbmsg = 0;
+    if(precvall(sockfd, serialised, sizeof(head_t)) <= 0)
+    {
+        if(doPrint)
+            (*doPrint)("prcvack: error while receiving the session acknowledgement");
+
+        return -1;
+    }
+
+    if(METRICS)
+        metrics_since(MH_ACK, &start);
+
+    if(pchkack(serialised, &ack, stream.bytes, 0) == -1 || PTYPE(ack.stype) != SACK || ack.nbelem != nbmsg)
+    {
+        if(doPrint)
+            (*doPrint)("prcvack: session acknowledgement does not match the data streamed");
+
+        stream.bytes = 0;
+        return -1;
+    }
+
+    stream.bytes = 0;
+    return 0;
+}
+
+/************************************************************************/
+/*  I : socket to which send the request                                */
+/*      choice of the file of which request a range                     */
+/*      range requested (its offset, its length and the size of the     */
+/*          file, as announced by the SRANGE reply)                     */
+/*      function to print error messages (can be NULL)                  */
+/*  P : Requests a range of a file on a new connection: an SRANGE       */
+/*          header is sent instead of the hello, followed by the range  */
+/*  O : -1 if error                                                     */
+/*      0 otherwise                                                     */
+/************************************************************************/
+int psndrange(int sockfd, uint32_t choice, range_t* range, void (*doPrint)(char*, ...))
+{
+    unsigned char serialised[HEAD_SZ + RANGE_SZ] = {0};
+    head_t request = {0, SRANGE | PF_RANGE, PVERSION};
+    int len = 0;
+
+    request.nbelem = choice;
+    len = pmkhead(serialised, &request);
+    len += pmkrange(serialised + len, range);
+    if(sendData(sockfd, serialised, &len, NULL, 1) == -1)
+    {
+        if(doPrint)
+            (*doPrint)("psndrange: error while sending the range request");
+
+        return -1;
+    }
+
+    return 0;
+}
+
+/************************************************************************/
+/*  I : socket from which receive the range                             */
+/*      range to fill                                                   */
+/*      function to print error messages (can be NULL)                  */
+/*  P : Receives the range following an SRANGE request header           */
+/*  O : -1 if error                                                     */
+/*      0 otherwise                                                     */
+/************************************************************************/
+int prcvrange(int sockfd, range_t* range, void (*doPrint)(char*, ...))
+{
+    unsigned char serialised[RANGE_SZ] = {0};
+
+    if(precvall(sockfd, serialised, RANGE_SZ) <= 0)
+    {
+        if(doPrint)
+            (*doPrint)("prcvrange: error while receiving the range requested");
+
+        return -1;
+    }
+
+    punpackrange(serialised, range);
+    return 0;
+}
+
+/************************************************************************/
+/*  I : range requested                                                 */
+/*      actual size of the file                                         */
+/*  P : Checks a range can be served from a file (the file must not     */
+/*          have changed since its size has been announced)             */
+/*  O : -1 if the range can not be served                               */
+/*      0 otherwise                                                     */
+/************************************************************************/
+int pchkrange(range_t* range, uint64_t size)
+{
+    if(range->size != size || range->offset > size || range->length > size - range->offset)
+        return -1;
+
+    return 0;
+}
+
+/************************************************************************/
+/*  I : socket from which receive the part of file                      */
+/*      file in which write the part                                    */
+/*      range requested                                                 */
+/*      function to print error messages (can be NULL)                  */
+/*  P : Receives the part of file replying to a range request, and      */
+/*          writes it in place (several parts can be received at once)  */
+/*  O : -1 if error                                                     */
+/*      0 otherwise                                                     */
+/************************************************************************/
+int prcvpart(int sockfd, int fd, range_t* range, void (*doPrint)(char*, ...))
+{
+    return precv(sockfd, &fd, range, doPrint);
+}
+
+/************************************************************************/
+/*  I : socket to which send the resume header                          */
+/*      offset from which resume the file                               */
+/*      checksum of the bytes before the offset                         */
+/*      function to print error messages (can be NULL)                  */
+/*  P : Sends a resume header: the client requests the offset of the    */
+/*          data it already has, the server replies with the one it     */
+/*          accepts (0 if the data does not match)                      */
+/*  O : -1 if error                                                     */
+/*      0 otherwise                                                     */
+/************************************************************************/
+int psndresume(int sockfd, uint64_t offset, uint32_t sum, void (*doPrint)(char*, ...))
+{
+    unsigned char serialised[HEAD_SZ] = {0};
+    head_t resume = {0, SRESUME, 0};
+    int len = 0;
+
+    resume.nbelem = sum;
+    resume.szelem = offset;
+    len = pmkhead(serialised, &resume);
+    if(sendData(sockfd, serialised, &len, NULL, 1) == -1)
+    {
+        if(doPrint)
+            (*doPrint)("psndresume: error while sending the resume header");
+
+        return -1;
+    }
+
+    return 0;
+}
+
+/************************************************************************/
+/*  I : socket from which receive the resume header                     */
+/*      header to fill with the offset and the checksum                 */
+/*      function to print error messages (can be NULL)                  */
+/*  P : Receives a resume header                                        */
+/*  O : -1 if error                                                     */
+/*      0 otherwise                                                     */
+/************************************************************************/
+int prcvresume(int sockfd, head_t* resume, void (*doPrint)(char*, ...))
+{
+    unsigned char serialised[HEAD_SZ] = {0};
+
+    if(precvall(sockfd, serialised, HEAD_SZ) <= 0)
+    {
+        if(doPrint)
+            (*doPrint)("prcvresume: error while receiving the resume header");
+
+        return -1;
+    }
+
+    punpackhead(serialised, resume);
+    if(PTYPE(resume->stype) != SRESUME)
+    {
+        if(doPrint)
+            (*doPrint)("prcvresume: unexpected header type %d", PTYPE(resume->stype));
+
+        return -1;
+    }
+
+    return 0;
+}
+
+/************************************************************************/
+/*  I : file to resume                                                  */
+/*      size of the file                                                */
+/*      resume header received from the client                          */
+/*  P : Checks the data the client already has matches the beginning    */
+/*          of the file (same checksum), and leaves in the header the   */
+/*          checksum of the bytes before the offset accepted            */
+/*  O : offset from which resume the file (0 if the data doesn't match) */
+/************************************************************************/
+uint64_t pchkresume(int fd, uint64_t size, head_t* resume)
+{
+    if(resume->szelem > 0 && resume->szelem <= size && pfilesum(fd, 0, resume->szelem) == resume->nbelem)
+        return resume->szelem;
+
+    //nothing accepted : checksum of no data
+    resume->nbelem = CRC32C_INIT;
+    return 0;
+}
+
+/************************************************************************/
+/*  I : socket from which receive the data                              */
+/*      buffer to fill                                                  */
+/*      amount of bytes to receive                                      */
+/*  P : Receives exactly the amount of bytes requested                  */
+/*  O : -1 if error                                                     */
+/*      0 if the connection has been closed                             */
+/*      amount of bytes received otherwise                              */
+/************************************************************************/
+static int precvall(int sockfd, void* buf, int len)
+{
+    int total = 0, ret = 0;
+
+    while(total < len)
+    {
+        if((ret = receiveData(sockfd, (char*)buf + total, len - total, NULL, 1)) <= 0)
+            return ret;
+
+        total += ret;
+    }
+
+    return total;
+}
+
+/************************************************************************/
+/*  I : socket to which send the list                                   */
+/*      list of names to send                                           */
+/*      header describing the list (flags)                              */
+/*      function to print error messages (can be NULL)                  */
+/*  P : Sends a list as a compact frame (PF_LISTZ): one header for the  */
+/*          whole payload of length-prefixed names                      */
+/*  O : -1 if error                                                     */
+/*      1 otherwise                                                     */
+/************************************************************************/
+static int psndlistz(int sockfd, meta_t* lis, head_t* header, void (*doPrint)(char*, ...))
+{
+    unsigned char* payload = NULL;
+    head_t frame = {1, 0, 0};
+    int ret = 0;
+
+    if(pmklistz(lis, &payload, &frame.szelem) == -1)
+    {
+        if(doPrint)
+            (*doPrint)("psnd: unable to serialise the list");
+
+        return -1;
+    }
+
+    //the whole payload is a single element
+    frame.stype = header->stype;
+    ret = psndframe(sockfd, &frame, payload, crc32c(CRC32C_INIT, payload, frame.szelem), doPrint);
+    free(payload);
+    return ret;
+}
+
+/************************************************************************/
+/*  I : socket to which send the message                                */
+/*      header of the message                                           */
+/*      payload of the message (nbelem * szelem bytes)                  */
+/*      checksum of the payload                                         */
+/*      function to print error messages (can be NULL)                  */
+/*  P : Sends a message held in memory, the header, the payload (and    */
+/*          the trailer if streamed) being gathered in a single         */
+/*          writev(), then checks its acknowledgement if not streamed   */
+/*  O : -1 if error                                                     */
+/*      1 otherwise                                                     */
+/************************************************************************/
+static int psndframe(int sockfd, head_t* frame, unsigned char* payload, uint32_t sum, void (*doPrint)(char*, ...))
+{
+    unsigned char head[HEAD_SZ] = {0}, trail[HEAD_SZ] = {0};
+    uint64_t size = (uint64_t)frame->nbelem * frame->szelem;
+    struct iovec iov[3];
+    head_t ack = {0};
+    int ret = 1;
+
+    iov[0].iov_base = head;
+    iov[0].iov_len = pmkhead(head, frame);
+    iov[1].iov_base = payload;
+    iov[1].iov_len = size;
+    iov[2].iov_base = trail;
+    iov[2].iov_len = pmktrailer(trail, sum, size);
+
+    if(sendVector(sockfd, iov, (frame->stype & PF_STREAM ? 3 : 2)) == -1)
+    {
+        if(doPrint)
+            (*doPrint)("psnd: error while sending the data: %s", strerror(errno));
+
+        ret = -1;
+    }
+
+    //streamed message : the acknowledgement comes later
+    if(frame->stype & PF_STREAM)
+    {
+        stream.nbmsg++;
+        stream.bytes += size;
+        return ret;
+    }
+
+    //receive the receiver's acknowlegement and check it
+    if(ret == -1 || precvackhead(sockfd, head) <= 0 || pchkack(head, &ack, size, sum) == -1)
+    {
+        if(doPrint)
+            (*doPrint)("psnd: acknowlegement header does not match the data sent");
+
+        return -1;
+    }
+
+    return ret;
+}
+
+/************************************************************************/
+/*  I : socket from which receive the acknowledgement                   */
+/*      buffer to fill with the serialised acknowledgement header       */
+/*  P : Receives an acknowledgement header, skipping a hello which      */
+/*          arrived after PHELLO_WAIT (the client is then served as a   */
+/*          legacy one, the hello is not an acknowledgement)            */
+/*  O : -1 if error                                                     */
+/*      0 if the connection has been closed                             */
+/*      amount of bytes received otherwise                              */
+/************************************************************************/
+static int precvackhead(int sockfd, unsigned char* serialised)
+{
+    head_t header = {0};
+    uint64_t start = 0;
+    int ret = 0;
+
+    if(METRICS)
+        start = metrics_now();
+
+    if((ret = precvall(sockfd, serialised, HEAD_SZ)) <= 0)
+        return ret;
+
+    punpackhead(serialised, &header);
+    if(PTYPE(header.stype) == SHELLO)
+        ret = precvall(sockfd, serialised, HEAD_SZ);
+
+    //time the receiver took to acknowledge the data
+    if(METRICS && ret > 0)
+        metrics_since(MH_ACK, &start);
+
+    return ret;
+}
+
+/************************************************************************/
+/*  I : decompression stream of the file                                */
+/*      file in which write the inflated data                           */
+/*      compressed data received                                        */
+/*      amount of bytes received                                        */
+/*  P : Inflates the data received and writes it in the file            */
+/*  O : -1 if error (corrupted stream, data after its end, write)       */
+/*       0 if the stream goes on                                        */
+/*       1 if the stream has ended                                      */
+/************************************************************************/
+static int pinflate(z_stream* zs, int fd, unsigned char* data, size_t len)
+{
+    unsigned char out[PZBUFSZ];
+    int ret = Z_OK;
+    size_t have = 0;
+
+    zs->next_in = data;
+    zs->avail_in = len;
+    do
+    {
+        zs->next_out = out;
+        zs->avail_out = sizeof(out);
+        ret = inflate(zs, Z_NO_FLUSH);
+        if(ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+            return -1;
+
+        have = sizeof(out) - zs->avail_out;
+        if(have && write(fd, out, have) != (ssize_t)have)
+            return -1;
+    }while(ret != Z_STREAM_END && (zs->avail_in > 0 || zs->avail_out == 0));
+
+    //nothing may follow the end of the stream
+    if(ret == Z_STREAM_END)
+        return (zs->avail_in > 0 ? -1 : 1);
+
+    return 0;
+}
+
+/************************************************************************/
+/*  I : socket from which receive the file                              */
+/*      file in which write the data                                    */
+/*      range of the file received (NULL if the whole file is sent)     */
+/*      amount of bytes to receive                                      */
+/*      amount of bytes received (updated)                              */
+/*      CRC32C of the data received (updated)                           */
+/*  P : Reserves the blocks of the file up front, then either receives  */
+/*          the data in a large page-aligned buffer written at once, or */
+/*          lets the kernel move it to the file (RCV_ZEROCOPY, the CRC  */
+/*          being computed from the pages written afterwards)           */
+/*  O : -1 if error                                                     */
+/*       1 otherwise                                                    */
+/************************************************************************/
+static int precvfile(int sockfd, int fd, range_t* range, uint64_t size, uint64_t* received, uint32_t* sum)
+{
+    uint64_t offset = (range ? range->offset : (uint64_t)lseek(fd, 0, SEEK_CUR)), want = 0;
+    unsigned char* buffer = NULL;
+    int64_t moved = 0;
+    ssize_t written = 0;
+    int ret = 1;
+
+    //reserve the blocks without changing the size of the file (a partial file stays resumable)
+    fallocate(fd, FALLOC_FL_KEEP_SIZE, offset, size);
+
+    if(recv_mode == RCV_ZEROCOPY)
+    {
+        if((moved = receiveFile(sockfd, fd, offset, size)) == -1)
+            return -1;
+
+        *received = moved;
+        *sum = pfilesum(fd, offset, moved);
+        if(!range)
+            lseek(fd, offset + moved, SEEK_SET);
+
+        return ((uint64_t)moved == size ? 1 : -1);
+    }
+
+    want = (size < PFILEBUFSZ ? size : PFILEBUFSZ);
+    if(posix_memalign((void**)&buffer, sysconf(_SC_PAGESIZE), want) != 0)
+        return -1;
+
+    while(*received < size && ret > 0)
+    {
+        //fill the buffer as much as the message allows, then write it at once
+        want = (size - *received < PFILEBUFSZ ? size - *received : PFILEBUFSZ);
+        if(precvall(sockfd, buffer, want) <= 0)
+        {
+            ret = -1;
+            break;
+        }
+
+        *sum = crc32c(*sum, buffer, want);
+        for(written = 0 ; (uint64_t)written < want && ret > 0 ; written += ret)
+        {
+            if((ret = pwrite(fd, buffer + written, want - written, offset + *received + written)) <= 0)
+                ret = -1;
+        }
+
+        if(ret > 0)
+        {
+            *received += want;
+            ret = 1;
+        }
+    }
+
+    free(buffer);
+    if(!range)
+        lseek(fd, offset + *received, SEEK_SET);
+
+    return ret;
+}
+
+/************************************************************************/
+/*  I : connection on which a file is being sent in datagrams           */
+/*      size of the file announced                                      */
+/*      port to fill with the one the receiver reports from             */
+/*  P : Receives the answer of the receiver to the header of a file     */
+/*          sent in datagrams, announcing its UDP port                  */
+/*  O : -1 if error (errno set, ECONNREFUSED if the receiver has no     */
+/*          UDP socket)                                                 */
+/*       0 otherwise                                                    */
+/************************************************************************/
+static int precvudp(int sockfd, uint64_t size, uint16_t* port)
+{
+    unsigned char serialised[sizeof(head_t)] = {0};
+    head_t announce = {0};
+    int ret = 0;
+
+    if((ret = precvall(sockfd, serialised, sizeof(head_t))) <= 0)
+    {
+        if(ret == 0)
+            errno = ECONNRESET;
+        return -1;
+    }
+
+    //the announcement must be the one of this file
+    punpackhead(serialised, &announce);
+    if(announce.stype != (SFILE | PF_UDP) || announce.szelem != size || announce.nbelem > 0xFFFF)
+    {
+        errno = EPROTO;
+        return -1;
+    }
+
+    if(announce.nbelem == 0)
+    {
+        errno = ECONNREFUSED;
+        return -1;
+    }
+
+    *port = announce.nbelem;
+    return 0;
+}
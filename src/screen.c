@@ -3,10 +3,42 @@
 ** Library regrouping screen-based functions
 ** ------------------------------------------
 ** Made by Gilles Henrard
-** Last modified : 01/11/2019
+** Last modified : 17/10/2026
 */
 #include "screen.h"
 
+typedef struct{
+    uint64_t seq;               // sequence number, telling whether the slot is free or filled
+    time_t when;                // time at which the message was logged
+    int fd;                     // file descriptor to which write the message
+    int style;                  // style of the message (NORMAL, BOLD)
+    int colour;                 // colour of the message
+    char text[SZLINE];          // message, formatted by the caller
+}logrec_t;
+
+typedef struct{
+    logrec_t slots[LOG_SLOTS];                      // messages queued
+    uint64_t tail __attribute__((aligned(64)));     // next slot claimed by a caller
+    uint64_t head __attribute__((aligned(64)));     // next slot read by the writer
+    int asleep;                 // writer waiting for messages (futex)
+    int stop;                   // writer asked to write what is left, then to stop
+    int running;                // writer started in this process
+    int mode;                   // LOG_SYNC or LOG_ASYNC
+    pthread_t thread;           // writer
+}logqueue_t;
+
+static logqueue_t logq = {.mode = LOG_SYNC};
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void plog(FILE* stream, int style, int colour, char* msg, va_list* arg);
+static int log_push(int fd, int style, int colour, char* msg, va_list* arg);
+static int log_start();
+static void log_join();
+static void log_reset();
+static void log_exit();
+static void* log_writer(void* arg);
+static void log_write(int fd, char* buffer, int* len);
+
 /************************************************************************/
 /*  I : buffer for the final message to display                         */
 /*      format string of the message                                    */
@@ -18,16 +50,17 @@ void format_output(char* final_msg, char* format, va_list* arg)
 {
     time_t timer = {0};
     char buffer[SZLINE] = {0};
-    struct tm* tm_info = {0};
+    struct tm tm_info = {0};
 
-    //get current time, and format it in the buffer
+    //get current time, and format it in the buffer (thread-safe)
     time(&timer);
-    tm_info = localtime(&timer);
-    strftime(buffer, sizeof(buffer), "%d-%m-%Y %H:%M:%S", tm_info);
+    localtime_r(&timer, &tm_info);
+    strftime(buffer, sizeof(buffer), "%d-%m-%Y %H:%M:%S", &tm_info);
     strcat(buffer, " -> ");
-    strcat(buffer, format);
+    strncat(buffer, format, sizeof(buffer) - strlen(buffer) - 1);
 
-    vsprintf(final_msg, buffer, *arg);
+    //messages longer than a line are truncated
+    vsnprintf(final_msg, SZLINE, buffer, *arg);
 }
 
 /************************************************************************/
@@ -37,14 +70,10 @@ void format_output(char* final_msg, char* format, va_list* arg)
 /************************************************************************/
 void print_success(char* msg, ...)
 {
-    char final_msg[SZLINE] = {0};
     va_list arg;
 
     va_start(arg, msg);
-
-    format_output(final_msg, msg, &arg);
-    fprintf(stdout, "\033[%d;%dm%s\033[0m\n", NORMAL, GREEN, final_msg);
-
+    plog(stdout, NORMAL, GREEN, msg, &arg);
     va_end(arg);
 }
 
@@ -55,14 +84,10 @@ void print_success(char* msg, ...)
 /************************************************************************/
 void print_error(char* msg, ...)
 {
-    char final_msg[SZLINE] = {0};
     va_list arg;
 
     va_start(arg, msg);
-
-    format_output(final_msg, msg, &arg);
-    fprintf(stderr, "\033[%d;%dm%s\033[0m\n", BOLD, RED, final_msg);
-
+    plog(stderr, BOLD, RED, msg, &arg);
     va_end(arg);
 }
 
@@ -73,16 +98,296 @@ void print_error(char* msg, ...)
 /************************************************************************/
 void print_neutral(char* msg, ...)
 {
-    char final_msg[SZLINE] = {0};
     va_list arg;
 
     va_start(arg, msg);
+    plog(stdout, NORMAL, RESET, msg, &arg);
+    va_end(arg);
+}
 
-    format_output(final_msg, msg, &arg);
-    fprintf(stdout, "\033[%d;%dm%s\033[0m\n", NORMAL, RESET, final_msg);
+/************************************************************************/
+/*  I : way messages are displayed (LOG_SYNC or LOG_ASYNC)              */
+/*  P : Sets the way messages are displayed : in the asynchronous mode, */
+/*          they are queued and a background thread writes them by      */
+/*          batches (what is queued is written when going back to the   */
+/*          synchronous mode, and at exit)                              */
+/*  O : previous mode                                                   */
+/************************************************************************/
+int setlogmode(int mode)
+{
+    static int registered = 0;
+    int previous = logq.mode;
 
-    va_end(arg);
+    if(mode == LOG_ASYNC && previous != LOG_ASYNC)
+    {
+        //whatever was printed synchronously comes first
+        fflush(stdout);
+        fflush(stderr);
+
+        if(!registered)
+        {
+            log_reset();
+            pthread_atfork(NULL, NULL, log_reset);
+            atexit(log_exit);
+            registered = 1;
+        }
+    }
+
+    logq.mode = mode;
+
+    if(mode != LOG_ASYNC && previous == LOG_ASYNC)
+        log_join();
+
+    return previous;
+}
+
+/************************************************************************/
+/*  I : stream on which display the message                             */
+/*      style and colour of the message                                 */
+/*      format string of the message                                    */
+/*      additional parameters of the message                            */
+/*  P : Queues the message in the asynchronous mode, or displays it     */
+/*  O : /                                                               */
+/************************************************************************/
+static void plog(FILE* stream, int style, int colour, char* msg, va_list* arg)
+{
+    char final_msg[SZLINE] = {0};
+
+    if(logq.mode == LOG_ASYNC && log_push(fileno(stream), style, colour, msg, arg) == 0)
+        return;
+
+    format_output(final_msg, msg, arg);
+    fprintf(stream, "\033[%d;%dm%s\033[0m\n", style, colour, final_msg);
+}
+
+/************************************************************************/
+/*  I : file descriptor to which write the message                      */
+/*      style and colour of the message                                 */
+/*      format string of the message                                    */
+/*      additional parameters of the message                            */
+/*  P : Claims a slot of the queue, without any lock (waiting for the   */
+/*          writer if it is full), and fills it with the message        */
+/*  O : -1 if the writer couldn't be started (nothing queued)           */
+/*       0 otherwise                                                    */
+/************************************************************************/
+static int log_push(int fd, int style, int colour, char* msg, va_list* arg)
+{
+    logrec_t* rec = NULL;
+    uint64_t pos = 0, seq = 0;
+
+    if(!__atomic_load_n(&logq.running, __ATOMIC_ACQUIRE) && log_start() == -1)
+        return -1;
+
+    //a slot is free for the position when its sequence number equals it
+    pos = __atomic_load_n(&logq.tail, __ATOMIC_RELAXED);
+    while(1)
+    {
+        rec = &logq.slots[pos & (LOG_SLOTS - 1)];
+        seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+
+        if(seq == pos)
+        {
+            if(__atomic_compare_exchange_n(&logq.tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if((int64_t)(seq - pos) < 0)
+        {
+            //queue full : let the writer catch up
+            sched_yield();
+            pos = __atomic_load_n(&logq.tail, __ATOMIC_RELAXED);
+        }
+        else
+            pos = __atomic_load_n(&logq.tail, __ATOMIC_RELAXED);
+    }
+
+    rec->when = time(NULL);
+    rec->fd = fd;
+    rec->style = style;
+    rec->colour = colour;
+    vsnprintf(rec->text, SZLINE, msg, *arg);
+    __atomic_store_n(&rec->seq, pos + 1, __ATOMIC_SEQ_CST);
+
+    //wake the writer up if it waits for messages
+    if(__atomic_exchange_n(&logq.asleep, 0, __ATOMIC_SEQ_CST))
+        syscall(SYS_futex, &logq.asleep, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+
+    return 0;
+}
+
+/************************************************************************/
+/*  I : /                                                               */
+/*  P : Starts the writer of the calling process, if not running yet    */
+/*  O : -1 on error                                                     */
+/*       0 otherwise                                                    */
+/************************************************************************/
+static int log_start()
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&log_lock);
+
+    if(!logq.running)
+    {
+        if(pthread_create(&logq.thread, NULL, log_writer, NULL) != 0)
+            ret = -1;
+        else
+            __atomic_store_n(&logq.running, 1, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_unlock(&log_lock);
+    return ret;
 }
 
+/************************************************************************/
+/*  I : /                                                               */
+/*  P : Has the writer write what is left in the queue, then waits for  */
+/*          it to stop                                                  */
+/*  O : /                                                               */
+/************************************************************************/
+static void log_join()
+{
+    pthread_mutex_lock(&log_lock);
+
+    if(logq.running)
+    {
+        __atomic_store_n(&logq.stop, 1, __ATOMIC_SEQ_CST);
+        if(__atomic_exchange_n(&logq.asleep, 0, __ATOMIC_SEQ_CST))
+            syscall(SYS_futex, &logq.asleep, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+
+        pthread_join(logq.thread, NULL);
+        logq.running = 0;
+        logq.stop = 0;
+    }
 
+    pthread_mutex_unlock(&log_lock);
+}
+
+/************************************************************************/
+/*  I : /                                                               */
+/*  P : Empties the queue of a forked child (the messages left belong   */
+/*          to its parent), which starts its own writer when needed     */
+/*  O : /                                                               */
+/************************************************************************/
+static void log_reset()
+{
+    uint64_t i = 0;
+
+    for(i = 0 ; i < LOG_SLOTS ; i++)
+        logq.slots[i].seq = i;
+
+    logq.tail = 0;
+    logq.head = 0;
+    logq.asleep = 0;
+    logq.stop = 0;
+    logq.running = 0;
+    pthread_mutex_init(&log_lock, NULL);
+}
+
+/************************************************************************/
+/*  I : /                                                               */
+/*  P : Writes what is left in the queue when the process exits         */
+/*  O : /                                                               */
+/************************************************************************/
+static void log_exit()
+{
+    setlogmode(LOG_SYNC);
+}
 
+/************************************************************************/
+/*  I : /                                                               */
+/*  P : Formats the messages queued, and writes them by batches when    */
+/*          the queue is empty or a buffer is full (the time is         */
+/*          formatted once per second)                                  */
+/*  O : /                                                               */
+/************************************************************************/
+static void* log_writer(void* arg __attribute__((unused)))
+{
+    struct timespec timeout = {.tv_sec = 1};
+    char out[LOG_BATCH], err[LOG_BATCH], stamp[32] = {0};
+    int outlen = 0, errlen = 0, *len = NULL;
+    logrec_t* rec = NULL;
+    time_t stamped = -1;
+    struct tm tm_info = {0};
+    char* buffer = NULL;
+
+    while(1)
+    {
+        rec = &logq.slots[logq.head & (LOG_SLOTS - 1)];
+
+        //queue empty : write the batches, then wait for messages
+        if(__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != logq.head + 1)
+        {
+            log_write(STDOUT_FILENO, out, &outlen);
+            log_write(STDERR_FILENO, err, &errlen);
+
+            __atomic_store_n(&logq.asleep, 1, __ATOMIC_SEQ_CST);
+            if(__atomic_load_n(&rec->seq, __ATOMIC_SEQ_CST) == logq.head + 1)
+            {
+                __atomic_store_n(&logq.asleep, 0, __ATOMIC_RELAXED);
+                continue;
+            }
+
+            if(__atomic_load_n(&logq.stop, __ATOMIC_SEQ_CST))
+                break;
+
+            syscall(SYS_futex, &logq.asleep, FUTEX_WAIT_PRIVATE, 1, &timeout, NULL, 0);
+            __atomic_store_n(&logq.asleep, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        if(rec->when != stamped)
+        {
+            localtime_r(&rec->when, &tm_info);
+            strftime(stamp, sizeof(stamp), "%d-%m-%Y %H:%M:%S", &tm_info);
+            stamped = rec->when;
+        }
+
+        if(rec->fd == STDERR_FILENO)
+        {
+            buffer = err;
+            len = &errlen;
+        }
+        else
+        {
+            buffer = out;
+            len = &outlen;
+        }
+
+        //room for the longest line
+        if(*len > LOG_BATCH - SZLINE * 2)
+            log_write(rec->fd, buffer, len);
+
+        *len += snprintf(buffer + *len, LOG_BATCH - *len, "\033[%d;%dm%s -> %s\033[0m\n", rec->style, rec->colour, stamp, rec->text);
+
+        //give the slot back to the callers
+        __atomic_store_n(&rec->seq, logq.head + LOG_SLOTS, __ATOMIC_RELEASE);
+        logq.head++;
+    }
+
+    return NULL;
+}
+
+/************************************************************************/
+/*  I : file descriptor to which write                                  */
+/*      buffer to write                                                 */
+/*      length of the buffer (reset)                                    */
+/*  P : Writes a whole batch of messages                                */
+/*  O : /                                                               */
+/************************************************************************/
+static void log_write(int fd, char* buffer, int* len)
+{
+    int done = 0, ret = 0;
+
+    while(done < *len)
+    {
+        if((ret = write(fd, buffer + done, *len - done)) == -1)
+        {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+        done += ret;
+    }
+
+    *len = 0;
+}
@@ -4,9 +4,21 @@
 ** ------------------------------------------
 ** Based on Brian 'Beej Jorgensen' Hall's code
 ** Modified by Gilles Henrard
-** Last modified : 14/11/2019
+** Last modified : 17/10/2026
 */
 #include "serialisation.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SWAP_X86
+#endif
+
+typedef void (*swapper_t)(unsigned char*, const unsigned char*, size_t, unsigned int);
+static void swap_scalar(unsigned char *dst, const unsigned char *src, size_t n, unsigned int width);
+static swapper_t swapper = swap_scalar;
+
+static unsigned int vpack(unsigned char *buf, char *format, va_list ap);
+static void vunpack(unsigned char *buf, char *format, va_list ap);
+static int fieldsize(char code);
 
 /****************************************************************/
 /*  I : floating point value to encode                          */
@@ -17,44 +29,33 @@ uint64_t pack754(long double f, unsigned bits, unsigned expbits)
 {
     long double fnorm;
     int shift;
-    long long sign, exp, significand;
+    uint64_t sign, exp, significand;
     unsigned significandbits = bits - expbits - 1; // -1 for sign bit
-    if (f == 0.0) return 0; // get this special case out of the way
+    uint64_t expmax = (1ULL<<expbits) - 1;
+    long long bias = (1LL<<(expbits-1)) - 1;
 
-    // check sign and begin normalization
-    if (f < 0)
-    {
-        sign = 1;
-        fnorm = -f;
-    }
-    else
-    {
-        sign = 0;
-        fnorm = f;
-    }
+    // get the special cases out of the way
+    sign = (uint64_t)(signbit(f) ? 1 : 0) << (bits-1);
+    if (isnan(f)) return sign | (expmax<<significandbits) | (1ULL<<(significandbits-1));
+    if (isinf(f)) return sign | (expmax<<significandbits);
+    if (f == 0.0) return sign;
 
-    // get the normalized form of f and track the exponent
-    shift = 0;
-    while(fnorm >= 2.0)
-    {
-        fnorm /= 2.0;
-        shift++;
-    }
-    while(fnorm < 1.0)
-    {
-        fnorm *= 2.0;
-        shift--;
-    }
-    fnorm = fnorm - 1.0;
+    // get the normalized form of f ([1.0; 2.0[) and its exponent
+    fnorm = frexpl(fabsl(f), &shift) * 2.0;
+    shift--;
 
-    // calculate the binary form (non-float) of the significand data
-    significand = fnorm * ((1LL<<significandbits) + 0.5f);
+    // subnormal numbers : no implicit one, fixed exponent
+    if (shift + bias <= 0)
+        return sign | (uint64_t)llroundl(ldexpl(fabsl(f), bias - 1 + significandbits));
 
-    // get the biased exponent
-    exp = shift + ((1<<(expbits-1)) - 1); // shift + bias
+    // calculate the binary form (non-float) of the significand data, rounded
+    //  (a rounding carry goes in the exponent, and may give an infinity)
+    significand = (uint64_t)llroundl((fnorm - 1.0) * (1ULL<<significandbits));
+    exp = shift + bias;
+    if (exp >= expmax) return sign | (expmax<<significandbits);
 
     // return the final answer
-    return (sign<<(bits-1)) | (exp<<(bits-expbits-1)) | significand;
+    return sign | ((exp<<significandbits) + significand);
 }
 
 /****************************************************************/
@@ -65,33 +66,24 @@ uint64_t pack754(long double f, unsigned bits, unsigned expbits)
 long double unpack754(uint64_t i, unsigned bits, unsigned expbits)
 {
     long double result;
-    long long shift;
-    unsigned bias;
     unsigned significandbits = bits - expbits - 1; // -1 for sign bit
-    if (i == 0) return 0.0;
-
-    // pull the significand
-    result = (i&((1LL<<significandbits)-1)); // mask
-    result /= (1LL<<significandbits); // convert back to float
-    result += 1.0f; // add the one back on
+    uint64_t expmax = (1ULL<<expbits) - 1;
+    long long bias = (1LL<<(expbits-1)) - 1;
+    uint64_t significand = i & ((1ULL<<significandbits) - 1);
+    uint64_t exp = (i>>significandbits) & expmax;
 
-    // deal with the exponent
-    bias = (1<<(expbits-1)) - 1;
-    shift = ((i>>significandbits)&((1LL<<expbits)-1)) - bias;
-    while(shift > 0)
-    {
-        result *= 2.0;
-        shift--;
-    }
-    while(shift < 0)
-    {
-        result /= 2.0;
-        shift++;
-    }
+    // infinities and NaN
+    if (exp == expmax)
+        result = significand ? NAN : INFINITY;
+    // subnormal numbers (no implicit one)
+    else if (exp == 0)
+        result = ldexpl(significand, 1 - bias - significandbits);
+    // normal numbers (implicit one added back on)
+    else
+        result = ldexpl(significand | (1ULL<<significandbits), exp - bias - significandbits);
 
     // sign it
-    result *= (i>>(bits-1))&1? -1.0: 1.0;
-    return result;
+    return (i>>(bits-1))&1 ? -result : result;
 }
 
 /****************************************************************/
@@ -269,6 +261,19 @@ unsigned long long int unpacku64(unsigned char *buf)
 unsigned int pack(unsigned char *buf, char *format, ...)
 {
     va_list ap;
+    unsigned int size = 0;
+
+    va_start(ap, format);
+    size = vpack(buf, format, ap);
+    va_end(ap);
+    return size;
+}
+
+/*
+** vpack() -- pack(), with the values given as a va_list
+*/
+static unsigned int vpack(unsigned char *buf, char *format, va_list ap)
+{
     signed char c;
     unsigned char C; // 8-bit
     int h;
@@ -288,7 +293,6 @@ unsigned int pack(unsigned char *buf, char *format, ...)
 
     // strings
     unsigned int size = 0;
-    va_start(ap, format);
     for(; *format != '\0'; format++)
     {
         switch(*format)
@@ -371,7 +375,6 @@ unsigned int pack(unsigned char *buf, char *format, ...)
             break;
         }
     }
-    va_end(ap);
     return size;
 }
 
@@ -392,6 +395,17 @@ unsigned int pack(unsigned char *buf, char *format, ...)
 void unpack(unsigned char *buf, char *format, ...)
 {
     va_list ap;
+
+    va_start(ap, format);
+    vunpack(buf, format, ap);
+    va_end(ap);
+}
+
+/*
+** vunpack() -- unpack(), with the destinations given as a va_list
+*/
+static void vunpack(unsigned char *buf, char *format, va_list ap)
+{
     signed char *c;
     unsigned char *C; // 8-bit
     int *h;
@@ -408,7 +422,6 @@ void unpack(unsigned char *buf, char *format, ...)
     unsigned long long int fhold;
     char *s;
     unsigned int len, maxstrlen=0, count;
-    va_start(ap, format);
     for(; *format != '\0'; format++)
     {
         switch(*format)
@@ -495,5 +508,533 @@ void unpack(unsigned char *buf, char *format, ...)
         }
         if (!isdigit(*format)) maxstrlen = 0;
     }
+}
+
+/*
+** compile_format() -- parse a format once, so it can be reused by
+**  packf() and unpackf() without being interpreted again
+**
+** Only the fixed-size integer codes are supported (c, C, h, H, l, L,
+**  q and Q, see pack())
+*/
+int compile_format(packfmt_t* fmt, char* format)
+{
+    memset(fmt, 0, sizeof(packfmt_t));
+    for(; *format != '\0'; format++)
+    {
+        if(fmt->nbfields >= PACKMAX)
+            return -1;
+
+        switch(*format)
+        {
+        case 'c': // 8-bit
+        case 'C':
+            fmt->sizes[fmt->nbfields] = 1;
+            break;
+        case 'h': // 16-bit
+        case 'H':
+            fmt->sizes[fmt->nbfields] = 2;
+            break;
+        case 'l': // 32-bit
+        case 'L':
+            fmt->sizes[fmt->nbfields] = 4;
+            break;
+        case 'q': // 64-bit
+        case 'Q':
+            fmt->sizes[fmt->nbfields] = 8;
+            break;
+        default: // floats and strings can't be compiled
+            return -1;
+        }
+
+        fmt->codes[fmt->nbfields] = *format;
+        fmt->size += fmt->sizes[fmt->nbfields];
+        fmt->nbfields++;
+    }
+
+    return 0;
+}
+
+/*
+** packf() -- store the values in the buffer, as dictated by a compiled
+**  format (one value per field, whatever its size)
+*/
+unsigned int packf(unsigned char *buf, packfmt_t* fmt, uint64_t* values)
+{
+    unsigned int i;
+
+    for(i = 0; i < fmt->nbfields; i++)
+    {
+        switch(fmt->sizes[i])
+        {
+        case 1:
+            *buf = (unsigned char)values[i];
+            break;
+        case 2:
+            storeu16(buf, (uint16_t)values[i]);
+            break;
+        case 4:
+            storeu32(buf, (uint32_t)values[i]);
+            break;
+        case 8:
+            storeu64(buf, values[i]);
+            break;
+        }
+        buf += fmt->sizes[i];
+    }
+
+    return fmt->size;
+}
+
+/*
+** unpackf() -- unpack the buffer in the values, as dictated by a compiled
+**  format (signed fields are sign-extended to 64 bits)
+*/
+void unpackf(unsigned char *buf, packfmt_t* fmt, uint64_t* values)
+{
+    unsigned int i;
+
+    for(i = 0; i < fmt->nbfields; i++)
+    {
+        switch(fmt->codes[i])
+        {
+        case 'c': // 8-bit
+            values[i] = (uint64_t)(int64_t)(int8_t)*buf;
+            break;
+        case 'C': // 8-bit unsigned
+            values[i] = *buf;
+            break;
+        case 'h': // 16-bit
+            values[i] = (uint64_t)(int64_t)(int16_t)loadu16(buf);
+            break;
+        case 'H': // 16-bit unsigned
+            values[i] = loadu16(buf);
+            break;
+        case 'l': // 32-bit
+            values[i] = (uint64_t)(int64_t)(int32_t)loadu32(buf);
+            break;
+        case 'L': // 32-bit unsigned
+            values[i] = loadu32(buf);
+            break;
+        default: // 64-bit
+            values[i] = loadu64(buf);
+            break;
+        }
+        buf += fmt->sizes[i];
+    }
+}
+
+/*
+** Cursors : a buffer with its capacity, the amount of bytes available in
+**  it and a position, so that records can be packed without overflowing
+**  the buffer, and unpacked as soon as their bytes are available (e.g.
+**  when they are received from a socket piece by piece)
+*/
+
+/****************************************************************/
+/*  I : cursor to initialise                                    */
+/*      buffer on which the cursor works                        */
+/*      capacity of the buffer                                  */
+/*      amount of bytes already available in the buffer         */
+/*  P : Sets a cursor at the beginning of a buffer              */
+/*  O : /                                                       */
+/****************************************************************/
+void cinit(cursor_t* cur, void* buf, size_t cap, size_t len)
+{
+    cur->buf = (unsigned char*)buf;
+    cur->cap = cap;
+    cur->len = (len > cap ? cap : len);
+    cur->pos = 0;
+    cur->need = 0;
+}
+
+/****************************************************************/
+/*  I : cursor to update                                        */
+/*      amount of bytes written after the available ones        */
+/*          (e.g. by recv(cur->buf + cur->len, ...))            */
+/*  P : Makes the bytes written in the buffer available         */
+/*  O : /                                                       */
+/****************************************************************/
+void cfeed(cursor_t* cur, size_t n)
+{
+    cur->len += n;
+    if(cur->len > cur->cap)
+        cur->len = cur->cap;
+}
+
+/****************************************************************/
+/*  I : cursor to update                                        */
+/*  P : Moves the bytes not read yet at the beginning of the    */
+/*          buffer, to make room for the next ones              */
+/*  O : /                                                       */
+/****************************************************************/
+void ccompact(cursor_t* cur)
+{
+    if(cur->pos == 0)
+        return;
+
+    memmove(cur->buf, cur->buf + cur->pos, cur->len - cur->pos);
+    cur->len -= cur->pos;
+    cur->pos = 0;
+}
+
+/****************************************************************/
+/*  I : code of a field (as in pack())                          */
+/*  P : Gives the serialised size of a fixed-size field         */
+/*  O : size of the field, 0 if it is not a fixed-size field    */
+/****************************************************************/
+static int fieldsize(char code)
+{
+    switch(code)
+    {
+    case 'c':
+    case 'C':
+        return 1;
+    case 'h':
+    case 'H':
+    case 'f':
+        return 2;
+    case 'l':
+    case 'L':
+    case 'd':
+        return 4;
+    case 'q':
+    case 'Q':
+    case 'g':
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+/*
+** cpack() -- store the values in the cursor, as dictated by the format
+**  (see pack()), only if they all fit in the room left
+**
+** Returns the amount of bytes written, or -1 (nothing written and
+**  cur->need set to the bytes missing)
+*/
+int cpack(cursor_t* cur, char* format, ...)
+{
+    va_list ap, measure;
+    size_t size = 0;
+    char* f = NULL;
+
+    //measure the record (strings are measured with their length prefix)
+    va_start(ap, format);
+    va_copy(measure, ap);
+    for(f = format; *f != '\0'; f++)
+    {
+        switch(*f)
+        {
+        case 's':
+            size += 2 + strlen(va_arg(measure, char*));
+            break;
+        case 'f':
+        case 'd':
+            size += fieldsize(*f);
+            (void)va_arg(measure, double);
+            break;
+        case 'g':
+            size += 8;
+            (void)va_arg(measure, long double);
+            break;
+        case 'q':
+        case 'Q':
+            size += 8;
+            (void)va_arg(measure, unsigned long long int);
+            break;
+        case 'l':
+        case 'L':
+            size += 4;
+            (void)va_arg(measure, unsigned long int);
+            break;
+        default:
+            if(fieldsize(*f))
+            {
+                size += fieldsize(*f);
+                (void)va_arg(measure, unsigned int);
+            }
+            break;
+        }
+    }
+    va_end(measure);
+
+    if(cur->pos + size > cur->cap)
+    {
+        cur->need = cur->pos + size - cur->cap;
+        va_end(ap);
+        return -1;
+    }
+
+    vpack(cur->buf + cur->pos, format, ap);
+    va_end(ap);
+    cur->pos += size;
+    if(cur->len < cur->pos)
+        cur->len = cur->pos;
+    cur->need = 0;
+    return size;
+}
+
+/*
+** cunpack() -- unpack a record from the cursor in the destinations, as
+**  dictated by the format (see unpack()), only if all its bytes are
+**  available
+**
+** Returns the amount of bytes read, or 0 (nothing read and cur->need set
+**  to the minimum amount of bytes still missing)
+*/
+int cunpack(cursor_t* cur, char* format, ...)
+{
+    va_list ap;
+    size_t size = 0, avail = cur->len - cur->pos;
+    char* f = NULL;
+
+    //measure the record (strings need their length prefix to be available)
+    for(f = format; *f != '\0'; f++)
+    {
+        if(*f == 's')
+        {
+            if(size + 2 > avail)
+                break;
+            size += 2 + loadu16(cur->buf + cur->pos + size);
+        }
+        else
+            size += fieldsize(*f);
+    }
+
+    if(*f == 's' || size > avail)
+    {
+        cur->need = (*f == 's' ? size + 2 : size) - avail;
+        return 0;
+    }
+
+    va_start(ap, format);
+    vunpack(cur->buf + cur->pos, format, ap);
     va_end(ap);
+    cur->pos += size;
+    cur->need = 0;
+    return size;
+}
+
+/****************************************************************/
+/*  I : cursor from which read                                  */
+/*      amount of bytes to read                                 */
+/*  P : Reads a raw record in place (no copy)                   */
+/*  O : address of the record in the buffer                     */
+/*      NULL if not available yet (cur->need set)               */
+/****************************************************************/
+unsigned char* ctake(cursor_t* cur, size_t n)
+{
+    unsigned char* data = NULL;
+
+    if(cur->pos + n > cur->len)
+    {
+        cur->need = cur->pos + n - cur->len;
+        return NULL;
+    }
+
+    data = cur->buf + cur->pos;
+    cur->pos += n;
+    cur->need = 0;
+    return data;
 }
+
+/****************************************************************/
+/*  I : cursor in which write                                   */
+/*      raw data to write                                       */
+/*      amount of bytes to write                                */
+/*  P : Writes raw data, only if it fits in the room left       */
+/*  O : -1 if it does not fit (cur->need set)                   */
+/*       0 otherwise                                            */
+/****************************************************************/
+int cput(cursor_t* cur, const void* data, size_t n)
+{
+    if(cur->pos + n > cur->cap)
+    {
+        cur->need = cur->pos + n - cur->cap;
+        return -1;
+    }
+
+    memcpy(cur->buf + cur->pos, data, n);
+    cur->pos += n;
+    if(cur->len < cur->pos)
+        cur->len = cur->pos;
+    cur->need = 0;
+    return 0;
+}
+
+/*
+** Batch byte-swapping : the network order being big-endian, packing or
+**  unpacking an array of integers is the same byte swap of each element,
+**  done by a scalar loop or by SIMD shuffles, chosen at load time
+*/
+
+/****************************************************************/
+/*  I : destination buffer                                      */
+/*      source buffer                                           */
+/*      amount of integers to swap                              */
+/*      size of each integer (2, 4 or 8 bytes)                  */
+/*  P : Swaps the byte order of each integer, one at a time     */
+/*  O : /                                                       */
+/****************************************************************/
+static void swap_scalar(unsigned char *dst, const unsigned char *src, size_t n, unsigned int width)
+{
+    uint16_t h;
+    uint32_t l;
+    uint64_t q;
+    size_t i;
+
+    switch(width)
+    {
+    case 2:
+        for(i = 0; i < n; i++)
+        {
+            memcpy(&h, src + 2*i, sizeof(h));
+            storeu16(dst + 2*i, h);
+        }
+        break;
+    case 4:
+        for(i = 0; i < n; i++)
+        {
+            memcpy(&l, src + 4*i, sizeof(l));
+            storeu32(dst + 4*i, l);
+        }
+        break;
+    default:
+        for(i = 0; i < n; i++)
+        {
+            memcpy(&q, src + 8*i, sizeof(q));
+            storeu64(dst + 8*i, q);
+        }
+        break;
+    }
+}
+
+#ifdef SWAP_X86
+/****************************************************************/
+/*  I : size of each integer (2, 4 or 8 bytes)                  */
+/*  P : Gives the shuffle reversing the bytes of each integer   */
+/*          in a 16-bytes lane                                  */
+/*  O : shuffle mask                                            */
+/****************************************************************/
+__attribute__((target("ssse3")))
+static __m128i swap_mask(unsigned int width)
+{
+    switch(width)
+    {
+    case 2:
+        return _mm_setr_epi8(1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14);
+    case 4:
+        return _mm_setr_epi8(3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12);
+    default:
+        return _mm_setr_epi8(7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8);
+    }
+}
+
+/****************************************************************/
+/*  I : destination buffer                                      */
+/*      source buffer                                           */
+/*      amount of integers to swap                              */
+/*      size of each integer (2, 4 or 8 bytes)                  */
+/*  P : Swaps the byte order of each integer, 16 bytes at a     */
+/*          time, then finishes the tail with the scalar loop   */
+/*  O : /                                                       */
+/****************************************************************/
+__attribute__((target("ssse3")))
+static void swap_ssse3(unsigned char *dst, const unsigned char *src, size_t n, unsigned int width)
+{
+    __m128i mask = swap_mask(width);
+    size_t bytes = n * width, i = 0;
+
+    for(i = 0; i + 16 <= bytes; i += 16)
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + i)), mask));
+
+    swap_scalar(dst + i, src + i, (bytes - i) / width, width);
+}
+
+/****************************************************************/
+/*  I : destination buffer                                      */
+/*      source buffer                                           */
+/*      amount of integers to swap                              */
+/*      size of each integer (2, 4 or 8 bytes)                  */
+/*  P : Swaps the byte order of each integer, 32 bytes at a     */
+/*          time (the shuffle stays within each 16-bytes lane), */
+/*          then finishes the tail with the scalar loop         */
+/*  O : /                                                       */
+/****************************************************************/
+__attribute__((target("avx2")))
+static void swap_avx2(unsigned char *dst, const unsigned char *src, size_t n, unsigned int width)
+{
+    __m256i mask = _mm256_broadcastsi128_si256(swap_mask(width));
+    size_t bytes = n * width, i = 0;
+
+    for(i = 0; i + 32 <= bytes; i += 32)
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(src + i)), mask));
+
+    swap_scalar(dst + i, src + i, (bytes - i) / width, width);
+}
+#endif
+
+/****************************************************************/
+/*  I : kernel to use (SWAP_AUTO, SWAP_SCALAR, SWAP_SSSE3 or    */
+/*          SWAP_AVX2)                                          */
+/*  P : Sets the kernel used by the batch (un)packing functions */
+/*  O : -1 if the kernel is unknown or not supported by the CPU */
+/*       0 otherwise                                            */
+/****************************************************************/
+int setswapkernel(int kernel)
+{
+    switch(kernel)
+    {
+    case SWAP_SCALAR:
+        swapper = swap_scalar;
+        return 0;
+
+#ifdef SWAP_X86
+    case SWAP_SSSE3:
+        __builtin_cpu_init();
+        if(!__builtin_cpu_supports("ssse3"))
+            return -1;
+        swapper = swap_ssse3;
+        return 0;
+
+    case SWAP_AVX2:
+        __builtin_cpu_init();
+        if(!__builtin_cpu_supports("avx2"))
+            return -1;
+        swapper = swap_avx2;
+        return 0;
+#endif
+
+    case SWAP_AUTO:
+        if(setswapkernel(SWAP_AVX2) == -1 && setswapkernel(SWAP_SSSE3) == -1)
+            swapper = swap_scalar;
+        return 0;
+
+    default:
+        return -1;
+    }
+}
+
+/****************************************************************/
+/*  I : /                                                       */
+/*  P : Picks the best batch kernel when the library is loaded  */
+/*  O : /                                                       */
+/****************************************************************/
+__attribute__((constructor))
+static void init_swapkernel()
+{
+    setswapkernel(SWAP_AUTO);
+}
+
+/*
+** packaN() -- store an array of N-bit integers in a char buffer (network order)
+** unpackaN() -- unpack an array of N-bit integers from a char buffer
+*/
+void packa16(unsigned char *buf, const uint16_t* values, size_t n){ (*swapper)(buf, (const unsigned char*)values, n, 2); }
+void packa32(unsigned char *buf, const uint32_t* values, size_t n){ (*swapper)(buf, (const unsigned char*)values, n, 4); }
+void packa64(unsigned char *buf, const uint64_t* values, size_t n){ (*swapper)(buf, (const unsigned char*)values, n, 8); }
+void unpacka16(uint16_t* values, const unsigned char *buf, size_t n){ (*swapper)((unsigned char*)values, buf, n, 2); }
+void unpacka32(uint32_t* values, const unsigned char *buf, size_t n){ (*swapper)((unsigned char*)values, buf, n, 4); }
+void unpacka64(uint64_t* values, const unsigned char *buf, size_t n){ (*swapper)((unsigned char*)values, buf, n, 8); }
@@ -0,0 +1,263 @@
+/*
+** zcache.c
+** Library regrouping the compressed files cache functions
+** ------------------------------------------
+** Made by Gilles Henrard
+** Last modified : 17/10/2026
+*/
+#include "zcache.h"
+
+typedef struct{
+    int src;                        // file to compress
+    int tmp;                        // compressed file being built
+    struct timespec mtime;          // modification time of the file compressed
+    char entry[PATH_MAX];           // path of the compressed file
+    char tmppath[PATH_MAX];         // path of the compressed file being built
+}zc_job_t;
+
+static int zc_paths(char* path, char* dir, zc_job_t* job);
+static int zc_reserve(char* dir, zc_job_t* job);
+static int zc_build(zc_job_t* job);
+static void* zc_thread(void* arg);
+
+/************************************************************************/
+/*  I : path of the file to send                                        */
+/*      file to send (open)                                             */
+/*      way to build the compressed file if missing (ZC_WAIT, ZC_ASYNC) */
+/*  P : Gives the compressed version of a file, kept in a directory     */
+/*          next to the one served, and built again when the file has   */
+/*          been modified since (their modification times differ)       */
+/*  O : compressed file (open, to be closed by the caller)              */
+/*      -1 if the file is to be sent raw (not worth compressing, being  */
+/*          built, or error)                                            */
+/************************************************************************/
+int zcache_get(char* path, int fd, int mode)
+{
+    char dir[PATH_MAX] = {0};
+    zc_job_t job = {0}, *async = NULL;
+    struct stat st = {0}, zst = {0};
+    pthread_attr_t attr;
+    pthread_t thread;
+    int zfd = -1;
+
+    if(fstat(fd, &st) == -1 || st.st_size < ZC_MIN || zc_paths(path, dir, &job) == -1)
+        return -1;
+
+    //compressed file up to date (empty if the file is not worth compressing)
+    if((zfd = open(job.entry, O_RDONLY)) != -1)
+    {
+        if(fstat(zfd, &zst) != -1 && zst.st_mtim.tv_sec == st.st_mtim.tv_sec && zst.st_mtim.tv_nsec == st.st_mtim.tv_nsec)
+        {
+            if(zst.st_size > 0)
+                return zfd;
+
+            close(zfd);
+            return -1;
+        }
+        close(zfd);
+    }
+
+    //missing or outdated : build it, unless someone else already does
+    job.mtime = st.st_mtim;
+    if(zc_reserve(dir, &job) == -1)
+        return -1;
+
+    if(mode == ZC_WAIT)
+    {
+        job.src = fd;
+        if(zc_build(&job) == -1 || (zfd = open(job.entry, O_RDONLY)) == -1)
+            return -1;
+
+        if(fstat(zfd, &zst) == -1 || zst.st_size == 0)
+        {
+            close(zfd);
+            return -1;
+        }
+
+        return zfd;
+    }
+
+    //build it in a thread of its own, with its own descriptor of the file
+    if((async = malloc(sizeof(zc_job_t))) == NULL || (job.src = dup(fd)) == -1)
+    {
+        print_error("zcache: unable to prepare the compression of %s", path);
+        free(async);
+        close(job.tmp);
+        unlink(job.tmppath);
+        return -1;
+    }
+    memcpy(async, &job, sizeof(zc_job_t));
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if(pthread_create(&thread, &attr, zc_thread, async) != 0)
+    {
+        print_error("zcache: pthread_create: unable to compress %s", path);
+        close(async->src);
+        close(async->tmp);
+        unlink(async->tmppath);
+        free(async);
+    }
+    pthread_attr_destroy(&attr);
+
+    return -1;
+}
+
+/************************************************************************/
+/*  I : path of the file to send                                        */
+/*      buffer to fill with the cache directory                         */
+/*      job to fill with the paths of the compressed file               */
+/*  P : Builds the paths of the cache directory (the directory of the   */
+/*          file, suffixed with ZC_SUFFIX) and of the compressed file   */
+/*  O : -1 if a path is too long                                        */
+/*       0 otherwise                                                    */
+/************************************************************************/
+static int zc_paths(char* path, char* dir, zc_job_t* job)
+{
+    char* name = strrchr(path, '/');
+    int len = 0;
+
+    if(name)
+        len = snprintf(dir, PATH_MAX, "%.*s%s", (int)(name - path), path, ZC_SUFFIX);
+    else
+        len = snprintf(dir, PATH_MAX, "%s", ZC_SUFFIX);
+    name = (name ? name + 1 : path);
+
+    if(len >= PATH_MAX
+       || snprintf(job->entry, PATH_MAX, "%s/%s%s", dir, name, ZC_EXT) >= PATH_MAX
+       || snprintf(job->tmppath, PATH_MAX, "%s%s", job->entry, ZC_TMP) >= PATH_MAX)
+        return -1;
+
+    return 0;
+}
+
+/************************************************************************/
+/*  I : cache directory                                                 */
+/*      job of which open the compressed file being built               */
+/*  P : Opens the compressed file being built and locks it, so a single */
+/*          process or thread builds it (the lock is released if the    */
+/*          builder dies, the file is then built again from scratch)    */
+/*  O : -1 if already being built, or on error                          */
+/*       0 otherwise                                                    */
+/************************************************************************/
+static int zc_reserve(char* dir, zc_job_t* job)
+{
+    struct stat st = {0}, path = {0};
+
+    if(mkdir(dir, 0755) == -1 && errno != EEXIST)
+    {
+        print_error("zcache: unable to create %s: %s", dir, strerror(errno));
+        return -1;
+    }
+
+    if((job->tmp = open(job->tmppath, O_WRONLY | O_CREAT | O_CLOEXEC, 0644)) == -1)
+    {
+        print_error("zcache: unable to create %s: %s", job->tmppath, strerror(errno));
+        return -1;
+    }
+
+    //locked by another builder, or renamed by it before being locked here
+    if(flock(job->tmp, LOCK_EX | LOCK_NB) == -1 || fstat(job->tmp, &st) == -1
+       || stat(job->tmppath, &path) == -1 || st.st_ino != path.st_ino
+       || ftruncate(job->tmp, 0) == -1)
+    {
+        close(job->tmp);
+        return -1;
+    }
+
+    return 0;
+}
+
+/************************************************************************/
+/*  I : job describing the file to compress                             */
+/*  P : Compresses the file as a zlib stream (left empty if the first   */
+/*          ZC_SAMPLE bytes, or the whole file if shorter, don't shrink */
+/*          below ZC_RATIO %), gives it the modification time of the   */
+/*          file, then renames it to its final name                     */
+/*  O : -1 on error (or if the file has been modified meanwhile)        */
+/*       0 otherwise                                                    */
+/************************************************************************/
+static int zc_build(zc_job_t* job)
+{
+    unsigned char in[ZC_CHUNK], out[ZC_CHUNK];
+    struct timespec times[2] = {{0, UTIME_NOW}, {0, 0}};
+    struct stat st = {0};
+    z_stream zs = {0};
+    ssize_t len = 0, have = 0;
+    off_t offset = 0;
+    int flush = Z_NO_FLUSH, ret = 0;
+
+    if(deflateInit(&zs, ZC_LEVEL) != Z_OK)
+    {
+        close(job->tmp);
+        unlink(job->tmppath);
+        return -1;
+    }
+
+    while(flush != Z_FINISH && ret != -1)
+    {
+        if((len = pread(job->src, in, sizeof(in), offset)) == -1)
+        {
+            ret = -1;
+            break;
+        }
+        offset += len;
+        zs.next_in = in;
+        zs.avail_in = len;
+        flush = (len == 0 ? Z_FINISH : Z_NO_FLUSH);
+
+        do
+        {
+            zs.next_out = out;
+            zs.avail_out = sizeof(out);
+            deflate(&zs, flush);
+            have = sizeof(out) - zs.avail_out;
+            if(have && write(job->tmp, out, have) != have)
+                ret = -1;
+        }while(zs.avail_out == 0 && ret != -1);
+
+        //not worth compressing : the file stays empty
+        if(zs.total_in >= ZC_SAMPLE && zs.total_out * 100 > zs.total_in * ZC_RATIO)
+        {
+            if(ftruncate(job->tmp, 0) == -1)
+                ret = -1;
+            break;
+        }
+    }
+
+    //whole file compressed (shorter than the sample) : not worth it either if it barely shrinks
+    if(ret != -1 && flush == Z_FINISH && zs.total_out * 100 > zs.total_in * ZC_RATIO && ftruncate(job->tmp, 0) == -1)
+        ret = -1;
+    deflateEnd(&zs);
+
+    //the file must not have changed while being compressed
+    if(fstat(job->src, &st) == -1 || st.st_mtim.tv_sec != job->mtime.tv_sec || st.st_mtim.tv_nsec != job->mtime.tv_nsec)
+        ret = -1;
+
+    times[1] = job->mtime;
+    if(ret == -1 || futimens(job->tmp, times) == -1 || rename(job->tmppath, job->entry) == -1)
+    {
+        print_error("zcache: unable to build %s", job->entry);
+        close(job->tmp);
+        unlink(job->tmppath);
+        return -1;
+    }
+
+    close(job->tmp);
+    return 0;
+}
+
+/************************************************************************/
+/*  I : job describing the file to compress (allocated)                 */
+/*  P : Builds a compressed file in the background                      */
+/*  O : /                                                               */
+/************************************************************************/
+static void* zc_thread(void* arg)
+{
+    zc_job_t* job = (zc_job_t*)arg;
+
+    zc_build(job);
+    close(job->src);
+    free(job);
+    return NULL;
+}
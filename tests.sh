@@ -58,13 +58,27 @@ echo -e '\e[1m6- test of a port blocked by firewall (will timeout after 5 sec.)\
 echo -e '\e[1mbin/client clapton 80\e[0m'
 bin/client clapton 80
 
+#test 7
+echo ''
+echo -e '\e[1m7- test of a compact list holding a name as long as a list element (must be rejected as malformed)\e[0m'
+echo -e '\e[1mbin/client localhost 3492\e[0m'
+python3 -c '
+import socket, struct
+l = socket.socket(); l.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1); l.bind(("127.0.0.1", 3492)); l.listen(1)
+c, _ = l.accept(); c.recv(16)
+name = struct.pack(">H", 152) + b"n" * 152
+c.sendall(struct.pack(">IIQ", 1, 0x00020000, len(name)) + name); c.recv(16)' &
+sleep 1
+bin/client localhost 3492
+wait
+
 #
 # Successes tests
 #
 
-#test 7
+#test 8
 echo ''
-echo -e '\e[1m7- test of the server application via hostname\e[0m'
+echo -e '\e[1m8- test of the server application via hostname\e[0m'
 echo -e '\e[1mbin/client clapton 3490\e[0m'
 
 echo "Before the transfer, data/ contains:"